@@ -6,6 +6,15 @@
 #include <boost/nowide/iostream.hpp>
 #include <boost/nowide/fstream.hpp>
 
+#ifndef _WIN32
+#include <cstring>          // strerror()
+#include <errno.h>
+#include <fcntl.h>          // open() flags
+#include <signal.h>
+#include <sys/wait.h>       // waitpid()
+#include <unistd.h>         // fork(), execv(), dup2()
+#endif
+
 namespace lth_loc = leatherman::locale;
 namespace lth_jc = leatherman::json_container;
 namespace lth_exec = leatherman::execution;
@@ -15,6 +24,136 @@ namespace fs = boost::filesystem;
 
 #ifndef _WIN32
 static const fs::perms FILE_PERMS { fs::owner_read | fs::owner_write | fs::group_read };
+
+static int openOutputFile(const std::string& path)
+{
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd == -1) {
+        throw std::runtime_error(lth_loc::format("failed to open {1}: {2}", path, strerror(errno)));
+    }
+    fs::permissions(path, FILE_PERMS);
+    return fd;
+}
+
+static void writeAll(int fd, const std::string& data)
+{
+    size_t offset { 0 };
+    while (offset < data.size()) {
+        auto written = write(fd, data.data() + offset, data.size() - offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EPIPE: the task exited without reading its whole input
+            return;
+        }
+        offset += static_cast<size_t>(written);
+    }
+}
+
+// Runs the task with the stdout and stderr files as its file descriptors 1
+// and 2, so that its output is written there directly, without being copied
+// through pipes by the wrapper; the input is fed through a pipe or, if an
+// input file is specified, the task reads it from that file as its stdin.
+// Returns the exit code of the task (127 if it's not found, as
+// lth_exec::execute). Throws a runtime_error if the task can't be executed.
+static int runTask(const std::string& executable,
+                   const std::vector<std::string>& arguments,
+                   const std::string& input,
+                   const std::string& input_path,
+                   const std::string& stdout_path,
+                   const std::string& stderr_path)
+{
+    auto executable_path = lth_exec::which(executable);
+    if (executable_path.empty()) {
+        return 127;
+    }
+
+    std::vector<std::string> args { executable_path };
+    args.insert(args.end(), arguments.begin(), arguments.end());
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    auto stdout_fd = openOutputFile(stdout_path);
+    auto stderr_fd = openOutputFile(stderr_path);
+
+    // The exec status pipe is closed on a successful exec; otherwise the
+    // child writes errno to it
+    int stdin_pipe[2], status_pipe[2];
+    if (input_path.empty()) {
+        if (pipe(stdin_pipe) == -1) {
+            throw std::runtime_error(lth_loc::format("failed to create a pipe: {1}", strerror(errno)));
+        }
+    } else {
+        stdin_pipe[0] = open(input_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (stdin_pipe[0] == -1) {
+            throw std::runtime_error(lth_loc::format("failed to open {1}: {2}", input_path, strerror(errno)));
+        }
+        stdin_pipe[1] = -1;
+    }
+    if (pipe(status_pipe) == -1) {
+        throw std::runtime_error(lth_loc::format("failed to create a pipe: {1}", strerror(errno)));
+    }
+    fcntl(status_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    auto pid = fork();
+    if (pid == -1) {
+        throw std::runtime_error(lth_loc::format("failed to fork: {1}", strerror(errno)));
+    }
+
+    if (pid == 0) {
+        if (dup2(stdin_pipe[0], STDIN_FILENO) != -1
+                && dup2(stdout_fd, STDOUT_FILENO) != -1
+                && dup2(stderr_fd, STDERR_FILENO) != -1) {
+            close(stdin_pipe[0]);
+            if (stdin_pipe[1] != -1) {
+                close(stdin_pipe[1]);
+            }
+            close(status_pipe[0]);
+            execv(argv[0], argv.data());
+        }
+        int error { errno };
+        while (write(status_pipe[1], &error, sizeof(error)) == -1 && errno == EINTR) {}
+        _exit(127);
+    }
+
+    close(stdin_pipe[0]);
+    close(status_pipe[1]);
+    close(stdout_fd);
+    close(stderr_fd);
+
+    int exec_error { 0 };
+    ssize_t status_size;
+    while ((status_size = read(status_pipe[0], &exec_error, sizeof(exec_error))) == -1
+            && errno == EINTR) {}
+    close(status_pipe[0]);
+
+    if (stdin_pipe[1] != -1) {
+        if (status_size <= 0) {
+            signal(SIGPIPE, SIG_IGN);
+            writeAll(stdin_pipe[1], input);
+        }
+        close(stdin_pipe[1]);
+    }
+
+    int status { 0 };
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            throw std::runtime_error(lth_loc::format("failed to wait for the task: {1}", strerror(errno)));
+        }
+    }
+
+    if (status_size > 0) {
+        throw std::runtime_error(strerror(exec_error));
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
 #endif
 
 int main(int argc, char *argv[])
@@ -23,29 +162,44 @@ int main(int argc, char *argv[])
     std::istream_iterator<char> i_s_i(boost::nowide::cin), end;
     auto params = lth_jc::JsonContainer(std::string { i_s_i, end });
     auto task_executable = params.get<std::string>("executable");
+    // Large inputs are stored on file by pxp-agent
+    auto input_path = params.includes("input_file") ? params.get<std::string>("input_file")
+                                                    : std::string {};
     int exitcode;
 
     try {
+#ifdef _WIN32
+        std::string input;
+        if (input_path.empty()) {
+            input = params.get<std::string>("input");
+        } else if (!lth_file::read(input_path, input)) {
+            throw std::runtime_error(lth_loc::format("failed to read {1}", input_path));
+        }
         auto exec = lth_exec::execute(
             task_executable,
             params.get<std::vector<std::string>>("arguments"),
-            params.get<std::string>("input"),
+            input,
             params.get<std::string>("stdout"),
             params.get<std::string>("stderr"),
             {},       // environment
             nullptr,  // PID callback
             0,        // timeout
-#ifndef _WIN32
-            // Not used on Windows. We instead rely on inherited directory ACLs.
-            FILE_PERMS,
-#endif
+            // No file permissions on Windows. We instead rely on inherited directory ACLs.
             lth_util::option_set<lth_exec::execution_options> {
                 lth_exec::execution_options::thread_safe,
                 lth_exec::execution_options::merge_environment,
                 lth_exec::execution_options::allow_stdin_unread,
                 lth_exec::execution_options::inherit_locale });
         exitcode = exec.exit_code;
-    } catch (lth_exec::execution_exception &e) {
+#else
+        exitcode = runTask(task_executable,
+                           params.get<std::vector<std::string>>("arguments"),
+                           input_path.empty() ? params.get<std::string>("input") : std::string {},
+                           input_path,
+                           params.get<std::string>("stdout"),
+                           params.get<std::string>("stderr"));
+#endif
+    } catch (std::runtime_error &e) {
         // Avoid atomic update to allow testing against /dev/stderr. There should never be
         // multiple processes trying to write this output.
         boost::nowide::ofstream ofs { params.get<std::string>("stderr"), std::ios::binary };
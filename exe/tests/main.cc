@@ -99,6 +99,53 @@ TEST_CASE("runs an executable") {
         REQUIRE(read(dir+"/exit") == "0");
     }
 
+#ifndef _WIN32
+    SECTION("doesn't block if the task doesn't read its input") {
+        auto input = "{\"executable\": \""+executable+"\", \"arguments\": [], "
+            "\"input\": \""+string(1 << 20, 'x')+"\", "
+            "\"stdout\": \""+dir+"/out\", \"stderr\": \""+dir+"/err\", \"exitcode\": \""+dir+"/exit\"}";
+        ofstream foo(executable);
+        foo << "#!/bin/sh" << endl;
+        foo << "echo done" << endl;
+        foo.close();
+        fs::permissions(executable, fs::owner_read|fs::owner_write|fs::owner_exe);
+
+        auto exec = execute(input);
+        REQUIRE(exec.exit_code == 0);
+        REQUIRE(read(dir+"/out") == "done\n");
+        REQUIRE(read(dir+"/exit") == "0");
+    }
+#endif
+
+    SECTION("reads the input from the input file, if specified") {
+        auto input = "{\"executable\": \""+executable+"\", \"arguments\": [], "
+            "\"input_file\": \""+dir+"/in\", "
+            "\"stdout\": \""+dir+"/out\", \"stderr\": \""+dir+"/err\", \"exitcode\": \""+dir+"/exit\"}";
+        ofstream in(dir+"/in");
+        in << "{\"a\": 1}";
+        in.close();
+        ofstream foo(executable);
+#ifdef _WIN32
+        foo << "@echo off" << endl;
+        foo << "more" << endl;
+#else
+        foo << "#!/bin/sh" << endl;
+        foo << "cat -" << endl;
+#endif
+        foo.close();
+#ifndef _WIN32
+        fs::permissions(executable, fs::owner_read|fs::owner_write|fs::owner_exe);
+#endif
+
+        auto exec = execute(input);
+        REQUIRE(exec.exit_code == 0);
+
+        auto output = read(dir+"/out");
+        boost::trim(output);
+        REQUIRE(output == "{\"a\": 1}");
+        REQUIRE(read(dir+"/exit") == "0");
+    }
+
     SECTION("errors if task not found") {
         auto exec = execute(input);
         REQUIRE(exec.output == "");
@@ -31,6 +31,23 @@ class ActionResponse {
     static leatherman::json_container::JsonContainer
     getMetadataFromRequest(const ActionRequest& request);
 
+    // Return the entries of the specified action metadata that are set
+    // when the request is received and never change afterwards.
+    static leatherman::json_container::JsonContainer
+    getRequestMetadata(const leatherman::json_container::JsonContainer& metadata);
+
+    // Return the entries of the specified action metadata that are
+    // updated as the action progresses (status, end, results,
+    // results_are_valid, and execution_error).
+    static leatherman::json_container::JsonContainer
+    getStateMetadata(const leatherman::json_container::JsonContainer& metadata);
+
+    // Return the action metadata made of the request entries of the
+    // first object and of the state entries of the second one.
+    static leatherman::json_container::JsonContainer
+    mergeMetadata(const leatherman::json_container::JsonContainer& request_metadata,
+                  const leatherman::json_container::JsonContainer& state_metadata);
+
     ActionResponse(ModuleType module_type_,
                    const ActionRequest& request_,
                    std::string status_query_transaction_ = "");
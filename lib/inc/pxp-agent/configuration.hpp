@@ -151,6 +151,16 @@ class Configuration
         uint32_t pcp_message_ttl_s;
         uint32_t allowed_keepalive_timeouts;
         uint32_t ping_interval_s;
+        uint64_t task_cache_dir_max_size;
+        uint32_t task_download_limit;
+        uint64_t task_download_rate;
+        std::vector<std::string> task_local_sources;
+        bool task_direct_exec;
+        std::string spool_backend;
+        uint64_t spool_dir_max_size;
+        uint32_t spool_dir_max_transactions;
+        uint32_t spool_dir_max_transactions_per_requester;
+        std::string spool_durability;
     };
 
     /// Reset the HorseWhisperer singleton.
@@ -279,6 +289,9 @@ class Configuration
     // List of masters
     std::vector<std::string> master_uris_;
 
+    // List of local directories hosting pre-staged task files
+    std::vector<std::string> task_local_sources_;
+
     // Path to the logfile
     std::string logfile_;
 
@@ -19,6 +19,11 @@ class ExternalModule : public Module {
     /// before retrieving its output
     static const int OUTPUT_DELAY_MS;
 
+    /// Size of the output of a non-blocking action, on stdout or
+    /// stderr, above which it's moved from memory to its file while
+    /// the action is still running, when the output is piped
+    static const size_t PIPED_OUTPUT_SPILL_THRESHOLD;
+
     /// Run the specified executable; its output must define the
     /// module by providing the metadata in JSON format.
     ///
@@ -69,6 +74,11 @@ class ExternalModule : public Module {
     /// Results Storage
     std::shared_ptr<ResultsStorage> storage_;
 
+    /// Whether the module declared, in its metadata, that it writes
+    /// the output of non-blocking actions on stdout and stderr rather
+    /// than on the output files, so that it's captured by the agent
+    bool piped_output_;
+
     /// Metadata validator
     static const PCPClient::Validator metadata_validator_;
 
@@ -90,7 +100,9 @@ class ExternalModule : public Module {
     /// In case a configuration file was previously loaded for this
     /// action, its content will be added to a "configuration" entry.
     /// If the request's type is RequestType::NonBlocking, the paths
-    /// to the output files will be added to an "output_files" entry.
+    /// to the output files will be added to an "output_files" entry,
+    /// unless the output is piped (see piped_output_), which is not
+    /// supported on Windows.
     std::string getActionArguments(const ActionRequest& request);
 
     ActionResponse callBlockingAction(const ActionRequest& request);
@@ -99,6 +111,16 @@ class ExternalModule : public Module {
     /// the action output to file.
     ActionResponse callNonBlockingAction(const ActionRequest& request);
 
+#ifndef _WIN32
+    /// Runs the non-blocking action capturing its output through
+    /// pipes; the output is kept in memory and also stored in the
+    /// results directory, as it happens for the other non-blocking
+    /// actions, so that it's available to status requests.
+    /// Throws a ProcessingError in case the action can't be started
+    /// or the output can't be stored.
+    ActionResponse callPipedNonBlockingAction(const ActionRequest& request);
+#endif
+
     ActionResponse callAction(const ActionRequest& request) override;
 };
 
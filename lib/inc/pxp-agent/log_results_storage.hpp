@@ -0,0 +1,186 @@
+#ifndef SRC_AGENT_LOG_RESULTS_STORAGE_HPP_
+#define SRC_AGENT_LOG_RESULTS_STORAGE_HPP_
+
+#include <pxp-agent/results_storage.hpp>
+
+#include <cpp-pcp-client/util/thread.hpp>
+
+#include <boost/nowide/fstream.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace PXPAgent {
+
+// Stores the action metadata in an append-only log, instead of a
+// 'metadata' file per results directory, to avoid creating and
+// renaming a file for each metadata update.
+//
+// The log is made of numbered segment files, in the '.transactions'
+// directory of the spool; each record is a line containing JSON. The
+// first record of a transaction contains its whole metadata, split in
+// the request and state entries (as ResultsStorage does); the updates
+// append records with the state entries only, so that the request
+// parameters are written once. A removal marker drops the transaction.
+// An in-memory index, rebuilt at startup by scanning the segments,
+// maps each transaction to the location of its request record and of
+// its latest state, so that find() and getActionMetadata() don't scan
+// the spool, and so that recover() only reads the metadata of the
+// transactions that were running. When most of the log is made of
+// superseded records, it's compacted by copying the live records into
+// a new segment. The appended records are made durable according to
+// the configured mode; in group-commit mode, a single flush of the
+// active segment covers the records appended during the interval.
+//
+// The results directories are still created, as the action processes
+// write their output, PID, and exit code there; metadata files left
+// by the directory backend are imported into the log at startup.
+class LogResultsStorage : public ResultsStorage {
+  public:
+    // Name of the log directory, in the spool
+    static const std::string LOG_DIR;
+
+    // Size above which a new segment is started
+    static const uint64_t SEGMENT_MAX_SIZE;
+
+    LogResultsStorage() = delete;
+
+    // Loads the log, creating its directory if necessary, and imports
+    // the metadata files of the existing results directories.
+    // Throws an Error in case it fails to create or read the log.
+    LogResultsStorage(std::string spool_dir,
+                      std::string spool_dir_ttl,
+                      Quotas quotas = Quotas { 0, 0, 0 },
+                      Util::Durability durability = Util::Durability::Relaxed);
+
+    // Returns true if the metadata of the specified transaction is in
+    // the index, false otherwise.
+    bool find(const std::string& transaction_id) override;
+
+    // Creates the results directory and appends the metadata to the
+    // log. Throws an Error in case of failure.
+    void initializeMetadataFile(
+        const std::string& transaction_id,
+        const leatherman::json_container::JsonContainer& metadata) override;
+
+    // Appends the state entries of the metadata to the log.
+    // Throws an Error in case the transaction is unknown or in case it
+    // fails to write to the log.
+    void updateMetadataFile(
+        const std::string& transaction_id,
+        const leatherman::json_container::JsonContainer& metadata) override;
+
+    // Returns the action metadata, read from the log.
+    // Throws an Error in case the transaction is unknown, it fails to
+    // read the log, or the metadata is invalid.
+    leatherman::json_container::JsonContainer
+    getActionMetadata(const std::string& transaction_id) override;
+
+    // Calls the callback for the transactions whose action was running
+    // when the log was loaded, and still is according to the log; the
+    // purge index is built by the constructor, so the log is not read
+    // again and the number of threads is not used.
+    unsigned int recover(unsigned int num_threads,
+                         RecoveryCallback callback = nullptr,
+                         RecoveryStopper stopper = nullptr) override;
+
+    // Removes the results directories of the expired transactions and
+    // of the ones evicted to meet the quotas, as ResultsStorage::purge()
+    // does, and their metadata from the log. Compacts the log, if
+    // necessary.
+    unsigned int purge(
+        const std::string& ttl,
+        std::vector<std::string> ongoing_transactions,
+        std::function<void(const std::string& dir_path)> purge_callback = nullptr,
+        Util::PurgeBudget* budget = nullptr) override;
+
+    // Compacts the log if more than half of it consists of superseded
+    // records, unless it's being compacted. The metadata can be stored
+    // and read meanwhile. Throws an Error in case of failure.
+    void compactIfNeeded();
+
+    // Number of segment files; for testing
+    size_t numSegments();
+
+  protected:
+    // Also appends a removal marker to the log
+    void removeTransaction(
+        const std::string& transaction_id,
+        const std::function<void(const std::string& dir_path)>& purge_callback,
+        Util::PurgeBudget* budget) override;
+
+  private:
+    struct IndexEntry {
+        uint64_t segment;
+        uint64_t offset;
+        uint64_t size;      // without the trailing newline
+
+        bool operator==(const IndexEntry& other) const
+        {
+            return segment == other.segment && offset == other.offset;
+        }
+    };
+
+    struct TransactionEntry {
+        // Record containing the request entries of the metadata
+        IndexEntry request;
+        // Latest record containing the state entries; the request
+        // record, until the first update
+        IndexEntry state;
+
+        // Total size of the records, including the newlines
+        uint64_t size() const
+        {
+            return request.size + 1 + (state == request ? 0 : state.size + 1);
+        }
+    };
+
+    boost::filesystem::path log_dir_path_;
+    std::unordered_map<std::string, TransactionEntry> index_;
+    // Numbers of the existing segments, in ascending order
+    std::vector<uint64_t> segments_;
+    uint64_t next_segment_;
+    // 0 if no segment is open for appending
+    uint64_t active_segment_;
+    uint64_t active_segment_size_;
+    boost::nowide::ofstream active_segment_stream_;
+    // Total size of the indexed and of the superseded records
+    uint64_t live_bytes_;
+    uint64_t dead_bytes_;
+    // Transactions whose action was running according to the loaded
+    // log, to be checked by recover()
+    std::unordered_set<std::string> running_at_load_;
+    // Set while the log is compacted, without holding the mutex
+    bool compacting_;
+    PCPClient::Util::mutex mutex_;
+
+    boost::filesystem::path segmentPath(uint64_t segment) const;
+    void load();
+    // Loads the records of the segment; the start times of the
+    // transactions are tracked across segments to index the state
+    // records for purging
+    void loadSegment(uint64_t segment,
+                     std::unordered_map<std::string, std::string>& start_times);
+    void trackRunning(const std::string& transaction_id,
+                      const leatherman::json_container::JsonContainer& metadata);
+    void importResultsDirectories();
+    void closeActiveSegment();
+    void appendRequestRecord(const std::string& transaction_id,
+                             const leatherman::json_container::JsonContainer& metadata);
+    void appendStateRecord(const std::string& transaction_id,
+                           const leatherman::json_container::JsonContainer& metadata);
+    void appendRemovalRecord(const std::string& transaction_id);
+    // Removes the transaction from the index, accounting its records
+    // as superseded; returns false if it wasn't indexed
+    bool dropIndexEntry(const std::string& transaction_id);
+    IndexEntry append(const std::string& record);
+    std::string readRecord(const IndexEntry& entry);
+    void compact();
+};
+
+}  // namespace PXPAgent
+
+#endif  // SRC_AGENT_LOG_RESULTS_STORAGE_HPP_
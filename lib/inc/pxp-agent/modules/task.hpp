@@ -5,10 +5,13 @@
 #include <pxp-agent/action_response.hpp>
 #include <pxp-agent/results_storage.hpp>
 #include <pxp-agent/util/purgeable.hpp>
+#include <pxp-agent/util/curl_pool.hpp>
+#include <pxp-agent/util/task_cache_index.hpp>
+#include <pxp-agent/util/tombstones.hpp>
 
 #include <cpp-pcp-client/util/thread.hpp>
 
-#include <leatherman/curl/client.hpp>
+#include <cstdint>
 
 namespace PXPAgent {
 namespace Modules {
@@ -27,7 +30,12 @@ class Task : public PXPAgent::Module, public PXPAgent::Util::Purgeable {
          const std::string& ca,
          const std::string& crt,
          const std::string& key,
-         std::shared_ptr<ResultsStorage> storage);
+         std::shared_ptr<ResultsStorage> storage,
+         uint64_t task_cache_dir_max_size = 0,
+         uint32_t task_download_limit = 0,
+         uint64_t task_download_rate = 0,
+         std::vector<std::string> task_local_sources = {},
+         bool task_direct_exec = false);
 
     /// Whether or not the module supports non-blocking / asynchronous requests.
     bool supportsAsync() override { return true; }
@@ -43,13 +51,19 @@ class Task : public PXPAgent::Module, public PXPAgent::Util::Purgeable {
     /// in the response object's metadata.
     void processOutputAndUpdateMetadata(ActionResponse& response) override;
 
-    /// Utility to purge tasks from the task_cache_dir that have surpassed the ttl.
-    /// If a purge_callback is not specified, the boost filesystem's remove_all() will be used.
+    /// Utility to purge tasks from the task_cache_dir that have surpassed the ttl
+    /// (a zero ttl disables this step). Afterwards, if a maximum cache size was
+    /// specified, the least recently used tasks are evicted until the cache fits it.
+    /// If a purge_callback is not specified, the purged directories are moved to a
+    /// tombstone directory while holding the task cache lock, and then deleted by a
+    /// low priority background thread, so that purging doesn't delay task runs.
+    /// Both steps stop once the budget, if any, is exhausted.
     /// Returns number of directories purged.
     unsigned int purge(
         const std::string& ttl,
         std::vector<std::string> ongoing_transactions,
-        std::function<void(const std::string& dir_path)> purge_callback = nullptr) override;
+        std::function<void(const std::string& dir_path)> purge_callback = nullptr,
+        Util::PurgeBudget* budget = nullptr) override;
 
   private:
     std::shared_ptr<ResultsStorage> storage_;
@@ -57,11 +71,30 @@ class Task : public PXPAgent::Module, public PXPAgent::Util::Purgeable {
     std::string task_cache_dir_;
     PCPClient::Util::mutex task_cache_dir_mutex_;
 
+    /// Maximum size of the task cache in bytes; 0 means unbounded
+    uint64_t task_cache_dir_max_size_;
+
+    /// Cached task files known to be valid, so that running them
+    /// requires no filesystem access nor task_cache_dir_mutex_
+    Util::TaskCacheIndex task_cache_index_;
+
+    /// Purged task directories, pending deletion
+    Util::Tombstones task_cache_tombstones_;
+
     boost::filesystem::path exec_prefix_;
 
+    /// Whether non-blocking tasks are run without the task_wrapper
+    bool task_direct_exec_;
+
     std::vector<std::string> master_uris_;
 
-    leatherman::curl::client client_;
+    /// Local directories hosting pre-staged task files, checked
+    /// before downloading from master_uris_
+    std::vector<std::string> task_local_sources_;
+
+    /// Pooled curl handles sharing connections, TLS sessions and
+    /// DNS lookups among task file downloads
+    Util::CurlPool curl_pool_;
 
     void callBlockingAction(
         const ActionRequest& request,
@@ -77,7 +110,21 @@ class Task : public PXPAgent::Module, public PXPAgent::Util::Purgeable {
         const std::string &input,
         ActionResponse &response);
 
+    /// Verify and, if necessary, download all the files specified
+    /// by a 'prefetch' request into the task cache, without
+    /// executing anything. Throw a ProcessingError in case any of
+    /// the files could not be cached.
+    void prefetchTaskFiles(const ActionRequest& request, ActionResponse& response);
+
     ActionResponse callAction(const ActionRequest& request) override;
+
+    /// Remove the least recently used task directories until the
+    /// size of the task cache fits task_cache_dir_max_size_ or the
+    /// budget, if any, is exhausted.
+    /// Returns number of directories evicted.
+    unsigned int evictLeastRecentlyUsed(
+        std::function<void(const std::string& dir_path)> purge_callback,
+        Util::PurgeBudget* budget);
 };
 
 }  // namespace Modules
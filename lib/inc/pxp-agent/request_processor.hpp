@@ -92,7 +92,8 @@ class RequestProcessor {
     /// Modules configuration
     std::map<std::string, leatherman::json_container::JsonContainer> modules_config_;
 
-    /// To manage the spool purge task
+    /// To manage the spool recovery and purge tasks
+    std::unique_ptr<PCPClient::Util::thread> recovery_thread_ptr_;
     std::unique_ptr<PCPClient::Util::thread> purge_thread_ptr_;
     PCPClient::Util::mutex purge_mutex_;
     PCPClient::Util::condition_variable purge_cond_var_;
@@ -100,6 +101,13 @@ class RequestProcessor {
     /// Flag; set to true if the dtor has been called
     bool is_destructing_;
 
+    /// Flag; set to true once the recovery task is done
+    bool is_recovered_;
+
+    /// Flag; set to true when a new transaction exceeds a spool quota,
+    /// to trigger the purge task
+    bool quota_exceeded_;
+
     /// Resources to purge
     std::vector<std::shared_ptr<Util::Purgeable>> purgeables_;
 
@@ -139,8 +147,26 @@ class RequestProcessor {
     /// Log the loaded modules
     void logLoadedModules() const;
 
-    /// Purge task for resources that need to purge e.g. directories; the purge
-    /// call will be triggered min("1h", gcd(TTLS))
+    /// Recovery task, started with the agent: scans the spool with a pool
+    /// of threads, to build the purge index of the results storage while
+    /// the agent connects, and finalises the transactions whose action
+    /// process ended while the agent was not running.
+    void recoveryTask();
+
+    /// Finalises the specified transaction, found running in the spool
+    /// by the recovery task, if its action process is not running
+    /// anymore, by processing its output, if any, as a status request
+    /// would. Failures are logged.
+    void recoverTransaction(const std::string& transaction_id,
+                            leatherman::json_container::JsonContainer metadata);
+
+    /// Purge task for resources that need to purge e.g. directories; a purge
+    /// round will be triggered once the recovery task is done and then every
+    /// min("1h", gcd(TTLS)); the spool is also purged, between rounds, as soon
+    /// as a new transaction exceeds one of its quotas.
+    /// Each round is performed in budgeted slices, by a low priority thread,
+    /// so that a large backlog causes a steady background load, rather than
+    /// an I/O spike.
     void purgeTask();
 };
 
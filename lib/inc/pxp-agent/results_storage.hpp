@@ -2,13 +2,20 @@
 #define SRC_AGENT_RESULTS_STORAGE_HPP_
 
 #include <pxp-agent/action_output.hpp>
+#include <pxp-agent/util/file_syncer.hpp>
 #include <pxp-agent/util/purgeable.hpp>
 
 #include <leatherman/json_container/json_container.hpp>
 
+#include <cpp-pcp-client/util/thread.hpp>
+
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/date_time/posix_time/ptime.hpp>
 
+#include <cstdint>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -19,43 +26,104 @@ namespace PXPAgent {
 // NOTE(ale): possible execptions thrown while inspecting files are
 // propagated by ResultsStorage methods (more specifically, errors
 // raised by boost::filesystem::exists() are not filtered).
+//
+// Each transaction has its own results directory in the spool, where
+// the action processes write their output, PID, and exit code; this
+// class also stores the action metadata there. The request entries of
+// the metadata, which include the request parameters, are written
+// once, in a 'request' file; the entries that change as the action
+// progresses (status, end, results...) are in a small 'state' file,
+// rewritten at each update. The 'metadata' files written by previous
+// versions, containing both, are still read and are split at the
+// first update. The metadata methods are virtual, so that a
+// different backend can store it elsewhere (see LogResultsStorage).
+// The metadata writes are made durable according to the configured
+// mode (see Util::FileSyncer).
+//
+// The results directories are sharded in two levels of subdirectories
+// named after a hash of the transaction ID ('<spool>/ab/c/<id>'), so
+// that no directory of the spool holds more than a few hundred entries
+// with hundreds of thousands of retained transactions. The results
+// directories of the flat layout of previous versions ('<spool>/<id>')
+// are moved to their shard at startup.
+//
+// The finalised transactions are kept in a purge index, ordered by
+// start time, which is updated whenever the metadata is stored and
+// rebuilt at startup by recover(); as the TTL is the same for every
+// transaction, that's also their expiry order, so that purge() only
+// inspects the expired ones instead of reading the metadata of the
+// whole spool. The index also tracks the number of transactions of
+// each requester and, with a size quota, the size of the finalised
+// transactions, so that the quotas of the spool are enforced by
+// evicting the oldest finalised transactions first.
 class ResultsStorage : public PXPAgent::Util::Purgeable {
   public:
     struct Error : public std::runtime_error {
         explicit Error(std::string const& msg) : std::runtime_error(msg) {}
     };
 
+    // Limits of the spool; 0 disables the corresponding quota
+    struct Quotas {
+        // Total size of the finalised transactions, in bytes
+        uint64_t max_size;
+        // Number of transactions, including the running ones
+        uint32_t max_transactions;
+        uint32_t max_transactions_per_requester;
+    };
+
     ResultsStorage() = delete;
-    ResultsStorage(std::string spool_dir, std::string spool_dir_ttl);
+
+    // Called with the metadata of a transaction whose action was
+    // running, according to its metadata
+    using RecoveryCallback =
+        std::function<void(const std::string& transaction_id,
+                           leatherman::json_container::JsonContainer metadata)>;
+
+    // Returns true if the recovery must stop (e.g. at shutdown)
+    using RecoveryStopper = std::function<bool()>;
+
+    // Moves the results directories of the flat layout to their shard.
+    // The existing transactions are not indexed for purging until
+    // recover() is called.
+    ResultsStorage(std::string spool_dir,
+                   std::string spool_dir_ttl,
+                   Quotas quotas = Quotas { 0, 0, 0 },
+                   Util::Durability durability = Util::Durability::Relaxed);
+
     ResultsStorage(const ResultsStorage&) = delete;
     ResultsStorage& operator=(const ResultsStorage&) = delete;
+    virtual ~ResultsStorage() = default;
+
+    // Returns the path of the results directory of the specified
+    // transaction, which may not exist.
+    boost::filesystem::path getResultsPath(const std::string& transaction_id) const;
 
     // Returns true if a results directory for the specified
     // transaction exists, false otherwise.
-    bool find(const std::string& transaction_id);
+    virtual bool find(const std::string& transaction_id);
 
-    // Initializes the metadata file for the specified transaction.
+    // Initializes the metadata files for the specified transaction.
     // Creates the results directory if necessary.
     // Throws an Error in case it fails to create the directory or
     // in case it fails to write to file.
-    void initializeMetadataFile(
+    virtual void initializeMetadataFile(
         const std::string& transaction_id,
         const leatherman::json_container::JsonContainer& metadata);
 
-    // Updates the metadata file.
+    // Updates the metadata; only its state entries are written.
     // Throws an Error in case there's no results directory for the
     // specified transaction or in case it fails to write to file.
-    void updateMetadataFile(
+    virtual void updateMetadataFile(
         const std::string& transaction_id,
         const leatherman::json_container::JsonContainer& metadata);
 
     // Returns the action metadata specified by the transaction.
     // Throws an Error in case:
-    //  - the metadata file does not exist;
-    //  - the function fails to read the content of the metadata file;
-    //  - the content of the metadata file is not valid JSON;
+    //  - the metadata files do not exist;
+    //  - the function fails to read the content of the metadata files;
+    //  - the content of the metadata files is not valid JSON;
     //  - the metadata does not comply with its JSON schema.
-    leatherman::json_container::JsonContainer
+    virtual leatherman::json_container::JsonContainer
     getActionMetadata(const std::string& transaction_id);
 
     // Returns true if the PID file for the specified transaction
@@ -72,7 +140,8 @@ class ResultsStorage : public PXPAgent::Util::Purgeable {
     // exists, false otherwise.
     bool outputIsReady(const std::string& transaction_id);
 
-    // Returns the output of the action specified by the transaction.
+    // Returns the output of the action specified by the transaction,
+    // decompressing the output files compressed by compressOutput().
     // Throws an Error in case:
     //  - it the stdout file exist, but the function fails to read it;
     //  - it fails to read a valid integer exit code.
@@ -82,19 +151,138 @@ class ResultsStorage : public PXPAgent::Util::Purgeable {
     ActionOutput getOutput(const std::string& transaction_id,
                            int exitcode);
 
+    // Compresses the stdout and stderr files of the specified
+    // transaction, if its action completed (i.e. the exitcode file
+    // exists), replacing them with their compressed version; small
+    // files are left as they are. Failures are logged and leave the
+    // uncompressed files in place.
+    void compressOutput(const std::string& transaction_id);
+
+    // Returns true if any quota is enabled, false otherwise.
+    bool hasQuotas() const;
+
+    // Returns true if the indexed transactions exceed a quota, false
+    // otherwise. Thread safe.
+    bool quotaExceeded();
+
+    // Reads the metadata of the stored transactions, to build the purge
+    // index, and calls the callback, if any, for the ones whose action
+    // was running, so that the caller can finalise the transactions
+    // interrupted while the agent was down. The shards are scanned by
+    // the specified number of threads, which call the callback; the
+    // storage can be used meanwhile. The threads check the stopper, if
+    // any, before each transaction, and stop scanning once it returns
+    // true. Failures are logged.
+    // Returns the number of scanned transactions.
+    virtual unsigned int recover(unsigned int num_threads,
+                                 RecoveryCallback callback = nullptr,
+                                 RecoveryStopper stopper = nullptr);
+
     // Cleans up the spool directory by removing the results
-    // directories that are older than the specified ttl and skipping
-    // the directories related to ongoing tasks.
-    // This function is not thread safe.
+    // directories that are older than the specified ttl, if not 0, and
+    // skipping the directories related to ongoing tasks; the expired
+    // transactions are retrieved from the purge index, oldest first,
+    // until the budget, if any, is exhausted. Then, if a quota is
+    // exceeded, evicts the oldest finalised transactions that are not
+    // ongoing, until the quotas are met or the budget is exhausted.
+    // This function must not be called concurrently with itself.
     // If a purge_callback is not specified, the boost filesystem's
     // remove_all() will be used.
     unsigned int purge(
         const std::string& ttl,
         std::vector<std::string> ongoing_transactions,
-        std::function<void(const std::string& dir_path)> purge_callback = nullptr) override;
+        std::function<void(const std::string& dir_path)> purge_callback = nullptr,
+        Util::PurgeBudget* budget = nullptr) override;
 
-  private:
+  protected:
     boost::filesystem::path spool_dir_path_;
+    Util::FileSyncer file_syncer_;
+
+    // Adds the transaction to the purge index, or updates its
+    // position, if its action is not running and its start time is
+    // valid; otherwise removes it from the index. Thread safe.
+    void indexTransaction(const std::string& transaction_id,
+                          const leatherman::json_container::JsonContainer& metadata);
+
+    // Removes the transaction from the purge index. Thread safe.
+    void unindexTransaction(const std::string& transaction_id);
+
+    // Removes the results directory of the transaction and unindexes
+    // it. Propagates the purge_callback errors.
+    virtual void removeTransaction(
+        const std::string& transaction_id,
+        const std::function<void(const std::string& dir_path)>& purge_callback,
+        Util::PurgeBudget* budget);
+
+    // Returns the indexed transactions started before the specified
+    // instant, oldest first, skipping the ongoing ones. Thread safe.
+    std::vector<std::string> getExpiredTransactions(
+        const boost::posix_time::ptime& instant,
+        const std::vector<std::string>& ongoing_transactions);
+
+    // Creates the results directory, if necessary.
+    // Throws an Error in case of failure.
+    void createResultsDirectory(const std::string& transaction_id);
+
+    // Calls the callback with the transaction ID of each results
+    // directory of the spool, until it returns false.
+    // Propagates the boost::filesystem errors.
+    void eachResultsDirectory(
+        const std::function<bool(const std::string& transaction_id)>& callback);
+
+    // Returns true if the results directory of the specified
+    // transaction contains metadata files, false otherwise.
+    bool hasMetadataFiles(const std::string& transaction_id);
+
+    // Removes the metadata files of the specified transaction.
+    // Propagates the boost::filesystem errors.
+    void removeMetadataFiles(const std::string& transaction_id);
+
+    // Returns the action metadata, after validating it; the source is
+    // only used for logging.
+    // Throws an Error in case of invalid metadata.
+    static leatherman::json_container::JsonContainer
+    validateActionMetadata(const std::string& transaction_id,
+                           leatherman::json_container::JsonContainer metadata,
+                           const std::string& source);
+
+  private:
+    using PurgeIndex = std::multimap<boost::posix_time::ptime, std::string>;
+
+    struct IndexedTransaction {
+        std::string requester;
+        // Size of the results directory, measured once the action is
+        // finalised; 0 without a size quota
+        uint64_t size;
+        bool finalised;
+        // Position in the purge index, if finalised
+        PurgeIndex::iterator position;
+    };
+
+    Quotas quotas_;
+
+    // Finalised transactions by start time
+    PurgeIndex purge_index_;
+    // Every indexed transaction, including the running ones
+    std::unordered_map<std::string, IndexedTransaction> indexed_transactions_;
+    std::unordered_map<std::string, uint32_t> requester_transactions_;
+    uint64_t indexed_size_;
+    PCPClient::Util::mutex purge_index_mutex_;
+
+    bool quotaExceededLocked() const;
+    // Returns the finalised transactions to evict, oldest first, for
+    // the indexed ones to meet the quotas. Thread safe.
+    std::vector<std::string> getTransactionsOverQuota(
+        const std::vector<std::string>& ongoing_transactions);
+    unsigned int evictOverQuota(
+        const std::vector<std::string>& ongoing_transactions,
+        const std::function<void(const std::string& dir_path)>& purge_callback,
+        Util::PurgeBudget* budget);
+    void updateTransactionSize(const std::string& transaction_id);
+
+    void migrateFlatLayout();
+    void recoverTransaction(const std::string& transaction_id,
+                            const RecoveryCallback& callback);
 
     ActionOutput getOutput_(const std::string& transaction_id,
                             bool get_exitcode);
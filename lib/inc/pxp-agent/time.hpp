@@ -43,6 +43,11 @@ class Timestamp {
     // the extended ISO format (refer to boost date_time docs)
     static std::string convertToISO(std::string extended_ISO8601_time);
 
+    // Returns the time point of the specified extended ISO date time
+    // string; throws an Error in case it fails to create it
+    static boost::posix_time::ptime
+    getTimePoint(const std::string& extended_ISO8601_time);
+
     // Throws an Error in case it fails to create a time point from
     // the specified extended ISO date time string
     bool isNewerThan(const std::string& extended_ISO8601_time);
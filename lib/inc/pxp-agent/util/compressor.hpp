@@ -0,0 +1,45 @@
+#ifndef SRC_UTIL_COMPRESSOR_HPP_
+#define SRC_UTIL_COMPRESSOR_HPP_
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Streaming compressor; the content is fed in chunks of arbitrary
+/// size and the compressed content is passed to a callback. Produces
+/// content that can be decompressed by Decompressor.
+class Compressor {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Receives a chunk of compressed content
+    using OutputCallback = std::function<void(const char* data, size_t size)>;
+
+    /// Return a compressor for the specified compression format
+    /// ("gzip" or, if pxp-agent was built with zstd support, "zstd").
+    /// Throw an Error in case the format is not supported.
+    static std::unique_ptr<Compressor> create(const std::string& compression);
+
+    virtual ~Compressor() = default;
+
+    /// Compress the specified chunk of content.
+    /// Throw an Error in case of failure.
+    virtual void compress(const char* data,
+                          size_t size,
+                          const OutputCallback& output_callback) = 0;
+
+    /// Flush the compressed content and end it; no more content can
+    /// be compressed afterwards. Throw an Error in case of failure.
+    virtual void finish(const OutputCallback& output_callback) = 0;
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_COMPRESSOR_HPP_
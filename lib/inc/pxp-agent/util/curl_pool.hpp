@@ -0,0 +1,123 @@
+#ifndef SRC_UTIL_CURL_POOL_HPP_
+#define SRC_UTIL_CURL_POOL_HPP_
+
+#include <pxp-agent/util/token_bucket.hpp>
+
+#include <cpp-pcp-client/util/thread.hpp>
+
+#include <curl/curl.h>
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Thread-safe pool of libcurl easy handles used to perform HTTPS
+/// downloads. All handles are attached to the same curl share object,
+/// so that the connection cache, the TLS sessions and the DNS lookups
+/// are reused by transfers performed by different threads. A handle
+/// is checked out of the pool for the duration of a single transfer
+/// and returned to it afterwards, keeping its own connections warm.
+///
+/// The pool can optionally limit the number of concurrent transfers
+/// (get() blocks until a slot is available) and the aggregate
+/// bandwidth of the transfers.
+class CurlPool {
+  public:
+    /// Failure to set up a transfer; the request should not be
+    /// retried against a different server.
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Failure while transferring data (connection errors, TLS
+    /// errors, timeouts, etc.); the request may succeed against a
+    /// different server.
+    struct TransferError : public Error {
+        explicit TransferError(std::string const& msg) : Error(msg) {}
+    };
+
+    /// Receives a chunk of the response body, together with the
+    /// HTTP status code of the response (206 in case a range request
+    /// was honoured by the server). Exceptions thrown by the callback
+    /// abort the transfer and are propagated by get().
+    using WriteCallback = std::function<void(long status_code, const char* data, size_t size)>;
+
+    /// Maximum number of idle handles kept by the pool
+    static const size_t MAX_IDLE_HANDLES;
+
+    CurlPool() = delete;
+    /// A max_transfers or max_bytes_per_second value of 0 disables
+    /// the relative limit.
+    CurlPool(std::string ca,
+             std::string crt,
+             std::string key,
+             uint32_t max_transfers = 0,
+             uint64_t max_bytes_per_second = 0);
+    CurlPool(const CurlPool&) = delete;
+    CurlPool& operator=(const CurlPool&) = delete;
+    ~CurlPool();
+
+    /// Perform a GET request for the specified HTTPS URL by using a
+    /// pooled handle. The body of a successful response is passed to
+    /// write_callback as it is received; in case of an HTTP status
+    /// code >= 400 the body is instead stored in error_body.
+    /// If range_start is greater than 0, only the content starting
+    /// at that offset is requested (HTTP Range); note that the server
+    /// may ignore that and reply with the whole content (status 200).
+    /// Return the HTTP status code of the response.
+    /// Throw a TransferError in case the transfer fails, an Error in
+    /// case it fails to set up the request.
+    long get(const std::string& url,
+             const WriteCallback& write_callback,
+             std::string& error_body,
+             long connection_timeout_ms,
+             uint64_t range_start = 0);
+
+    /// Number of handles currently waiting in the pool
+    size_t numIdleHandles();
+
+    /// Number of transfers currently in progress
+    uint32_t numActiveTransfers();
+
+  private:
+    std::string ca_;
+    std::string crt_;
+    std::string key_;
+
+    CURLSH* share_;
+
+    /// One mutex per shared data type; used by the share callbacks
+    PCPClient::Util::mutex share_mutexes_[CURL_LOCK_DATA_LAST];
+
+    std::vector<CURL*> idle_handles_;
+    uint32_t num_active_transfers_;
+    const uint32_t max_transfers_;
+    PCPClient::Util::mutex idle_handles_mutex_;
+    PCPClient::Util::condition_variable transfer_slot_cond_var_;
+
+    /// Shared by all transfers
+    TokenBucket bandwidth_;
+
+    /// Wait for a transfer slot, if limited, and return a handle
+    CURL* checkout();
+    void checkin(CURL* handle);
+
+    static void lockShare(CURL* handle,
+                          curl_lock_data data,
+                          curl_lock_access access,
+                          void* user_ptr);
+
+    static void unlockShare(CURL* handle,
+                            curl_lock_data data,
+                            void* user_ptr);
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_CURL_POOL_HPP_
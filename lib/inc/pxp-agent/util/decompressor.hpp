@@ -0,0 +1,45 @@
+#ifndef SRC_UTIL_DECOMPRESSOR_HPP_
+#define SRC_UTIL_DECOMPRESSOR_HPP_
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Streaming decompressor; the compressed content is fed in chunks
+/// of arbitrary size, as they are received, and the decompressed
+/// content is passed to a callback.
+class Decompressor {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Receives a chunk of decompressed content
+    using OutputCallback = std::function<void(const char* data, size_t size)>;
+
+    /// Return a decompressor for the specified compression format
+    /// ("gzip" or, if pxp-agent was built with zstd support, "zstd").
+    /// Throw an Error in case the format is not supported.
+    static std::unique_ptr<Decompressor> create(const std::string& compression);
+
+    virtual ~Decompressor() = default;
+
+    /// Decompress the specified chunk of compressed content.
+    /// Throw an Error in case the content is not valid.
+    virtual void decompress(const char* data,
+                            size_t size,
+                            const OutputCallback& output_callback) = 0;
+
+    /// Throw an Error in case the compressed content fed so far
+    /// is incomplete.
+    virtual void finish() = 0;
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_DECOMPRESSOR_HPP_
@@ -0,0 +1,105 @@
+#ifndef SRC_UTIL_FILE_SYNCER_HPP_
+#define SRC_UTIL_FILE_SYNCER_HPP_
+
+#include <cpp-pcp-client/util/thread.hpp>
+#include <cpp-pcp-client/util/chrono.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+namespace PXPAgent {
+namespace Util {
+
+/// How the files written to the spool are made durable.
+enum class Durability {
+    /// Each write is flushed to disk, with its directory entry, before
+    /// returning.
+    Strict,
+    /// The written files are flushed together, by a background thread,
+    /// at a short interval; a crash loses at most the writes of the
+    /// last interval, but the writes don't wait for the disk.
+    GroupCommit,
+    /// Nothing is flushed; the writes rely on the page cache, which the
+    /// operating system flushes eventually.
+    Relaxed
+};
+
+/// Writes files and makes them durable according to a Durability mode.
+/// In group-commit mode, the files are queued and flushed by a thread
+/// started by the constructor; flushing the same file once per interval
+/// serves all the writes made to it meanwhile (e.g. the records
+/// appended to a log).
+class FileSyncer {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Interval between the flushes of the group-commit mode
+    static const PCPClient::Util::chrono::milliseconds GROUP_COMMIT_INTERVAL;
+
+    FileSyncer() = delete;
+    explicit FileSyncer(
+        Durability durability,
+        PCPClient::Util::chrono::milliseconds group_commit_interval = GROUP_COMMIT_INTERVAL);
+    FileSyncer(const FileSyncer&) = delete;
+    FileSyncer& operator=(const FileSyncer&) = delete;
+
+    /// Stops the group-commit thread, after flushing the queued files.
+    ~FileSyncer();
+
+    Durability durability() const { return durability_; }
+
+    /// Replaces the content of the specified file atomically, by
+    /// writing a temporary file and renaming it, and makes the write
+    /// durable according to the mode; in strict mode, the temporary
+    /// file is flushed before being renamed, so that the file is never
+    /// found empty after a crash.
+    /// Throw an Error in case of failure.
+    void writeFile(const std::string& content,
+                   const std::string& file_path,
+                   boost::filesystem::perms perms);
+
+    /// Make the writes to the specified file durable according to the
+    /// mode. In strict mode, throw an Error in case of failure; in
+    /// group-commit mode, failures are logged.
+    void sync(const std::string& file_path);
+
+    /// Same as above, for the entry of the specified file or directory
+    /// in its parent directory, after creating or renaming it.
+    void syncEntry(const std::string& path);
+
+    /// Flush the queued files now. Failures are logged.
+    void flush();
+
+    /// Flush the content of the specified file to disk.
+    /// Throw an Error in case of failure.
+    static void syncFile(const std::string& file_path);
+
+    /// Flush the entries of the specified directory to disk, where the
+    /// platform supports it. Throw an Error in case of failure.
+    static void syncDirectory(const std::string& dir_path);
+
+  private:
+    Durability durability_;
+    PCPClient::Util::chrono::milliseconds group_commit_interval_;
+
+    std::unordered_set<std::string> queued_files_;
+    std::unordered_set<std::string> queued_directories_;
+    bool stopping_;
+    PCPClient::Util::mutex mutex_;
+    PCPClient::Util::condition_variable cond_var_;
+    std::unique_ptr<PCPClient::Util::thread> group_commit_thread_ptr_;
+
+    void enqueue(std::unordered_set<std::string>& queue, const std::string& path);
+    void groupCommitTask();
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_FILE_SYNCER_HPP_
@@ -0,0 +1,85 @@
+#ifndef SRC_UTIL_POSIX_DETACHED_TASK_HPP_
+#define SRC_UTIL_POSIX_DETACHED_TASK_HPP_
+
+#include <sys/types.h>          // pid_t
+
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Runs a task executable detached from the agent, without the
+/// task_wrapper: the agent forks a minimal reaper process, in a new
+/// session, which execs the task with its stdout and stderr opened
+/// directly on the results files, feeds the input to its stdin,
+/// waits for it and atomically writes its exit code. The reaper
+/// doesn't exec anything itself and only performs system calls after
+/// forking, so a task costs a single exec and no output copying.
+/// As with the task_wrapper, the task keeps running and its exit code
+/// is recorded even if the agent terminates.
+class DetachedTask {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Run the executable and wait for it to complete. The
+    /// environment is merged with the agent's one. The PID callback
+    /// is called with the PID of the reaper process, which lives as
+    /// long as the task. Return the exit code of the task (128 plus
+    /// the signal number if it was killed by a signal, 127 if it
+    /// could not be executed, in which case the reason is written to
+    /// the stderr file).
+    /// Throw an Error if the results files can't be created or if
+    /// the reaper process can't be spawned.
+    static int run(const std::string& executable,
+                   const std::vector<std::string>& arguments,
+                   const std::string& input,
+                   const std::map<std::string, std::string>& environment,
+                   const std::string& stdout_path,
+                   const std::string& stderr_path,
+                   const std::string& exitcode_path,
+                   std::function<void(pid_t)> pid_callback);
+
+    /// As run(), but the task reads its input directly from the
+    /// specified file, opened as its stdin, so that large inputs
+    /// don't need to be held in memory and written through a pipe.
+    /// Throw an Error also if the input file can't be opened.
+    static int runWithInputFile(const std::string& executable,
+                                const std::vector<std::string>& arguments,
+                                const std::string& input_path,
+                                const std::map<std::string, std::string>& environment,
+                                const std::string& stdout_path,
+                                const std::string& stderr_path,
+                                const std::string& exitcode_path,
+                                std::function<void(pid_t)> pid_callback);
+
+    /// Receives a chunk of the output of the process
+    using OutputCallback = std::function<void(const char* data, size_t size)>;
+
+    /// Run the executable, detached from the agent as well, and
+    /// capture its stdout and stderr through pipes, passing them to
+    /// the callbacks as they are received, while feeding the input.
+    /// No reaper process is involved, so the output is lost if the
+    /// agent terminates before the process completes. Return the exit
+    /// code of the process, as run() does.
+    /// Throw an Error if the process can't be spawned. Exceptions
+    /// thrown by the callbacks are propagated, once the process
+    /// terminated.
+    static int capture(const std::string& executable,
+                       const std::vector<std::string>& arguments,
+                       const std::string& input,
+                       const std::map<std::string, std::string>& environment,
+                       std::function<void(pid_t)> pid_callback,
+                       const OutputCallback& stdout_callback,
+                       const OutputCallback& stderr_callback);
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_POSIX_DETACHED_TASK_HPP_
@@ -7,6 +7,11 @@ namespace Util {
 bool processExists(int pid);
 int getPid();
 
+/// Lower the CPU and, where supported, the I/O scheduling priority of
+/// the calling thread, so that background work does not compete with
+/// request processing. Failures are ignored.
+void lowerThreadPriority();
+
 }  // namespace Util
 }  // namespace PXPAgent
 
@@ -1,13 +1,49 @@
 #pragma once
 
+#include <cpp-pcp-client/util/chrono.hpp>
+
 #include <vector>
 #include <string>
 #include <memory>
+#include <cstdint>
+#include <functional>
 #include <boost/filesystem.hpp>
 
 namespace PXPAgent {
 namespace Util {
 
+/// Limits the work done by a purge() call, so that the purge of a
+/// large backlog can be spread over several calls instead of causing
+/// an I/O spike. Once the budget is exhausted, the purgeables stop
+/// removing directories and leave the remaining ones for the next
+/// call. The time limit is measured from the budget construction.
+class PurgeBudget {
+  public:
+    /// A limit of 0 disables the corresponding check.
+    PurgeBudget(unsigned int max_dirs,
+                uint64_t max_bytes,
+                PCPClient::Util::chrono::milliseconds max_duration);
+
+    bool exhausted() const;
+
+    /// Whether the size of the removed directories must be charged.
+    bool limitsBytes() const { return max_bytes_ > 0; }
+
+    /// Account for a removed directory of the specified size.
+    void charge(uint64_t num_bytes);
+
+    unsigned int numDirs() const { return num_dirs_; }
+    uint64_t numBytes() const { return num_bytes_; }
+
+  private:
+    unsigned int max_dirs_;
+    uint64_t max_bytes_;
+    bool limits_duration_;
+    PCPClient::Util::chrono::steady_clock::time_point deadline_;
+    unsigned int num_dirs_;
+    uint64_t num_bytes_;
+};
+
 class Purgeable {
   public:
     Purgeable() {}
@@ -18,10 +54,13 @@ class Purgeable {
         return ttl_;
     }
 
+    /// Purge the expired resources; in case a budget is specified,
+    /// stop once it's exhausted.
     virtual unsigned int purge(
         const std::string& ttl,
         std::vector<std::string> ongoing_transactions,
-        std::function<void(const std::string& dir_path)> purge_callback = nullptr) = 0;
+        std::function<void(const std::string& dir_path)> purge_callback = nullptr,
+        PurgeBudget* budget = nullptr) = 0;
 
   protected:
     static void defaultDirPurgeCallback(const std::string& dir_path)
@@ -29,6 +68,22 @@ class Purgeable {
         boost::filesystem::remove_all(dir_path);
     }
 
+    static bool budgetExhausted(const PurgeBudget* budget)
+    {
+        return budget != nullptr && budget->exhausted();
+    }
+
+    /// Remove the directory by calling the purge callback, then charge
+    /// it to the budget, if any. Propagates the callback exceptions.
+    static void purgeDirectory(
+        const std::string& dir_path,
+        const std::function<void(const std::string& dir_path)>& purge_callback,
+        PurgeBudget* budget);
+
+    /// Return the total size of the regular files contained in the
+    /// specified directory and its subdirectories.
+    static uint64_t getDirectorySize(const boost::filesystem::path& dir_path);
+
   private:
     std::string ttl_;
 };
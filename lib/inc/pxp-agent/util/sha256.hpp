@@ -0,0 +1,36 @@
+#ifndef SRC_UTIL_SHA256_HPP_
+#define SRC_UTIL_SHA256_HPP_
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Incrementally computes a sha256 digest; used to hash task files
+/// while they are being read, downloaded, or extracted.
+class Sha256Digest {
+  public:
+    Sha256Digest();
+    Sha256Digest(const Sha256Digest&) = delete;
+    Sha256Digest& operator=(const Sha256Digest&) = delete;
+    ~Sha256Digest();
+
+    void reset();
+
+    void update(const char* data, size_t size);
+
+    /// Returns the lowercase hex digest; the digest must be reset
+    /// before reuse.
+    std::string hexDigest();
+
+  private:
+    EVP_MD_CTX* mdctx_;
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_SHA256_HPP_
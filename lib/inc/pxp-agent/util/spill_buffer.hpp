@@ -0,0 +1,55 @@
+#ifndef SRC_UTIL_SPILL_BUFFER_HPP_
+#define SRC_UTIL_SPILL_BUFFER_HPP_
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/nowide/fstream.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Accumulates the output of a process in memory, up to a size
+/// threshold; once that's exceeded, the content is moved to a file and
+/// the remaining output is appended to it, so that memory usage stays
+/// bounded. When the output is complete, it's written to the file if
+/// it wasn't spilled, so that it is stored in either case.
+class SpillBuffer {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    SpillBuffer() = delete;
+    SpillBuffer(std::string file_path, size_t threshold, boost::filesystem::perms file_perms);
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    /// Append a chunk of output. Throw an Error in case it fails to
+    /// write the file.
+    void append(const char* data, size_t size);
+
+    /// Store the output on file, if it wasn't spilled already, and
+    /// return it; if it was spilled, it's read back from the file.
+    /// Throw an Error in case of file failure.
+    std::string finish();
+
+    /// Whether the threshold was exceeded
+    bool spilled() const { return spilled_; }
+
+  private:
+    std::string file_path_;
+    size_t threshold_;
+    boost::filesystem::perms file_perms_;
+    std::string buffer_;
+    bool spilled_;
+    boost::nowide::ofstream ofs_;
+
+    void openFile();
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_SPILL_BUFFER_HPP_
@@ -0,0 +1,92 @@
+#ifndef SRC_UTIL_TAR_EXTRACTOR_HPP_
+#define SRC_UTIL_TAR_EXTRACTOR_HPP_
+
+#include <pxp-agent/util/sha256.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/nowide/fstream.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Extracts a tar archive (ustar, including the GNU long name and the
+/// pax path extensions) as a stream, i.e. while its content is being
+/// received, into a destination directory. The sha256 of each regular
+/// file member is computed during the extraction.
+///
+/// Only regular files and directories are supported; links and
+/// special files, as well as absolute member paths and paths
+/// containing '..' components, are rejected.
+class TarExtractor {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    struct Member {
+        /// Path relative to the destination directory, '/' separated
+        std::string path;
+        uint64_t size;
+        std::string sha256;
+    };
+
+    TarExtractor() = delete;
+    TarExtractor(boost::filesystem::path dest_dir, boost::filesystem::perms file_perms);
+    TarExtractor(const TarExtractor&) = delete;
+    TarExtractor& operator=(const TarExtractor&) = delete;
+
+    /// Feed the next chunk of the archive. Throw an Error in case the
+    /// archive is invalid, contains an unsupported member, or in case
+    /// of a filesystem failure.
+    void extract(const char* data, size_t size);
+
+    /// Check that the archive is complete; throw an Error otherwise.
+    void finish();
+
+    /// Remove the extracted content and start over, with a new archive.
+    void reset();
+
+    /// Regular file members extracted so far, in archive order; for a
+    /// path repeated in the archive, only the last member is listed, as
+    /// its content replaced the earlier ones
+    const std::vector<Member>& members() const { return members_; }
+
+  private:
+    enum class State { Header, Data, Padding, End };
+    enum class MemberType { File, LongName, PaxHeader, Skipped };
+
+    boost::filesystem::path dest_dir_;
+    boost::filesystem::perms file_perms_;
+
+    State state_;
+    MemberType member_type_;
+    std::string header_;
+    uint64_t remaining_;
+    uint64_t padding_;
+
+    /// Data of the GNU long name / pax header members
+    std::string metadata_;
+
+    /// Path set by a GNU long name or pax header for the next member
+    std::string next_path_;
+
+    Member member_;
+    boost::nowide::ofstream member_ofs_;
+    Sha256Digest member_digest_;
+    std::vector<Member> members_;
+
+    void processHeader();
+    void processData(const char* data, size_t size);
+    void completeMember();
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_TAR_EXTRACTOR_HPP_
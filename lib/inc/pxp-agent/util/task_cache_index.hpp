@@ -0,0 +1,117 @@
+#ifndef SRC_UTIL_TASK_CACHE_INDEX_HPP_
+#define SRC_UTIL_TASK_CACHE_INDEX_HPP_
+
+#include <cpp-pcp-client/util/thread.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// In-memory index of the task cache. For each <task_cache_dir>/<sha256>
+/// directory, it stores the cached files (path, size, and whether their
+/// sha256 was verified) and the last time the task was used.
+///
+/// The index allows running a cached task without touching the
+/// filesystem: last use times are recorded in memory and persisted
+/// lazily, in batches, as the last modification time of the cache
+/// directories (which is what the task cache purge relies on).
+///
+/// All functions are thread-safe.
+class TaskCacheIndex {
+  public:
+    /// Maximum number of pending last use updates; once reached, the
+    /// updates are persisted by the thread that records the next use
+    static const size_t MAX_PENDING_LAST_USE_UPDATES;
+
+    TaskCacheIndex() = delete;
+    explicit TaskCacheIndex(boost::filesystem::path task_cache_dir);
+    TaskCacheIndex(const TaskCacheIndex&) = delete;
+    TaskCacheIndex& operator=(const TaskCacheIndex&) = delete;
+
+    /// Persists the pending last use updates.
+    ~TaskCacheIndex();
+
+    /// Build the index by scanning the task cache directory; the
+    /// files found are not verified. Temporary and partially
+    /// downloaded files are ignored. Does not throw; failures are
+    /// logged and the affected entries are not indexed.
+    void load();
+
+    /// If the specified file is indexed and was verified, record a
+    /// use of its task, set path to the file path, and return true.
+    /// Return false otherwise.
+    bool lookupVerified(const std::string& sha256,
+                        const std::string& filename,
+                        boost::filesystem::path& path);
+
+    /// Add the specified file as verified and record a use of its task.
+    void addVerified(const std::string& sha256,
+                     const std::string& filename,
+                     const boost::filesystem::path& path,
+                     uintmax_t size);
+
+    /// Remove the specified task from the index (e.g. after its
+    /// cache directory was purged).
+    void remove(const std::string& sha256);
+
+    /// Remove the specified task from the index, unless a use of it
+    /// was recorded after the specified time or was not persisted yet
+    /// by flush(); return true if the task can be purged (including
+    /// when it's not indexed), false otherwise. As the lookups of the
+    /// task fail once it's removed, checking and removing it at once
+    /// ensures that no run obtains its files while they are purged.
+    bool removeIfUnusedSince(const std::string& sha256, std::time_t since);
+
+    /// Return the time of the last use of the specified task recorded
+    /// since the index was loaded, or 0 if there's none (the previous
+    /// uses are reflected by the last modification time of the task
+    /// cache directory).
+    std::time_t lastUse(const std::string& sha256);
+
+    /// Return the number of indexed files
+    size_t numFiles();
+
+    /// Persist the pending last use updates as the last modification
+    /// time of the relative cache directories. Does not throw.
+    void flush();
+
+  private:
+    struct CachedFile {
+        boost::filesystem::path path;
+        uintmax_t size;
+        bool verified;
+    };
+
+    struct CachedTask {
+        std::map<std::string, CachedFile> files;
+        /// 0 if the task was not used since the index was loaded
+        std::time_t last_use;
+        bool last_use_pending;
+    };
+
+    boost::filesystem::path task_cache_dir_;
+
+    /// sha256 -> cached task
+    std::map<std::string, CachedTask> tasks_;
+    size_t num_pending_last_use_updates_;
+    PCPClient::Util::mutex mutex_;
+
+    /// Serializes flushes, so that they can be performed without
+    /// holding mutex_ while accessing the filesystem
+    PCPClient::Util::mutex flush_mutex_;
+
+    /// Must be called while holding mutex_; return true if the
+    /// pending updates must be flushed
+    bool recordUse(CachedTask& task);
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_TASK_CACHE_INDEX_HPP_
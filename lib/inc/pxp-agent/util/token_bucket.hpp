@@ -0,0 +1,38 @@
+#ifndef SRC_UTIL_TOKEN_BUCKET_HPP_
+#define SRC_UTIL_TOKEN_BUCKET_HPP_
+
+#include <cpp-pcp-client/util/thread.hpp>
+#include <cpp-pcp-client/util/chrono.hpp>
+
+#include <cstdint>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Thread-safe token bucket used to limit the rate of a resource
+/// shared by multiple threads (e.g. the download bandwidth). Tokens
+/// are added at the specified rate, up to one second worth of them.
+class TokenBucket {
+  public:
+    /// A rate of 0 disables the limit.
+    explicit TokenBucket(uint64_t tokens_per_second);
+
+    /// Consume the specified number of tokens. In case there are not
+    /// enough, the bucket goes into debt and the caller is put to
+    /// sleep until the debt is paid off at the configured rate; as a
+    /// consequence, concurrent callers share the rate fairly.
+    void consume(uint64_t num_tokens);
+
+    uint64_t rate() const { return tokens_per_second_; }
+
+  private:
+    const uint64_t tokens_per_second_;
+    double tokens_;
+    PCPClient::Util::chrono::steady_clock::time_point last_refill_;
+    PCPClient::Util::mutex mutex_;
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_TOKEN_BUCKET_HPP_
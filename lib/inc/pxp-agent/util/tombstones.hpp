@@ -0,0 +1,69 @@
+#ifndef SRC_UTIL_TOMBSTONES_HPP_
+#define SRC_UTIL_TOMBSTONES_HPP_
+
+#include <cpp-pcp-client/util/thread.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Deletes directories in the background. A directory is "buried" by
+/// renaming it into the tombstone directory, which is cheap and can
+/// be done while holding a lock; the tombstones are then deleted by a
+/// low priority thread, started on the first reap() call.
+///
+/// The tombstone directory must be on the same filesystem as the
+/// buried directories; tombstones left by a previous run (e.g. due to
+/// a shutdown while reaping) are deleted by the next reap() call.
+class Tombstones {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    Tombstones() = delete;
+    explicit Tombstones(boost::filesystem::path tombstone_dir);
+    Tombstones(const Tombstones&) = delete;
+    Tombstones& operator=(const Tombstones&) = delete;
+
+    /// Stops the reaper thread once it's done deleting the current
+    /// tombstone; the remaining ones are left for the next run.
+    ~Tombstones();
+
+    /// Move the specified directory into the tombstone directory.
+    /// Throw an Error in case of failure.
+    void bury(const boost::filesystem::path& dir_path);
+
+    /// Schedule the deletion of all the tombstones, without waiting.
+    void reap();
+
+    /// Block until the scheduled deletions are completed.
+    void waitForReaping();
+
+    const boost::filesystem::path& tombstoneDir() const { return tombstone_dir_; }
+
+  private:
+    boost::filesystem::path tombstone_dir_;
+
+    bool reap_requested_;
+    bool reaping_;
+    std::atomic<bool> stopping_;
+    PCPClient::Util::mutex mutex_;
+    PCPClient::Util::condition_variable reap_cond_var_;
+    PCPClient::Util::condition_variable reaped_cond_var_;
+    std::unique_ptr<PCPClient::Util::thread> reaper_thread_ptr_;
+
+    void reaperTask();
+    void deleteTombstones();
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_TOMBSTONES_HPP_
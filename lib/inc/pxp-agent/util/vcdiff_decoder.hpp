@@ -0,0 +1,45 @@
+#ifndef SRC_UTIL_VCDIFF_DECODER_HPP_
+#define SRC_UTIL_VCDIFF_DECODER_HPP_
+
+#include <boost/filesystem/path.hpp>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+/// Decoder of binary deltas in the VCDIFF format (RFC 3284), as
+/// produced for example by `xdelta3 -S none`. The delta is applied to
+/// a source (base) file to reconstruct the target file, which is
+/// passed to the output callback window by window; memory usage is
+/// bounded by the size of the largest source and target windows.
+///
+/// Supported are the default instruction code table, the default
+/// address cache, and source windows taken from the base file. Not
+/// supported are secondary compression, custom code tables, and
+/// windows whose source is the target itself (VCD_TARGET).
+class VcdiffDecoder {
+  public:
+    struct Error : public std::runtime_error {
+        explicit Error(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Receives a chunk of the reconstructed target file
+    using OutputCallback = std::function<void(const char* data, size_t size)>;
+
+    /// Apply the delta to the base file. Throw an Error in case the
+    /// delta is invalid or unsupported, or if it doesn't match the
+    /// base file (e.g. it refers to data beyond its end or a window
+    /// checksum differs); the output callback may have been called
+    /// for the preceding windows.
+    static void decode(const std::string& delta,
+                       const boost::filesystem::path& base_path,
+                       const OutputCallback& output_callback);
+};
+
+}  // namespace Util
+}  // namespace PXPAgent
+
+#endif  // SRC_UTIL_VCDIFF_DECODER_HPP_
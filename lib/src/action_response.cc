@@ -10,8 +10,10 @@
 #define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.action_response"
 #include <leatherman/logging/logging.hpp>
 
+#include <algorithm>  // std::find
 #include <cassert>
 #include <utility>  // std::forward
+#include <vector>
 
 namespace PXPAgent {
 
@@ -36,6 +38,15 @@ const std::string RESULTS { "results" };
 const std::string RESULTS_ARE_VALID { "results_are_valid" };
 const std::string EXECUTION_ERROR { "execution_error" };
 
+// Entries of the action metadata that change after initialization
+static const std::vector<std::string> STATE_ENTRIES {
+    STATUS, END, RESULTS, RESULTS_ARE_VALID, EXECUTION_ERROR };
+
+static bool isStateEntry(const std::string& key)
+{
+    return std::find(STATE_ENTRIES.begin(), STATE_ENTRIES.end(), key) != STATE_ENTRIES.end();
+}
+
 static PCPClient::Validator getActionMetadataValidator()
 {
     using T_C = PCPClient::TypeConstraint;
@@ -86,6 +97,40 @@ ActionResponse::getMetadataFromRequest(const ActionRequest& request)
     return m;
 }
 
+lth_jc::JsonContainer
+ActionResponse::getRequestMetadata(const lth_jc::JsonContainer& metadata)
+{
+    lth_jc::JsonContainer request_metadata {};
+    for (const auto& key : metadata.keys())
+        if (!isStateEntry(key))
+            request_metadata.set<lth_jc::JsonContainer>(
+                key, metadata.get<lth_jc::JsonContainer>(key));
+    return request_metadata;
+}
+
+lth_jc::JsonContainer
+ActionResponse::getStateMetadata(const lth_jc::JsonContainer& metadata)
+{
+    lth_jc::JsonContainer state_metadata {};
+    for (const auto& key : STATE_ENTRIES)
+        if (metadata.includes(key))
+            state_metadata.set<lth_jc::JsonContainer>(
+                key, metadata.get<lth_jc::JsonContainer>(key));
+    return state_metadata;
+}
+
+lth_jc::JsonContainer
+ActionResponse::mergeMetadata(const lth_jc::JsonContainer& request_metadata,
+                              const lth_jc::JsonContainer& state_metadata)
+{
+    auto metadata = getRequestMetadata(request_metadata);
+    for (const auto& key : STATE_ENTRIES)
+        if (state_metadata.includes(key))
+            metadata.set<lth_jc::JsonContainer>(
+                key, state_metadata.get<lth_jc::JsonContainer>(key));
+    return metadata;
+}
+
 //
 // Public interface
 //
@@ -216,12 +261,14 @@ lth_jc::JsonContainer ActionResponse::toJSON(R_T response_type) const
             break;
         case (R_T::StatusOutput):
         {
+            // NB: the results are set in place, instead of building
+            // a separate object and copying it, as it contains the
+            // output of the action, which may be large
             auto action_status = action_metadata.get<std::string>({ RESULTS, STATUS });
-            lth_jc::JsonContainer action_results {};
-            action_results.set<std::string>(TRANSACTION_ID, status_query_transaction);
+            r.set<std::string>({ RESULTS, TRANSACTION_ID }, status_query_transaction);
 
             if (action_status == ACTION_STATUS_NAMES.at(ActionStatus::Running)) {
-                action_results.set<std::string>(STATUS,
+                r.set<std::string>({ RESULTS, STATUS },
                     ACTION_STATUS_NAMES.at(ActionStatus::Running));
             } else if (action_status == ACTION_STATUS_NAMES.at(ActionStatus::Success)
                     || action_status == ACTION_STATUS_NAMES.at(ActionStatus::Failure)) {
@@ -233,22 +280,22 @@ lth_jc::JsonContainer ActionResponse::toJSON(R_T response_type) const
                 // (in case the output is bad) or, otherwise, to
                 // (exitcode == EXIT_SUCCESS), as done in:
                 // https://github.com/puppetlabs/pxp-agent/blob/1.0.2/lib/src/modules/status.cc#L232
-                action_results.set<int>("exitcode", output.exitcode);
+                r.set<int>({ RESULTS, "exitcode" }, output.exitcode);
 
                 if (action_status == ACTION_STATUS_NAMES.at(ActionStatus::Failure)) {
                     // The output was bad; report a failure
-                    action_results.set<std::string>(STATUS,
+                    r.set<std::string>({ RESULTS, STATUS },
                         ACTION_STATUS_NAMES.at(ActionStatus::Failure));
                 } else {
                     // The output was good; use exitcode
-                    action_results.set<std::string>(STATUS,
+                    r.set<std::string>({ RESULTS, STATUS },
                         (output.exitcode == EXIT_SUCCESS
                             ? ACTION_STATUS_NAMES.at(ActionStatus::Success)
                             : ACTION_STATUS_NAMES.at(ActionStatus::Failure)));
                 }
             } else {
                 // TODO(ale): also UNDETERMINED once PXP v.2 is in
-                action_results.set<std::string>(STATUS,
+                r.set<std::string>({ RESULTS, STATUS },
                     ACTION_STATUS_NAMES.at(ActionStatus::Unknown));
             }
 
@@ -262,16 +309,14 @@ lth_jc::JsonContainer ActionResponse::toJSON(R_T response_type) const
                     err_obj.set("msg", exec_err);
                     lth_jc::JsonContainer result_obj;
                     result_obj.set("_error", err_obj);
-                    action_results.set("stdout", result_obj.toString());
+                    r.set<std::string>({ RESULTS, "stdout" }, result_obj.toString());
                 }
             }
 
-            if (!action_results.includes("stdout") && !output.std_out.empty())
-                action_results.set<std::string>("stdout", output.std_out);
+            if (!r.includes({ RESULTS, "stdout" }) && !output.std_out.empty())
+                r.set<std::string>({ RESULTS, "stdout" }, output.std_out);
             if (!output.std_err.empty())
-                action_results.set<std::string>("stderr", output.std_err);
-
-            r.set<lth_jc::JsonContainer>(RESULTS, action_results);
+                r.set<std::string>({ RESULTS, "stderr" }, output.std_err);
 
             break;
         }
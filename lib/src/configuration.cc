@@ -226,9 +226,10 @@ HW::ParseResult parseArguments(const int argc, char* const argv[])
 
 HW::ParseResult Configuration::parseOptions(int argc, char *argv[])
 {
-    // If parsing options, clear the previous value for master_uris.
-    // This is primarily for testing.
+    // If parsing options, clear the previous value for master_uris
+    // and task_local_sources. This is primarily for testing.
     master_uris_.clear();
+    task_local_sources_.clear();
 
     // Remember the path to the pxp-agent executable used to start
     // this process, it is supposed to be used to start executables
@@ -393,7 +394,18 @@ const Configuration::Agent& Configuration::getAgentConfiguration() const
         static_cast<uint32_t >(HW::GetFlag<int>("association-request-ttl")),
         static_cast<uint32_t >(HW::GetFlag<int>("pcp-message-ttl")),
         static_cast<uint32_t >(HW::GetFlag<int>("allowed-keepalive-timeouts")),
-        static_cast<uint32_t >(HW::GetFlag<int>("ping-interval")) };
+        static_cast<uint32_t >(HW::GetFlag<int>("ping-interval")),
+        static_cast<uint64_t>(HW::GetFlag<int>("task-cache-dir-max-size")) * 1024 * 1024,
+        static_cast<uint32_t>(HW::GetFlag<int>("task-download-limit")),
+        static_cast<uint64_t>(HW::GetFlag<int>("task-download-rate")) * 1024,
+        task_local_sources_,
+        HW::GetFlag<bool>("task-direct-exec"),
+        HW::GetFlag<std::string>("spool-backend"),
+        static_cast<uint64_t>(HW::GetFlag<int>("spool-dir-max-size")) * 1024 * 1024,
+        static_cast<uint32_t>(HW::GetFlag<int>("spool-dir-max-transactions")),
+        static_cast<uint32_t>(HW::GetFlag<int>(
+            "spool-dir-max-transactions-per-requester")),
+        HW::GetFlag<std::string>("spool-durability") };
     return agent_configuration_;
 }
 
@@ -669,6 +681,63 @@ void Configuration::defineDefaultValues()
                     Types::String,
                     DEFAULT_DIR_PURGE_TTL) } });
 
+    defaults_.insert(
+        Option { "spool-backend",
+                 Base_ptr { new Entry<std::string>(
+                    "spool-backend",
+                    "",
+                    lth_loc::translate("How the metadata of the action results is stored: "
+                                       "'directory' (a file in each results directory) "
+                                       "or 'log' (a transaction log), default: 'directory'"),
+                    Types::String,
+                    "directory") } });
+
+    defaults_.insert(
+        Option { "spool-dir-max-size",
+                 Base_ptr { new Entry<int>(
+                    "spool-dir-max-size",
+                    "",
+                    lth_loc::translate("Maximum size of the finalised action results in "
+                                       "MB; the oldest ones are evicted when exceeded, "
+                                       "default: 0 (unbounded)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "spool-dir-max-transactions",
+                 Base_ptr { new Entry<int>(
+                    "spool-dir-max-transactions",
+                    "",
+                    lth_loc::translate("Maximum number of action results in the spool; "
+                                       "the oldest finalised ones are evicted when "
+                                       "exceeded, default: 0 (unbounded)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "spool-dir-max-transactions-per-requester",
+                 Base_ptr { new Entry<int>(
+                    "spool-dir-max-transactions-per-requester",
+                    "",
+                    lth_loc::translate("Maximum number of action results of each "
+                                       "requester in the spool; the oldest finalised "
+                                       "ones are evicted when exceeded, default: 0 "
+                                       "(unbounded)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "spool-durability",
+                 Base_ptr { new Entry<std::string>(
+                    "spool-durability",
+                    "",
+                    lth_loc::translate("How the spool writes are flushed to disk: "
+                                       "'strict' (each write), 'group-commit' (batched "
+                                       "at a short interval) or 'relaxed' (left to the "
+                                       "operating system), default: 'relaxed'"),
+                    Types::String,
+                    "relaxed") } });
+
     defaults_.insert(
         Option { "task-cache-dir-purge-ttl",
                  Base_ptr { new Entry<std::string>(
@@ -680,6 +749,47 @@ void Configuration::defineDefaultValues()
                     Types::String,
                     DEFAULT_DIR_PURGE_TTL) } });
 
+    defaults_.insert(
+        Option { "task-cache-dir-max-size",
+                 Base_ptr { new Entry<int>(
+                    "task-cache-dir-max-size",
+                    "",
+                    lth_loc::translate("Maximum size of the tasks cache in MB; the least "
+                                       "recently used tasks are evicted when exceeded, "
+                                       "default: 0 (unbounded)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "task-download-limit",
+                 Base_ptr { new Entry<int>(
+                    "task-download-limit",
+                    "",
+                    lth_loc::translate("Maximum number of task files downloaded "
+                                       "concurrently, default: 0 (unlimited)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "task-download-rate",
+                 Base_ptr { new Entry<int>(
+                    "task-download-rate",
+                    "",
+                    lth_loc::translate("Maximum aggregate bandwidth of task file "
+                                       "downloads in KB/s, default: 0 (unlimited)"),
+                    Types::Int,
+                    0) } });
+
+    defaults_.insert(
+        Option { "task-direct-exec",
+                 Base_ptr { new Entry<bool>(
+                    "task-direct-exec",
+                    "",
+                    lth_loc::translate("Run non-blocking tasks without the task_wrapper "
+                                       "(ignored on Windows), default: false"),
+                    Types::Bool,
+                    false) } });
+
     defaults_.insert(
         Option { "foreground",
                  Base_ptr { new Entry<bool>(
@@ -833,6 +943,11 @@ void Configuration::parseConfigFile()
                     master_uris_ = config->get_string_list(key);
                 });
                 continue;
+            } else if (key == "task-local-sources") {
+                wrap(key, lth_loc::translate("array of strings"), [&]() {
+                    task_local_sources_ = config->get_string_list(key);
+                });
+                continue;
             } else {
                 LOG_INFO("Ignoring unrecognized option '{1}'", key);
                 continue;
@@ -985,6 +1100,20 @@ void Configuration::validateAndNormalizeOtherSettings()
         check_and_create_dir(val_path, option.first, option.second);
     }
 
+    // The local task sources may be mounted later (e.g. NFS shares),
+    // so they are not required to exist
+    for (auto& source : task_local_sources_) {
+        fs::path source_path { lth_file::tilde_expand(source) };
+        if (!source_path.is_absolute())
+            throw Configuration::Error {
+                lth_loc::format("task-local-sources value \"{1}\" must be an absolute path",
+                                source) };
+        if (!fs::is_directory(source_path))
+            LOG_WARNING("The task-local-sources directory '{1}' does not exist",
+                        source_path.string());
+        source = source_path.string();
+    }
+
     fs::path spool_dir_path = HW::GetFlag<std::string>("spool-dir");
     fs::path tmp_path;
     do {
@@ -1022,6 +1151,18 @@ void Configuration::validateAndNormalizeOtherSettings()
     }
 #endif
 
+    auto spool_backend = HW::GetFlag<std::string>("spool-backend");
+    if (spool_backend != "directory" && spool_backend != "log")
+        throw Configuration::Error {
+            lth_loc::translate("spool-backend must be either 'directory' or 'log'") };
+
+    auto spool_durability = HW::GetFlag<std::string>("spool-durability");
+    if (spool_durability != "strict" && spool_durability != "group-commit"
+            && spool_durability != "relaxed")
+        throw Configuration::Error {
+            lth_loc::translate("spool-durability must be either 'strict', "
+                               "'group-commit' or 'relaxed'") };
+
     for (auto purge_ttl : {"spool-dir-purge-ttl", "task-cache-dir-purge-ttl"}) {
         try {
             Timestamp(HW::GetFlag<std::string>(purge_ttl));
@@ -1032,6 +1173,19 @@ void Configuration::validateAndNormalizeOtherSettings()
         }
     }
 
+    for (auto task_limit : {"task-cache-dir-max-size", "task-download-limit", "task-download-rate"}) {
+        if (HW::GetFlag<int>(task_limit) < 0)
+            throw Configuration::Error {
+                lth_loc::format("{1} must be positive", task_limit) };
+    }
+
+    for (auto spool_limit : {"spool-dir-max-size", "spool-dir-max-transactions",
+                             "spool-dir-max-transactions-per-requester"}) {
+        if (HW::GetFlag<int>(spool_limit) < 0)
+            throw Configuration::Error {
+                lth_loc::format("{1} must be positive", spool_limit) };
+    }
+
     for (auto msg_ttl : {"association-timeout", "association-request-ttl", "pcp-message-ttl"}) {
         if (HW::GetFlag<int>(msg_ttl) < 0)
             throw Configuration::Error {
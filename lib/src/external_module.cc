@@ -2,6 +2,11 @@
 #include <pxp-agent/module_type.hpp>
 #include <pxp-agent/action_output.hpp>
 #include <pxp-agent/configuration.hpp>
+#include <pxp-agent/util/spill_buffer.hpp>
+
+#ifndef _WIN32
+#include <pxp-agent/util/posix/detached_task.hpp>
+#endif
 
 #include <leatherman/execution/execution.hpp>
 
@@ -34,6 +39,7 @@ static const std::string ACTION_SCHEMA_NAME { "action_metadata" };
 
 static const std::string METADATA_CONFIGURATION_ENTRY { "configuration" };
 static const std::string METADATA_ACTIONS_ENTRY { "actions" };
+static const std::string METADATA_PIPED_OUTPUT_ENTRY { "piped_output" };
 
 static const int EXTERNAL_MODULE_FILE_ERROR_EC { 5 };
 
@@ -58,6 +64,7 @@ PCPClient::Validator getMetadataValidator()
     metadata_schema.addConstraint("description", T_C::String, true);
     metadata_schema.addConstraint(METADATA_CONFIGURATION_ENTRY, T_C::Object, false);
     metadata_schema.addConstraint(METADATA_ACTIONS_ENTRY, T_C::Array, true);
+    metadata_schema.addConstraint(METADATA_PIPED_OUTPUT_ENTRY, T_C::Bool, false);
 
     // 'actions' is an array of actions; define the action sub_schema
     PCPClient::Schema action_schema { ACTION_SCHEMA_NAME,
@@ -83,13 +90,17 @@ ExternalModule::ExternalModule(const std::string& path,
                                std::shared_ptr<ResultsStorage> storage)
         : path_ { path },
           config_ { config },
-          storage_ { std::move(storage) }
+          storage_ { std::move(storage) },
+          piped_output_ { false }
 {
     fs::path module_path { path };
     module_name = module_path.stem().string();
     auto metadata = getModuleMetadata();
 
     try {
+        if (metadata.includes(METADATA_PIPED_OUTPUT_ENTRY))
+            piped_output_ = metadata.get<bool>(METADATA_PIPED_OUTPUT_ENTRY);
+
         if (metadata.includes(METADATA_CONFIGURATION_ENTRY)) {
             registerConfiguration(
                 metadata.get<lth_jc::JsonContainer>(METADATA_CONFIGURATION_ENTRY));
@@ -110,13 +121,17 @@ ExternalModule::ExternalModule(const std::string& path,
                                std::shared_ptr<ResultsStorage> storage)
         : path_ { path },
           config_ { "{}" },
-          storage_ { std::move(storage) }
+          storage_ { std::move(storage) },
+          piped_output_ { false }
 {
     fs::path module_path { path };
     module_name = module_path.stem().string();
     auto metadata = getModuleMetadata();
 
     try {
+       if (metadata.includes(METADATA_PIPED_OUTPUT_ENTRY))
+           piped_output_ = metadata.get<bool>(METADATA_PIPED_OUTPUT_ENTRY);
+
        registerActions(metadata);
     } catch (lth_jc::data_error& e) {
         LOG_ERROR("Failed to retrieve metadata of module {1}: {2}",
@@ -142,6 +157,8 @@ void ExternalModule::validateConfiguration()
 
 const int ExternalModule::OUTPUT_DELAY_MS { 100 };
 
+const size_t ExternalModule::PIPED_OUTPUT_SPILL_THRESHOLD { 1024 * 1024 };
+
 void ExternalModule::processOutputAndUpdateMetadata(ActionResponse& response)
 {
     if (response.output.std_out.empty()) {
@@ -296,7 +313,14 @@ std::string ExternalModule::getActionArguments(const ActionRequest& request)
     if (!config_.empty())
         action_args.set<lth_jc::JsonContainer>("configuration", config_);
 
-    if (request.type() == RequestType::NonBlocking) {
+#ifndef _WIN32
+    bool pipes_output { piped_output_ };
+#else
+    // Output pipes are not supported; the output is always on file
+    bool pipes_output { false };
+#endif
+
+    if (request.type() == RequestType::NonBlocking && !pipes_output) {
         fs::path r_d_p { request.resultsDir() };
         lth_jc::JsonContainer output_files {};
         output_files.set<std::string>("stdout", (r_d_p / "stdout").string());
@@ -337,6 +361,15 @@ ActionResponse ExternalModule::callBlockingAction(const ActionRequest& request)
 
 ActionResponse ExternalModule::callNonBlockingAction(const ActionRequest& request)
 {
+#ifndef _WIN32
+    if (piped_output_)
+        return callPipedNonBlockingAction(request);
+#else
+    if (piped_output_)
+        LOG_DEBUG("Output pipes are not supported on Windows; the {1} will be "
+                  "started as a file based task", request.prettyLabel());
+#endif
+
     ActionResponse response { ModuleType::External, request };
     auto action_name = request.action();
     auto input_txt = getActionArguments(request);
@@ -400,6 +433,58 @@ ActionResponse ExternalModule::callNonBlockingAction(const ActionRequest& reques
     return response;
 }
 
+#ifndef _WIN32
+ActionResponse ExternalModule::callPipedNonBlockingAction(const ActionRequest& request)
+{
+    ActionResponse response { ModuleType::External, request };
+    auto input_txt = getActionArguments(request);
+    fs::path results_dir_path { request.resultsDir() };
+
+    LOG_INFO("Starting a task for the {1}; its output will be captured and "
+             "stored in {2}", request.prettyLabel(), request.resultsDir());
+    LOG_TRACE("Input for the {1}: {2}", request.prettyLabel(), input_txt);
+
+    Util::SpillBuffer std_out { (results_dir_path / "stdout").string(),
+                                PIPED_OUTPUT_SPILL_THRESHOLD, NIX_FILE_PERMS };
+    Util::SpillBuffer std_err { (results_dir_path / "stderr").string(),
+                                PIPED_OUTPUT_SPILL_THRESHOLD, NIX_FILE_PERMS };
+    int exitcode;
+
+    try {
+        exitcode = Util::DetachedTask::capture(
+            path_, { request.action() },
+            input_txt,
+            std::map<std::string, std::string>(),  // environment
+            [results_dir_path](pid_t pid) {
+                auto pid_file = (results_dir_path / "pid").string();
+                lth_file::atomic_write_to_file(std::to_string(pid) + "\n", pid_file,
+                                               NIX_FILE_PERMS, std::ios::binary);
+            },
+            [&std_out](const char* data, size_t size) { std_out.append(data, size); },
+            [&std_err](const char* data, size_t size) { std_err.append(data, size); });
+
+        LOG_INFO("The task for the {1} has completed", request.prettyLabel());
+
+        // The exitcode file marks the completion of the task, so it
+        // must be written after the output ones
+        response.output = ActionOutput { exitcode, std_out.finish(), std_err.finish() };
+        lth_file::atomic_write_to_file(std::to_string(exitcode),
+                                       (results_dir_path / "exitcode").string(),
+                                       NIX_FILE_PERMS, std::ios::binary);
+    } catch (const Util::DetachedTask::Error& e) {
+        LOG_ERROR("Failed to start the task for the {1}: {2}", request.prettyLabel(), e.what());
+        throw Module::ProcessingError { lth_loc::translate("failed to start the task") };
+    } catch (const Util::SpillBuffer::Error& e) {
+        LOG_WARNING("Failed to store the output of the {1}: {2}", request.prettyLabel(), e.what());
+        throw Module::ProcessingError {
+            lth_loc::translate("failed to write output on file") };
+    }
+
+    processOutputAndUpdateMetadata(response);
+    return response;
+}
+#endif
+
 ActionResponse ExternalModule::callAction(const ActionRequest& request)
 {
     if (request.type() == RequestType::Blocking) {
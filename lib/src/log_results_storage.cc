@@ -0,0 +1,663 @@
+#include <pxp-agent/log_results_storage.hpp>
+#include <pxp-agent/configuration.hpp>
+#include <pxp-agent/action_response.hpp>
+#include <pxp-agent/time.hpp>
+
+#include <leatherman/file_util/file.hpp>
+#include <leatherman/util/scope_exit.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.log_results_storage"
+#include <leatherman/logging/logging.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cctype>     // isdigit()
+#include <map>
+
+namespace PXPAgent {
+
+namespace fs = boost::filesystem;
+namespace lth_jc   = leatherman::json_container;
+namespace lth_file = leatherman::file_util;
+namespace lth_loc  = leatherman::locale;
+namespace lth_util = leatherman::util;
+namespace pcp_util = PCPClient::Util;
+
+static const std::string REQUEST { "request" };
+static const std::string STATE { "state" };
+static const std::string SEGMENT_EXTENSION { ".log" };
+static const std::string TEMP_EXTENSION { ".tmp" };
+
+// The log is not compacted until the superseded records exceed this
+static const uint64_t COMPACTION_MIN_DEAD_BYTES { 1024 * 1024 };
+
+const std::string LogResultsStorage::LOG_DIR { ".transactions" };
+
+const uint64_t LogResultsStorage::SEGMENT_MAX_SIZE { 8 * 1024 * 1024 };
+
+LogResultsStorage::LogResultsStorage(std::string spool_dir,
+                                     std::string spool_dir_ttl,
+                                     Quotas quotas,
+                                     Util::Durability durability)
+        : ResultsStorage { std::move(spool_dir), std::move(spool_dir_ttl), quotas,
+                           durability },
+          log_dir_path_ { spool_dir_path_ / LOG_DIR },
+          index_ {},
+          segments_ {},
+          next_segment_ { 1 },
+          active_segment_ { 0 },
+          active_segment_size_ { 0 },
+          active_segment_stream_ {},
+          live_bytes_ { 0 },
+          dead_bytes_ { 0 },
+          running_at_load_ {},
+          compacting_ { false }
+{
+    try {
+        if (!fs::exists(log_dir_path_)) {
+            fs::create_directories(log_dir_path_);
+            fs::permissions(log_dir_path_, NIX_DIR_PERMS);
+        }
+    } catch (const fs::filesystem_error& e) {
+        throw Error {
+            lth_loc::format("failed to create the transaction log directory: {1}",
+                            e.what()) };
+    }
+
+    load();
+    importResultsDirectories();
+    compactIfNeeded();
+}
+
+bool LogResultsStorage::find(const std::string& transaction_id)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    return index_.find(transaction_id) != index_.end();
+}
+
+void LogResultsStorage::initializeMetadataFile(const std::string& transaction_id,
+                                               const lth_jc::JsonContainer& metadata)
+{
+    createResultsDirectory(transaction_id);
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    appendRequestRecord(transaction_id, metadata);
+}
+
+void LogResultsStorage::updateMetadataFile(const std::string& transaction_id,
+                                           const lth_jc::JsonContainer& metadata)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    if (index_.find(transaction_id) == index_.end())
+        throw Error {
+            lth_loc::format("no results for the transaction {1}", transaction_id) };
+    appendStateRecord(transaction_id, metadata);
+}
+
+static bool isRunning(const lth_jc::JsonContainer& metadata)
+{
+    return metadata.getWithDefault<std::string>("status", "") == "running";
+}
+
+// Returns the metadata of a record containing the request entries
+static lth_jc::JsonContainer getRequestRecordMetadata(const lth_jc::JsonContainer& record)
+{
+    return ActionResponse::mergeMetadata(record.get<lth_jc::JsonContainer>(REQUEST),
+                                         record.get<lth_jc::JsonContainer>(STATE));
+}
+
+lth_jc::JsonContainer
+LogResultsStorage::getActionMetadata(const std::string& transaction_id)
+{
+    std::string request_txt;
+    std::string state_txt;
+    std::string segment_path;
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        auto entry = index_.find(transaction_id);
+        if (entry == index_.end())
+            throw Error {
+                lth_loc::format("no metadata for the transaction {1}", transaction_id) };
+        request_txt = readRecord(entry->second.request);
+        if (!(entry->second.state == entry->second.request))
+            state_txt = readRecord(entry->second.state);
+        segment_path = segmentPath(entry->second.state.segment).string();
+    }
+
+    lth_jc::JsonContainer metadata;
+    try {
+        metadata = getRequestRecordMetadata(lth_jc::JsonContainer { request_txt });
+        if (!state_txt.empty())
+            metadata = ActionResponse::mergeMetadata(
+                metadata, lth_jc::JsonContainer { state_txt }.get<lth_jc::JsonContainer>(STATE));
+    } catch (const lth_jc::data_error& e) {
+        LOG_DEBUG("The log record of the transaction {1} is invalid: {2}",
+                  transaction_id, e.what());
+        throw Error {
+            lth_loc::format("invalid JSON in metadata file of the transaction {1}",
+                            transaction_id) };
+    }
+
+    return validateActionMetadata(transaction_id, std::move(metadata), segment_path);
+}
+
+unsigned int LogResultsStorage::recover(unsigned int,
+                                        RecoveryCallback callback,
+                                        RecoveryStopper stopper)
+{
+    // The purge index was built while loading the log; only the
+    // transactions that were running when it was loaded are read again
+    std::vector<std::string> transaction_ids {};
+    unsigned int num_transactions { 0 };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        transaction_ids.assign(running_at_load_.begin(), running_at_load_.end());
+        running_at_load_.clear();
+        num_transactions = static_cast<unsigned int>(index_.size());
+    }
+
+    if (callback == nullptr)
+        return num_transactions;
+
+    for (const auto& transaction_id : transaction_ids) {
+        if (stopper != nullptr && stopper()) {
+            LOG_DEBUG("Stopping the recovery of the transaction log");
+            break;
+        }
+
+        try {
+            auto metadata = getActionMetadata(transaction_id);
+            if (isRunning(metadata))
+                callback(transaction_id, std::move(metadata));
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to recover the transaction {1}: {2}",
+                      transaction_id, e.what());
+        }
+    }
+
+    return num_transactions;
+}
+
+unsigned int LogResultsStorage::purge(
+                const std::string& ttl,
+                std::vector<std::string> ongoing_transactions,
+                std::function<void(const std::string& dir_path)> purge_callback,
+                Util::PurgeBudget* budget)
+{
+    auto num_purged_dirs = ResultsStorage::purge(ttl, std::move(ongoing_transactions),
+                                                 std::move(purge_callback), budget);
+
+    try {
+        compactIfNeeded();
+    } catch (const Error& e) {
+        LOG_ERROR("Failed to compact the transaction log: {1}", e.what());
+    }
+
+    return num_purged_dirs;
+}
+
+void LogResultsStorage::removeTransaction(
+                const std::string& transaction_id,
+                const std::function<void(const std::string& dir_path)>& purge_callback,
+                Util::PurgeBudget* budget)
+{
+    purgeDirectory(getResultsPath(transaction_id).string(), purge_callback, budget);
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    appendRemovalRecord(transaction_id);
+}
+
+void LogResultsStorage::compactIfNeeded()
+{
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        if (compacting_ || dead_bytes_ <= COMPACTION_MIN_DEAD_BYTES
+                || dead_bytes_ <= live_bytes_)
+            return;
+        compacting_ = true;
+    }
+
+    lth_util::scope_exit compacting_resetter { [this]() {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        compacting_ = false;
+    } };
+
+    compact();
+}
+
+size_t LogResultsStorage::numSegments()
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    return segments_.size();
+}
+
+//
+// Private interface
+//
+
+fs::path LogResultsStorage::segmentPath(uint64_t segment) const
+{
+    auto name = std::to_string(segment);
+    if (name.size() < 10)
+        name.insert(0, 10 - name.size(), '0');
+    return log_dir_path_ / (name + SEGMENT_EXTENSION);
+}
+
+void LogResultsStorage::load()
+{
+    try {
+        for (fs::directory_iterator it { log_dir_path_ }, end; it != end; ++it) {
+            auto file_name = it->path().filename().string();
+
+            // Left by an interrupted compaction
+            if (it->path().extension() == TEMP_EXTENSION) {
+                fs::remove(it->path());
+                continue;
+            }
+
+            auto stem = it->path().stem().string();
+            if (it->path().extension() != SEGMENT_EXTENSION || stem.empty()
+                    || !std::all_of(stem.begin(), stem.end(), ::isdigit)) {
+                LOG_DEBUG("Ignoring the file '{1}' of the transaction log", file_name);
+                continue;
+            }
+            segments_.push_back(std::stoull(stem));
+        }
+    } catch (const fs::filesystem_error& e) {
+        throw Error {
+            lth_loc::format("failed to list the transaction log: {1}", e.what()) };
+    }
+
+    std::sort(segments_.begin(), segments_.end());
+    std::unordered_map<std::string, std::string> start_times;
+    for (auto segment : segments_)
+        loadSegment(segment, start_times);
+
+    // A new segment is started at each run, so that records are never
+    // appended after a record torn by a crash
+    if (!segments_.empty())
+        next_segment_ = segments_.back() + 1;
+
+    LOG_DEBUG("Loaded {1} transactions from {2} segments of the transaction log",
+              index_.size(), segments_.size());
+}
+
+void LogResultsStorage::loadSegment(uint64_t segment,
+                                    std::unordered_map<std::string, std::string>& start_times)
+{
+    auto segment_path = segmentPath(segment).string();
+    std::string content;
+    if (!lth_file::read(segment_path, content))
+        throw Error { lth_loc::format("failed to read '{1}'", segment_path) };
+
+    uint64_t offset { 0 };
+    while (offset < content.size()) {
+        auto newline = content.find('\n', offset);
+        auto size = (newline == std::string::npos ? content.size() : newline) - offset;
+        auto record_size = size + 1;
+
+        try {
+            lth_jc::JsonContainer record { content.substr(offset, size) };
+            auto transaction_id = record.get<std::string>("transaction_id");
+            IndexEntry entry { segment, offset, size };
+            auto transaction = index_.find(transaction_id);
+
+            if (record.includes(REQUEST)) {
+                auto metadata = getRequestRecordMetadata(record);
+                dropIndexEntry(transaction_id);
+                indexTransaction(transaction_id, metadata);
+                index_.emplace(transaction_id, TransactionEntry { entry, entry });
+                start_times[transaction_id] =
+                    metadata.getWithDefault<std::string>("start", "");
+                trackRunning(transaction_id, metadata);
+                live_bytes_ += record_size;
+            } else if (record.includes(STATE) && transaction != index_.end()) {
+                auto metadata = record.get<lth_jc::JsonContainer>(STATE);
+                metadata.set<std::string>("start", start_times[transaction_id]);
+                indexTransaction(transaction_id, metadata);
+                trackRunning(transaction_id, metadata);
+                if (!(transaction->second.state == transaction->second.request)) {
+                    live_bytes_ -= transaction->second.state.size + 1;
+                    dead_bytes_ += transaction->second.state.size + 1;
+                }
+                transaction->second.state = entry;
+                live_bytes_ += record_size;
+            } else {
+                // A removal marker, or the state of a removed transaction
+                dropIndexEntry(transaction_id);
+                unindexTransaction(transaction_id);
+                start_times.erase(transaction_id);
+                running_at_load_.erase(transaction_id);
+                dead_bytes_ += record_size;
+            }
+        } catch (const lth_jc::data_error& e) {
+            // Most likely the last record, torn by a crash
+            LOG_WARNING("Ignoring an invalid record of the transaction log '{1}' at "
+                        "offset {2}: {3}", segment_path, offset, e.what());
+            dead_bytes_ += record_size;
+        }
+
+        offset += record_size;
+    }
+}
+
+void LogResultsStorage::trackRunning(const std::string& transaction_id,
+                                     const lth_jc::JsonContainer& metadata)
+{
+    if (isRunning(metadata)) {
+        running_at_load_.insert(transaction_id);
+    } else {
+        running_at_load_.erase(transaction_id);
+    }
+}
+
+void LogResultsStorage::importResultsDirectories()
+{
+    unsigned int num_imported { 0 };
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+
+    eachResultsDirectory(
+        [&](const std::string& transaction_id) -> bool {
+            if (index_.count(transaction_id) || !hasMetadataFiles(transaction_id))
+                return true;
+
+            try {
+                auto metadata = ResultsStorage::getActionMetadata(transaction_id);
+                appendRequestRecord(transaction_id, metadata);
+                trackRunning(transaction_id, metadata);
+                removeMetadataFiles(transaction_id);
+                num_imported++;
+            } catch (const std::exception& e) {
+                LOG_WARNING("Failed to import the metadata of the transaction {1} into "
+                            "the transaction log: {2}", transaction_id, e.what());
+            }
+
+            return true;
+        });
+
+    if (num_imported > 0)
+        LOG_INFO("Imported the metadata of {1} transactions into the transaction log",
+                 num_imported);
+}
+
+void LogResultsStorage::closeActiveSegment()
+{
+    if (active_segment_ != 0) {
+        active_segment_stream_.close();
+        active_segment_stream_.clear();
+        active_segment_ = 0;
+    }
+}
+
+LogResultsStorage::IndexEntry LogResultsStorage::append(const std::string& record)
+{
+    if (active_segment_ != 0 && active_segment_size_ > 0
+            && active_segment_size_ + record.size() + 1 > SEGMENT_MAX_SIZE)
+        closeActiveSegment();
+
+    if (active_segment_ == 0) {
+        auto segment = next_segment_++;
+        auto segment_path = segmentPath(segment).string();
+        active_segment_stream_.open(segment_path, std::ios::binary | std::ios::app);
+        if (!active_segment_stream_)
+            throw Error { lth_loc::format("failed to open '{1}'", segment_path) };
+        boost::system::error_code ec;
+        fs::permissions(segment_path, NIX_FILE_PERMS, ec);
+        try {
+            file_syncer_.syncEntry(segment_path);
+        } catch (const Util::FileSyncer::Error& e) {
+            closeActiveSegment();
+            throw Error { e.what() };
+        }
+        segments_.push_back(segment);
+        active_segment_ = segment;
+        active_segment_size_ = 0;
+    }
+
+    IndexEntry entry { active_segment_, active_segment_size_, record.size() };
+    active_segment_stream_.write(record.data(), record.size());
+    active_segment_stream_.put('\n');
+    active_segment_stream_.flush();
+
+    if (!active_segment_stream_) {
+        // Don't append anything else after a partial record
+        closeActiveSegment();
+        throw Error {
+            lth_loc::format("failed to write to '{1}'", segmentPath(entry.segment).string()) };
+    }
+
+    active_segment_size_ += record.size() + 1;
+
+    try {
+        file_syncer_.sync(segmentPath(entry.segment).string());
+    } catch (const Util::FileSyncer::Error& e) {
+        // The record may be lost; don't index it
+        throw Error { e.what() };
+    }
+
+    return entry;
+}
+
+void LogResultsStorage::appendRequestRecord(const std::string& transaction_id,
+                                            const lth_jc::JsonContainer& metadata)
+{
+    lth_jc::JsonContainer record {};
+    record.set<std::string>("transaction_id", transaction_id);
+    record.set<lth_jc::JsonContainer>(REQUEST, ActionResponse::getRequestMetadata(metadata));
+    record.set<lth_jc::JsonContainer>(STATE, ActionResponse::getStateMetadata(metadata));
+
+    auto entry = append(record.toString());
+    indexTransaction(transaction_id, metadata);
+
+    dropIndexEntry(transaction_id);
+    index_.emplace(transaction_id, TransactionEntry { entry, entry });
+    live_bytes_ += entry.size + 1;
+}
+
+void LogResultsStorage::appendStateRecord(const std::string& transaction_id,
+                                          const lth_jc::JsonContainer& metadata)
+{
+    lth_jc::JsonContainer record {};
+    record.set<std::string>("transaction_id", transaction_id);
+    record.set<lth_jc::JsonContainer>(STATE, ActionResponse::getStateMetadata(metadata));
+
+    auto entry = append(record.toString());
+    indexTransaction(transaction_id, metadata);
+
+    // The previous state is superseded, unless it's in the request record
+    auto& transaction = index_.at(transaction_id);
+    if (!(transaction.state == transaction.request)) {
+        live_bytes_ -= transaction.state.size + 1;
+        dead_bytes_ += transaction.state.size + 1;
+    }
+    transaction.state = entry;
+    live_bytes_ += entry.size + 1;
+}
+
+void LogResultsStorage::appendRemovalRecord(const std::string& transaction_id)
+{
+    if (index_.find(transaction_id) == index_.end())
+        return;
+
+    lth_jc::JsonContainer record {};
+    record.set<std::string>("transaction_id", transaction_id);
+    record.set<bool>("removed", true);
+    auto entry = append(record.toString());
+
+    dropIndexEntry(transaction_id);
+    dead_bytes_ += entry.size + 1;
+    unindexTransaction(transaction_id);
+}
+
+bool LogResultsStorage::dropIndexEntry(const std::string& transaction_id)
+{
+    auto transaction = index_.find(transaction_id);
+    if (transaction == index_.end())
+        return false;
+
+    live_bytes_ -= transaction->second.size();
+    dead_bytes_ += transaction->second.size();
+    index_.erase(transaction);
+    return true;
+}
+
+std::string LogResultsStorage::readRecord(const IndexEntry& entry)
+{
+    auto segment_path = segmentPath(entry.segment).string();
+    boost::nowide::ifstream segment_stream { segment_path, std::ios::binary };
+    std::string record(entry.size, '\0');
+
+    if (!segment_stream.seekg(static_cast<std::streamoff>(entry.offset))
+            || !segment_stream.read(&record[0], static_cast<std::streamsize>(entry.size)))
+        throw Error { lth_loc::format("failed to read '{1}'", segment_path) };
+
+    return record;
+}
+
+// Copies the live records into a new segment, then removes the old
+// ones; the new segment has the highest number, so that its records
+// win if a crash leaves some of the old segments behind. These are
+// removed in ascending order, so that a removal record is never
+// deleted before the records it supersedes.
+// The records are copied without holding the mutex, from a snapshot
+// of the index, so that the metadata can be stored meanwhile (the
+// compaction is run by the low priority purge thread); the records
+// appended meanwhile go to newer segments, so that they win over the
+// copied ones, and are kept by updating the index only for the
+// transactions whose records were not superseded.
+void LogResultsStorage::compact()
+{
+    std::vector<std::pair<std::string, TransactionEntry>> transactions;
+    std::vector<uint64_t> old_segments;
+    uint64_t compacted_segment;
+    uint64_t old_bytes;
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        LOG_DEBUG("Compacting the transaction log: {1} bytes of live records, {2} "
+                  "bytes of superseded ones", live_bytes_, dead_bytes_);
+
+        closeActiveSegment();
+        compacted_segment = next_segment_++;
+        old_segments = segments_;
+        old_bytes = live_bytes_ + dead_bytes_;
+        transactions.assign(index_.begin(), index_.end());
+    }
+
+    auto compacted_path = segmentPath(compacted_segment);
+    auto temp_path = compacted_path.string() + TEMP_EXTENSION;
+
+    // The locations of the records in the compacted segment; read each
+    // old segment once; a transaction's state record never precedes its
+    // request record, so that the latter is copied first
+    std::vector<TransactionEntry> compacted_entries;
+    compacted_entries.reserve(transactions.size());
+    std::map<uint64_t, std::vector<IndexEntry*>> entries_by_segment;
+    for (const auto& transaction : transactions) {
+        compacted_entries.push_back(transaction.second);
+        auto& entry = compacted_entries.back();
+        entries_by_segment[entry.request.segment].push_back(&entry.request);
+        if (!(entry.state == entry.request))
+            entries_by_segment[entry.state.segment].push_back(&entry.state);
+    }
+
+    uint64_t offset { 0 };
+    {
+        boost::nowide::ofstream compacted_stream { temp_path, std::ios::binary | std::ios::trunc };
+        for (const auto& segment_entries : entries_by_segment) {
+            auto segment_path = segmentPath(segment_entries.first).string();
+            std::string content;
+            if (!lth_file::read(segment_path, content)) {
+                boost::system::error_code ec;
+                fs::remove(temp_path, ec);
+                throw Error { lth_loc::format("failed to read '{1}'", segment_path) };
+            }
+
+            for (auto entry : segment_entries.second) {
+                if (entry->offset + entry->size > content.size()) {
+                    boost::system::error_code ec;
+                    fs::remove(temp_path, ec);
+                    throw Error { lth_loc::format("'{1}' is truncated", segment_path) };
+                }
+                compacted_stream.write(content.data() + entry->offset, entry->size);
+                compacted_stream.put('\n');
+                entry->segment = compacted_segment;
+                entry->offset = offset;
+                offset += entry->size + 1;
+            }
+        }
+
+        compacted_stream.close();
+        if (compacted_stream.fail()) {
+            boost::system::error_code ec;
+            fs::remove(temp_path, ec);
+            throw Error { lth_loc::format("failed to write '{1}'", temp_path) };
+        }
+    }
+
+    for (size_t idx = 0; idx < transactions.size(); idx++) {
+        if (transactions[idx].second.state == transactions[idx].second.request)
+            compacted_entries[idx].state = compacted_entries[idx].request;
+    }
+
+    // NB: the old segments are removed next, so, unless relying on the
+    // page cache, the compacted one is flushed in any case
+    bool sync { file_syncer_.durability() != Util::Durability::Relaxed };
+
+    try {
+        if (sync)
+            Util::FileSyncer::syncFile(temp_path);
+        fs::permissions(temp_path, NIX_FILE_PERMS);
+        fs::rename(temp_path, compacted_path);
+        if (sync)
+            Util::FileSyncer::syncDirectory(log_dir_path_.string());
+    } catch (const std::exception& e) {
+        boost::system::error_code ec;
+        fs::remove(temp_path, ec);
+        throw Error {
+            lth_loc::format("failed to store the compacted transaction log: {1}", e.what()) };
+    }
+
+    size_t num_transactions;
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+
+        for (size_t idx = 0; idx < transactions.size(); idx++) {
+            auto current = index_.find(transactions[idx].first);
+            const auto& copied = transactions[idx].second;
+
+            // Removed, or stored again, meanwhile
+            if (current == index_.end() || !(current->second.request == copied.request))
+                continue;
+
+            // Unless updated meanwhile, the state is in the compacted segment
+            if (current->second.state == copied.state)
+                current->second.state = compacted_entries[idx].state;
+            current->second.request = compacted_entries[idx].request;
+        }
+
+        // The segments started meanwhile follow the compacted one
+        segments_.erase(segments_.begin(), segments_.begin() + old_segments.size());
+        segments_.insert(segments_.begin(), compacted_segment);
+
+        uint64_t live_bytes { 0 };
+        for (const auto& transaction : index_)
+            live_bytes += transaction.second.size();
+        dead_bytes_ = live_bytes_ + dead_bytes_ - old_bytes + offset - live_bytes;
+        live_bytes_ = live_bytes;
+        num_transactions = index_.size();
+    }
+
+    for (auto segment : old_segments) {
+        boost::system::error_code ec;
+        fs::remove(segmentPath(segment), ec);
+        if (ec)
+            LOG_WARNING("Failed to remove the old transaction log segment '{1}': {2}",
+                        segmentPath(segment).string(), ec.message());
+    }
+
+    LOG_INFO("Compacted the transaction log; {1} transactions in {2} bytes",
+             num_transactions, offset);
+}
+
+}  // namespace PXPAgent
@@ -1,6 +1,14 @@
 #include <pxp-agent/modules/task.hpp>
 #include <pxp-agent/configuration.hpp>
 #include <pxp-agent/time.hpp>
+#include <pxp-agent/util/decompressor.hpp>
+#include <pxp-agent/util/sha256.hpp>
+#include <pxp-agent/util/tar_extractor.hpp>
+#include <pxp-agent/util/vcdiff_decoder.hpp>
+
+#ifndef _WIN32
+#include <pxp-agent/util/posix/detached_task.hpp>
+#endif
 
 #include <cpp-pcp-client/util/chrono.hpp>
 
@@ -8,10 +16,13 @@
 #include <leatherman/execution/execution.hpp>
 #include <leatherman/file_util/file.hpp>
 #include <leatherman/file_util/directory.hpp>
+#include <leatherman/curl/client.hpp>
+#include <leatherman/util/scope_exit.hpp>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/nowide/cstdio.hpp>
+#include <boost/nowide/fstream.hpp>
 #include <boost/system/error_code.hpp>
 
 #include <rapidjson/rapidjson.h>
@@ -23,9 +34,9 @@
 #define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.modules.task"
 #include <leatherman/logging/logging.hpp>
 
-#include <openssl/evp.h>
 #include <curl/curl.h>
 
+#include <algorithm>
 #include <tuple>
 #include <set>
 
@@ -33,7 +44,6 @@ namespace PXPAgent {
 namespace Modules {
 
 namespace fs = boost::filesystem;
-namespace alg = boost::algorithm;
 namespace boost_error = boost::system::errc;
 namespace pcp_util = PCPClient::Util;
 
@@ -42,8 +52,10 @@ namespace lth_file = leatherman::file_util;
 namespace lth_jc   = leatherman::json_container;
 namespace lth_loc  = leatherman::locale;
 namespace lth_curl = leatherman::curl;
+namespace lth_util = leatherman::util;
 
 static const std::string TASK_RUN_ACTION { "run" };
+static const std::string TASK_PREFETCH_ACTION { "prefetch" };
 
 static const std::string TASK_RUN_ACTION_INPUT_SCHEMA { R"(
 {
@@ -74,6 +86,35 @@ static const std::string TASK_RUN_ACTION_INPUT_SCHEMA { R"(
           },
           "sha256": {
             "type": "string"
+          },
+          "compression": {
+            "type": "string",
+            "enum": ["gzip", "zstd"]
+          },
+          "archive": {
+            "type": "string",
+            "enum": ["tar"]
+          },
+          "delta": {
+            "type": "object",
+            "properties": {
+              "base_sha256": {
+                "type": "string"
+              },
+              "uri": {
+                "type": "object",
+                "properties": {
+                  "path": {
+                    "type": "string"
+                  },
+                  "params": {
+                     "type": "object"
+                  }
+                },
+                "required": ["path", "params"]
+              }
+            },
+            "required": ["base_sha256", "uri"]
           }
         },
         "required": ["filename", "uri", "sha256"]
@@ -91,6 +132,75 @@ static const std::string TASK_RUN_ACTION_INPUT_SCHEMA { R"(
 }
 )" };
 
+static const std::string TASK_PREFETCH_ACTION_INPUT_SCHEMA { R"(
+{
+  "type": "object",
+  "properties": {
+    "task": {
+      "type": "string"
+    },
+    "files": {
+      "type": "array",
+      "items": {
+        "type": "object",
+        "properties": {
+          "filename": {
+            "type": "string"
+          },
+          "uri": {
+            "type": "object",
+            "properties": {
+              "path": {
+                "type": "string"
+              },
+              "params": {
+                 "type": "object"
+              }
+            },
+            "required": ["path", "params"]
+          },
+          "sha256": {
+            "type": "string"
+          },
+          "compression": {
+            "type": "string",
+            "enum": ["gzip", "zstd"]
+          },
+          "archive": {
+            "type": "string",
+            "enum": ["tar"]
+          },
+          "delta": {
+            "type": "object",
+            "properties": {
+              "base_sha256": {
+                "type": "string"
+              },
+              "uri": {
+                "type": "object",
+                "properties": {
+                  "path": {
+                    "type": "string"
+                  },
+                  "params": {
+                     "type": "object"
+                  }
+                },
+                "required": ["path", "params"]
+              }
+            },
+            "required": ["base_sha256", "uri"]
+          }
+        },
+        "required": ["filename", "uri", "sha256"]
+      },
+      "minItems": 1
+    }
+  },
+  "required": ["files"]
+}
+)" };
+
 #ifdef _WIN32
 // The extension is required with lth_exec::execute when using a full path.
 static const std::string TASK_WRAPPER_EXECUTABLE { "task_wrapper.exe" };
@@ -113,6 +223,27 @@ static const std::map<std::string, std::function<TaskCommand(std::string)>> BUIL
 #endif
 };
 
+// Subdirectory of the task cache where purged tasks are moved before
+// being deleted; being on the same filesystem makes that a rename
+static const std::string TASK_CACHE_TOMBSTONE_DIR { ".tombstones" };
+
+// Inputs larger than this are written once to the results directory of
+// non-blocking tasks, which read them from there as their stdin, instead
+// of being fed through a pipe
+static const size_t TASK_INPUT_FILE_THRESHOLD { 1024 * 1024 };
+static const std::string TASK_INPUT_FILE { "input" };
+
+// Limits of the input passed via environment variables; a single variable
+// can't exceed 128 KiB on Linux (MAX_ARG_STRLEN) and the whole environment
+// block 32 KiB on Windows
+#ifdef _WIN32
+static const size_t MAX_ENVIRONMENT_VARIABLE_SIZE { 32767 };
+static const size_t MAX_ENVIRONMENT_INPUT_SIZE { 32767 };
+#else
+static const size_t MAX_ENVIRONMENT_VARIABLE_SIZE { 128 * 1024 };
+static const size_t MAX_ENVIRONMENT_INPUT_SIZE { 1024 * 1024 };
+#endif
+
 Task::Task(const fs::path& exec_prefix,
            const std::string& task_cache_dir,
            const std::string& task_cache_dir_purge_ttl,
@@ -120,15 +251,27 @@ Task::Task(const fs::path& exec_prefix,
            const std::string& ca,
            const std::string& crt,
            const std::string& key,
-           std::shared_ptr<ResultsStorage> storage) :
+           std::shared_ptr<ResultsStorage> storage,
+           uint64_t task_cache_dir_max_size,
+           uint32_t task_download_limit,
+           uint64_t task_download_rate,
+           std::vector<std::string> task_local_sources,
+           bool task_direct_exec) :
     Purgeable { task_cache_dir_purge_ttl },
     storage_ { std::move(storage) },
     task_cache_dir_ { task_cache_dir },
+    task_cache_dir_max_size_ { task_cache_dir_max_size },
+    task_cache_index_ { task_cache_dir },
+    task_cache_tombstones_ { fs::path { task_cache_dir } / TASK_CACHE_TOMBSTONE_DIR },
     exec_prefix_ { exec_prefix },
-    master_uris_ { master_uris }
+    task_direct_exec_ { task_direct_exec },
+    master_uris_ { master_uris },
+    task_local_sources_ { std::move(task_local_sources) },
+    curl_pool_ { ca, crt, key, task_download_limit, task_download_rate }
 {
     module_name = "task";
     actions.push_back(TASK_RUN_ACTION);
+    actions.push_back(TASK_PREFETCH_ACTION);
 
     PCPClient::Schema input_schema { TASK_RUN_ACTION, lth_jc::JsonContainer { TASK_RUN_ACTION_INPUT_SCHEMA } };
     PCPClient::Schema output_schema { TASK_RUN_ACTION };
@@ -136,9 +279,14 @@ Task::Task(const fs::path& exec_prefix,
     input_validator_.registerSchema(input_schema);
     results_validator_.registerSchema(output_schema);
 
-    client_.set_ca_cert(ca);
-    client_.set_client_cert(crt, key);
-    client_.set_supported_protocols(CURLPROTO_HTTPS);
+    PCPClient::Schema prefetch_input_schema { TASK_PREFETCH_ACTION,
+                                              lth_jc::JsonContainer { TASK_PREFETCH_ACTION_INPUT_SCHEMA } };
+    PCPClient::Schema prefetch_output_schema { TASK_PREFETCH_ACTION };
+
+    input_validator_.registerSchema(prefetch_input_schema);
+    results_validator_.registerSchema(prefetch_output_schema);
+
+    task_cache_index_.load();
 }
 
 static void addParametersToEnvironment(const lth_jc::JsonContainer &input, std::map<std::string, std::string> &environment)
@@ -149,6 +297,21 @@ static void addParametersToEnvironment(const lth_jc::JsonContainer &input, std::
     }
 }
 
+// Whether the environment variables can be passed to a process; exceeding
+// the system limits would make its execution fail
+static bool fitsInEnvironment(const std::map<std::string, std::string> &environment)
+{
+    size_t total_size { 0 };
+    for (auto& name_value : environment) {
+        auto size = name_value.first.size() + name_value.second.size() + 2;
+        if (size > MAX_ENVIRONMENT_VARIABLE_SIZE) {
+            return false;
+        }
+        total_size += size;
+    }
+    return total_size <= MAX_ENVIRONMENT_INPUT_SIZE;
+}
+
 static TaskCommand getTaskCommand(const fs::path &task_executable)
 {
     auto builtin = BUILTIN_TASK_INTERPRETERS.find(task_executable.extension().string());
@@ -179,7 +342,9 @@ static Module::ProcessingError toModuleProcessingError(const fs::filesystem_erro
 // the PXP agent owner/group (for unix OSes), writable for the PXP agent owner,
 // and executable by both PXP agent owner and group. Returns the path to this directory.
 // Note that the last modified time of the directory is updated, and that this routine
-// will not fail if the directory already exists.
+// will not fail if the directory already exists. As this is done each time the task
+// is run, the last modified time tracks the last use of the task, which is how both
+// the TTL purge and the LRU eviction of the task cache order tasks.
 static fs::path createCacheDir(const fs::path& task_cache_dir, const std::string& sha256) {
     auto cache_dir = task_cache_dir / sha256;
     fs::create_directories(cache_dir);
@@ -188,41 +353,36 @@ static fs::path createCacheDir(const fs::path& task_cache_dir, const std::string
     return cache_dir;
 }
 
-// Computes the sha256 of the file denoted by path. Assumes that
-// the file designated by "path" exists.
-static std::string calculateSha256(const std::string& path) {
-    auto mdctx = EVP_MD_CTX_create();
-
-    EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr);
-    {
-        constexpr std::streamsize CHUNK_SIZE = 0x8000;  // 32 kB
-        char buffer[CHUNK_SIZE];
-        boost::nowide::ifstream ifs(path);
-
-        while (ifs.read(buffer, CHUNK_SIZE)) {
-            EVP_DigestUpdate(mdctx, buffer, CHUNK_SIZE);
-        }
-        if (!ifs.eof()) {
-            EVP_MD_CTX_destroy(mdctx);
-            throw Module::ProcessingError(lth_loc::format("Error while reading {1}", path));
+// Feeds the content of the file denoted by path to the provided digest and, if
+// specified, to chunk_callback. Assumes that the file designated by "path" exists.
+static void updateSha256(Util::Sha256Digest& digest,
+                         const std::string& path,
+                         std::function<void(const char*, size_t)> chunk_callback = nullptr) {
+    constexpr std::streamsize CHUNK_SIZE = 0x8000;  // 32 kB
+    char buffer[CHUNK_SIZE];
+    boost::nowide::ifstream ifs(path, std::ios::binary);
+
+    while (ifs.read(buffer, CHUNK_SIZE)) {
+        digest.update(buffer, CHUNK_SIZE);
+        if (chunk_callback) {
+            chunk_callback(buffer, CHUNK_SIZE);
         }
-        EVP_DigestUpdate(mdctx, buffer, ifs.gcount());
     }
+    if (!ifs.eof()) {
+        throw Module::ProcessingError(lth_loc::format("Error while reading {1}", path));
+    }
+    digest.update(buffer, ifs.gcount());
+    if (chunk_callback) {
+        chunk_callback(buffer, ifs.gcount());
+    }
+}
 
-    unsigned char md_value[EVP_MAX_MD_SIZE];
-    unsigned int md_len;
-
-    EVP_DigestFinal_ex(mdctx, md_value, &md_len);
-    EVP_MD_CTX_destroy(mdctx);
-
-    std::string md_value_hex;
-
-    md_value_hex.reserve(2*md_len);
-    // TODO use boost::algorithm::hex_lower and drop the std::transform below when we upgrade to boost 1.62.0 or newer
-    alg::hex(md_value, md_value+md_len, std::back_inserter(md_value_hex));
-    std::transform(md_value_hex.begin(), md_value_hex.end(), md_value_hex.begin(), ::tolower);
-
-    return md_value_hex;
+// Computes the sha256 of the file denoted by path. Assumes that
+// the file designated by "path" exists.
+static std::string calculateSha256(const std::string& path) {
+    Util::Sha256Digest digest;
+    updateSha256(digest, path);
+    return digest.hexDigest();
 }
 
 static std::string createUrlEndpoint(const lth_jc::JsonContainer& uri) {
@@ -245,66 +405,539 @@ static std::string createUrlEndpoint(const lth_jc::JsonContainer& uri) {
     return url;
 }
 
+// Prefix of the name of a partially downloaded task file that is kept in the
+// cache dir so that the next download attempt can resume it.
+static const std::string PARTIAL_TASK_FILE_PREFIX { "partial_task_" };
+
 // Downloads the file at the specified url into the provided path. Note that the provided
-// "file_path" argument is a temporary file, call it "tempA". Leatherman.curl during
-// the download method will create another temporary file, call it "tempB", to save
-// the downloaded task file's contents in chunks before renaming it to "tempA." The
-// rationale behind this solution is that:
-//    (1) After download, we still need to check "tempA" to ensure that its sha matches
-//    the provided sha. So the downloaded task is not quite a "valid" task after this
-//    method is called; it's still temporary.
+// "file_path" argument is a temporary file; the rationale behind this solution is that:
+//    (1) After download, we still need to check the temporary file to ensure that its
+//    sha matches the provided sha. So the downloaded task is not quite a "valid" task
+//    after this method is called; it's still temporary.
 //
 //    (2) It somewhat simplifies error handling if multiple threads try to download
 //    the same task file.
+// If "file_path" is not empty, it's assumed to contain the beginning of the task file
+// from a previous, interrupted download; only the remaining content is then requested
+// by using an HTTP Range request. The same is done when moving to the next master-uri
+// after a transfer was interrupted. In case a server ignores the range, the file is
+// downloaded from the start.
+// If "compression" is not empty, the file is transferred compressed in the specified
+// format and is decompressed as a stream while being written. Such downloads are not
+// resumed, as the offset of the decompressed content can't be mapped to one of the
+// compressed content; they always start from the beginning.
+// If "extractor" is specified, the (decompressed) content is a tar archive that is
+// extracted as a stream, instead of being written to "file_path", which is not
+// created; such downloads are not resumed either.
+// The decompressed content of the file, including any resumed prefix, is fed to
+// "digest" as it is written, so that its sha256 is known at the end of the download
+// without reading the file again.
+// The transfer is performed with a handle of the pool, so that connections and TLS
+// sessions established with the masters by previous downloads are reused.
 // The downloaded task file's permissions will be set to rwx for user and rx for
-// group for non-Windows OSes.
+// group for non-Windows OSes. The file is not removed in case of failure.
 //
 // The method returns a tuple (success, err_msg). success is true if the file was downloaded;
-// false otherwise. err_msg contains the most recent http_file_download_exception's error
-// message; it is initially empty.
+// false otherwise. err_msg contains the most recent transfer error message; it is
+// initially empty.
 static std::tuple<bool, std::string> downloadTaskFile(const std::vector<std::string>& master_uris,
-                                                      lth_curl::client& client,
+                                                      Util::CurlPool& curl_pool,
                                                       const fs::path& file_path,
-                                                      const lth_jc::JsonContainer& uri) {
+                                                      const lth_jc::JsonContainer& uri,
+                                                      const std::string& compression,
+                                                      Util::Sha256Digest& digest,
+                                                      Util::TarExtractor* extractor = nullptr) {
     auto endpoint = createUrlEndpoint(uri);
     std::tuple<bool, std::string> result = std::make_tuple(false, "");
+    bool resumable { compression.empty() && extractor == nullptr };
+
+    digest.reset();
+    uint64_t offset { 0 };
+    try {
+        if (resumable && fs::exists(file_path)) {
+            updateSha256(digest, file_path.string());
+            offset = fs::file_size(file_path);
+        }
+        if (extractor == nullptr) {
+            boost::nowide::ofstream { file_path.string(),
+                                      std::ios::binary | (resumable ? std::ios::app : std::ios::trunc) };
+            fs::permissions(file_path, NIX_TASK_FILE_PERMS);
+        }
+    } catch (fs::filesystem_error& e) {
+        throw Module::ProcessingError(lth_loc::format("Downloading the task file failed. Reason: {1}", e.what()));
+    }
+
+    if (!compression.empty()) {
+        try {
+            // Fail early in case the compression is not supported
+            Util::Decompressor::create(compression);
+        } catch (Util::Decompressor::Error& e) {
+            throw Module::ProcessingError(lth_loc::format("Downloading the task file failed. Reason: {1}", e.what()));
+        }
+    }
+
+    // Discards what was downloaded so far
+    auto start_over = [&](boost::nowide::ofstream& ofs) {
+        if (extractor != nullptr) {
+            extractor->reset();
+        } else {
+            ofs.close();
+            ofs.open(file_path.string(), std::ios::binary | std::ios::trunc);
+        }
+        digest.reset();
+        offset = 0;
+    };
+
     for (auto& master_uri : master_uris) {
         auto url = master_uri + endpoint;
-        lth_curl::request req(url);
-        // timeout from connection after one minute, can configure
-        req.connection_timeout(60000);
+        bool range_rejected { false };
+
+        do {
+            try {
+                boost::nowide::ofstream ofs;
+                if (extractor == nullptr) {
+                    ofs.open(file_path.string(), std::ios::binary | std::ios::app);
+                    if (!ofs) {
+                        throw Util::CurlPool::Error {
+                            lth_loc::format("failed to open {1} for writing", file_path.string()) };
+                    }
+                }
+
+                std::unique_ptr<Util::Decompressor> decompressor;
+                if (!resumable) {
+                    start_over(ofs);
+                }
+                if (!compression.empty()) {
+                    decompressor = Util::Decompressor::create(compression);
+                }
+
+                auto range_start = offset;
+                if (range_start > 0) {
+                    LOG_DEBUG("Resuming the download of the task file from '{1}' at byte {2}",
+                              url, range_start);
+                }
+
+                std::string error_body;
+                // timeout from connection after one minute, can configure
+                auto status_code = curl_pool.get(
+                    url,
+                    [&](long status_code, const char* data, size_t size) {
+                        if (range_start > 0 && status_code != 206) {
+                            // The server ignored the range; start over
+                            LOG_DEBUG("'{1}' does not support range requests; downloading "
+                                      "the whole task file", url);
+                            start_over(ofs);
+                            range_start = 0;
+                        }
+                        auto write_output = [&](const char* output, size_t output_size) {
+                            if (extractor != nullptr) {
+                                extractor->extract(output, output_size);
+                            } else if (!ofs.write(output, output_size)) {
+                                throw Util::CurlPool::Error {
+                                    lth_loc::format("failed to write to {1}", file_path.string()) };
+                            }
+                            digest.update(output, output_size);
+                        };
+
+                        if (decompressor) {
+                            decompressor->decompress(data, size, write_output);
+                        } else {
+                            write_output(data, size);
+                        }
+                        offset += size;
+                    },
+                    error_body,
+                    60000,
+                    range_start);
+                if (decompressor && status_code < 400) {
+                    decompressor->finish();
+                }
+                if (extractor != nullptr && status_code < 400) {
+                    extractor->finish();
+                }
+                if (extractor == nullptr) {
+                    ofs.close();
+                }
+
+                if (status_code == 416 && range_start > 0 && !range_rejected) {
+                    // The partial file is not a prefix of the task file
+                    LOG_DEBUG("'{1}' rejected the range of the partially downloaded task "
+                              "file; downloading it from the start", url);
+                    start_over(ofs);
+                    ofs.close();
+                    range_rejected = true;
+                    continue;
+                }
+                if (status_code >= 400) {
+                    throw Util::CurlPool::TransferError {
+                        lth_loc::format("{1} returned a response with HTTP status {2}. Response body: {3}",
+                                        url, status_code, error_body) };
+                }
+                if (extractor == nullptr && ofs.fail()) {
+                    throw Util::CurlPool::Error {
+                        lth_loc::format("failed to write to {1}", file_path.string()) };
+                }
+
+                std::get<0>(result) = true;
+                return result;
+            } catch (Util::CurlPool::TransferError& e) {
+                // Server-side error, do nothing here -- we want to try the next master-uri,
+                // resuming from what was downloaded so far.
+                LOG_WARNING("Downloading the task file from the master-uri '{1}' failed. Reason: {2}", master_uri, e.what());
+                std::get<1>(result) = e.what();
+            } catch (Util::Decompressor::Error& e) {
+                // Corrupted or truncated content; try the next master-uri.
+                LOG_WARNING("Decompressing the task file downloaded from the master-uri '{1}' failed. Reason: {2}",
+                            master_uri, e.what());
+                std::get<1>(result) = e.what();
+            } catch (Util::TarExtractor::Error& e) {
+                // Corrupted, truncated, or unsupported archive; try the next master-uri.
+                LOG_WARNING("Extracting the task archive downloaded from the master-uri '{1}' failed. Reason: {2}",
+                            master_uri, e.what());
+                std::get<1>(result) = e.what();
+            } catch (Util::CurlPool::Error& e) {
+                throw Module::ProcessingError(lth_loc::format("Downloading the task file failed. Reason: {1}", e.what()));
+            } catch (fs::filesystem_error& e) {
+                throw Module::ProcessingError(lth_loc::format("Downloading the task file failed. Reason: {1}", e.what()));
+            }
+            break;
+        } while (true);
+    }
+
+    return result;
+}
+
+// Keeps the content of the temporary file of a failed download as the partial
+// task file, so that the next download attempt can resume it; discards it in case
+// nothing was downloaded.
+static void keepPartialTaskFile(const fs::path& tempname, const fs::path& partial_path) {
+    boost::system::error_code ec;
+    if (fs::file_size(tempname, ec) > 0 && !ec) {
+        fs::rename(tempname, partial_path, ec);
+        if (!ec) {
+            LOG_DEBUG("Keeping the partially downloaded task file {1}", partial_path.string());
+            return;
+        }
+    }
+    fs::remove(tempname, ec);
+}
+
+// Returns the paths where a pre-staged copy of the task file with the specified
+// sha256 may be found in the local source directories: <source>/<sha256>/<filename>
+// (the layout of the task cache, so that another cache can be used as a source)
+// and <source>/<sha256>. Only existing regular files are returned.
+static std::vector<fs::path> findLocalTaskFiles(const std::vector<std::string>& local_sources,
+                                                const std::string& sha256,
+                                                const std::string& filename) {
+    std::vector<fs::path> local_files;
+    for (const auto& source : local_sources) {
+        std::vector<fs::path> candidates { fs::path(source) / sha256 };
+        if (!filename.empty()) {
+            candidates.insert(candidates.begin(), fs::path(source) / sha256 / filename);
+        }
+        for (const auto& candidate : candidates) {
+            boost::system::error_code ec;
+            if (fs::is_regular_file(candidate, ec) && !ec) {
+                local_files.push_back(candidate);
+            }
+        }
+    }
+    return local_files;
+}
+
+// Fills the task cache with a pre-staged copy of the task file, if one is found in
+// the local source directories: the local file is copied to a temporary file of
+// cache_dir which, if its sha matches the provided one, is atomically renamed to
+// filepath. Returns true in that case, false if no valid local copy was found.
+// NB: the file is not hardlinked, as the cached copy must not change with the
+// pre-staged one (the cached files are verified once) nor change its mode.
+static bool fetchLocalTaskFile(const std::vector<std::string>& local_sources,
+                               const fs::path& cache_dir,
+                               const fs::path& filepath,
+                               const std::string& filename,
+                               const std::string& sha256) {
+    for (const auto& local_file : findLocalTaskFiles(local_sources, sha256, filename)) {
+        auto tempname = cache_dir / fs::unique_path("temp_task_%%%%-%%%%-%%%%-%%%%");
+        boost::system::error_code ec;
+        fs::copy_file(local_file, tempname, ec);
+        if (ec) {
+            LOG_WARNING("Failed to copy the local task file {1}: {2}", local_file.string(), ec.message());
+            fs::remove(tempname, ec);
+            continue;
+        }
+
+        if (sha256 != calculateSha256(tempname.string())) {
+            LOG_WARNING("The local task file {1}'s sha differs from the provided sha", local_file.string());
+            fs::remove(tempname, ec);
+            continue;
+        }
+
+        fs::permissions(tempname, NIX_TASK_FILE_PERMS);
+        fs::rename(tempname, filepath);
+        LOG_DEBUG("Cached the task file {1} from {2}", filename, local_file.string());
+        return true;
+    }
+    return false;
+}
+
+// Reconstructs the task file from the version of the same file cached under
+// base_sha256 and a binary delta (in the VCDIFF format, e.g. created with
+// `xdelta3 -S none -e -s <old> <new>`), which is usually much smaller than the
+// new version: the delta is downloaded to a temporary file of cache_dir and
+// applied to the cached version, writing the result to another temporary file
+// that, if its sha matches the provided one, is atomically renamed to filepath.
+// Returns true in that case; false if the base version is not cached, or if the
+// delta can't be downloaded or applied, so that the whole file is downloaded.
+static bool patchTaskFile(const std::vector<std::string>& master_uris,
+                          Util::CurlPool& curl_pool,
+                          const fs::path& cache_dir,
+                          const fs::path& filepath,
+                          const lth_jc::JsonContainer& file) {
+    auto filename = file.get<std::string>("filename");
+    auto sha256 = file.get<std::string>("sha256");
+    auto delta = file.get<lth_jc::JsonContainer>("delta");
+    auto base_sha256 = delta.get<std::string>("base_sha256");
+    auto base_path = cache_dir.parent_path() / base_sha256 / filename;
+
+    if (master_uris.empty() || !fs::exists(base_path)
+            || base_sha256 != calculateSha256(base_path.string())) {
+        LOG_DEBUG("The version {1} of the task file {2} is not cached; downloading the whole file",
+                  base_sha256, filename);
+        return false;
+    }
+
+    auto delta_path = cache_dir / fs::unique_path("temp_task_%%%%-%%%%-%%%%-%%%%");
+    auto tempname = cache_dir / fs::unique_path("temp_task_%%%%-%%%%-%%%%-%%%%");
+    lth_util::scope_exit temp_remover { [&]() {
+        boost::system::error_code ec;
+        fs::remove(delta_path, ec);
+        fs::remove(tempname, ec);
+    } };
+
+    try {
+        Util::Sha256Digest delta_digest;
+        auto download_result = downloadTaskFile(master_uris, curl_pool, delta_path,
+                                                delta.get<lth_jc::JsonContainer>("uri"),
+                                                "", delta_digest);
+        if (!std::get<0>(download_result)) {
+            LOG_WARNING("Downloading the delta of the task file {1} failed; downloading the "
+                        "whole file. Most recent error message: {2}",
+                        filename, std::get<1>(download_result));
+            return false;
+        }
+
+        Util::Sha256Digest digest;
+        boost::nowide::ofstream ofs { tempname.string(), std::ios::binary };
+        Util::VcdiffDecoder::decode(
+            lth_file::read(delta_path.string()),
+            base_path,
+            [&](const char* data, size_t size) {
+                if (!ofs.write(data, size)) {
+                    throw Util::VcdiffDecoder::Error {
+                        lth_loc::format("failed to write to {1}", tempname.string()) };
+                }
+                digest.update(data, size);
+            });
+        ofs.close();
+        if (ofs.fail()) {
+            throw Util::VcdiffDecoder::Error {
+                lth_loc::format("failed to write to {1}", tempname.string()) };
+        }
+
+        if (sha256 != digest.hexDigest()) {
+            LOG_WARNING("The task file {1} reconstructed from its delta differs from the "
+                        "provided sha; downloading the whole file", filename);
+            return false;
+        }
+    } catch (Util::VcdiffDecoder::Error& e) {
+        LOG_WARNING("Applying the delta of the task file {1} failed; downloading the whole "
+                    "file. Reason: {2}", filename, e.what());
+        return false;
+    } catch (Module::ProcessingError& e) {
+        LOG_WARNING("Downloading the delta of the task file {1} failed; downloading the "
+                    "whole file. Reason: {2}", filename, e.what());
+        return false;
+    }
+
+    fs::permissions(tempname, NIX_TASK_FILE_PERMS);
+    fs::rename(tempname, filepath);
+    LOG_DEBUG("Reconstructed the task file {1} from the cached version {2} and a delta",
+              filename, base_sha256);
+    return true;
+}
+
+// Name of the file that records the path and sha256 of the members of the task
+// archive extracted in a cache dir. The manifest is written once all members are
+// in place, so its presence also denotes a complete extraction.
+static const std::string TASK_ARCHIVE_MANIFEST { ".archive_manifest.json" };
+
+// Returns true if the manifest of the task archive extracted in cache_dir lists
+// "filename" and all the members it lists match their recorded sha256.
+static bool verifyTaskArchive(const fs::path& cache_dir, const std::string& filename) {
+    auto manifest_path = cache_dir / TASK_ARCHIVE_MANIFEST;
+    if (!fs::exists(manifest_path)) {
+        return false;
+    }
+
+    try {
+        lth_jc::JsonContainer manifest { lth_file::read(manifest_path.string()) };
+        bool includes_filename { false };
+
+        for (auto& member : manifest.get<std::vector<lth_jc::JsonContainer>>("members")) {
+            auto member_path = cache_dir / member.get<std::string>("path");
+            if (!fs::exists(member_path)
+                    || calculateSha256(member_path.string()) != member.get<std::string>("sha256")) {
+                LOG_DEBUG("The extracted task archive member {1} is missing or was modified",
+                          member_path.string());
+                return false;
+            }
+            fs::permissions(member_path, NIX_TASK_FILE_PERMS);
+            includes_filename |= (member.get<std::string>("path") == filename);
+        }
+
+        return includes_filename;
+    } catch (lth_jc::data_error& e) {
+        LOG_DEBUG("Invalid task archive manifest {1}: {2}", manifest_path.string(), e.what());
+        return false;
+    }
+}
+
+// Task archives (files with the "archive" field) are tar archives, optionally
+// compressed, whose sha256 is the one of the whole (uncompressed) archive; their
+// "filename" is the path of the member to be executed. If the archive was already
+// extracted in cache_dir and its members are intact, the path of that member is
+// returned right away. Otherwise:
+//    (1) The archive is extracted as a stream into a temporary directory inside
+//    cache_dir, while computing the sha256 of the archive and of each of its
+//    members. The archive is read from the local source directories, in case a
+//    pre-staged copy with a matching sha is found there, or it is otherwise
+//    downloaded as done for the other task files.
+//
+//    (2) If the archive's sha differs from the provided sha or if it doesn't
+//    include "filename", a PXP error is thrown.
+//
+//    (3) Otherwise, the members are renamed to cache_dir/<member path> and the
+//    manifest recording their sha256 is written.
+static fs::path updateTaskArchive(const std::vector<std::string>& master_uris,
+                                  const std::vector<std::string>& local_sources,
+                                  Util::CurlPool& curl_pool,
+                                  const fs::path& cache_dir,
+                                  const lth_jc::JsonContainer& file) {
+    auto filename = file.get<std::string>("filename");
+    auto sha256 = file.get<std::string>("sha256");
+    auto filepath = cache_dir / filename;
+
+    if (verifyTaskArchive(cache_dir, filename)) {
+        return filepath;
+    }
+
+    auto local_archives = findLocalTaskFiles(local_sources, sha256, "");
+    if (master_uris.empty() && local_archives.empty()) {
+        throw Module::ProcessingError(lth_loc::format("Cannot download task. No master-uris were provided"));
+    }
+
+    auto compression = file.includes("compression") ? file.get<std::string>("compression")
+                                                     : std::string {};
+    auto staging_dir = cache_dir / fs::unique_path("temp_task_%%%%-%%%%-%%%%-%%%%");
+    lth_util::scope_exit staging_dir_remover { [&staging_dir]() {
+        boost::system::error_code ec;
+        fs::remove_all(staging_dir, ec);
+    } };
+
+    Util::TarExtractor extractor { staging_dir, NIX_TASK_FILE_PERMS };
+    Util::Sha256Digest digest;
+    bool extracted_locally { false };
+
+    for (const auto& local_archive : local_archives) {
         try {
-            lth_curl::response resp;
-            client.download_file(req, file_path.string(), resp, NIX_TASK_FILE_PERMS);
-            if (resp.status_code() >= 400) {
-                throw lth_curl::http_file_download_exception(
-                    req,
-                    file_path.string(),
-                    lth_loc::format("{1} returned a response with HTTP status {2}. Response body: {3}", url, resp.status_code(), resp.body()));
+            extractor.reset();
+            digest.reset();
+            updateSha256(digest, local_archive.string(),
+                         [&extractor](const char* data, size_t size) { extractor.extract(data, size); });
+            extractor.finish();
+            if (sha256 == digest.hexDigest()) {
+                LOG_DEBUG("Extracting the task archive {1} from {2}", sha256, local_archive.string());
+                extracted_locally = true;
+                break;
             }
-        } catch (lth_curl::http_file_download_exception& e) {
-            // Server-side error, do nothing here -- we want to try the next master-uri.
-            LOG_WARNING("Downloading the task file from the master-uri '{1}' failed. Reason: {2}", master_uri, e.what());
-            std::get<1>(result) = e.what();
-        } catch (lth_curl::http_request_exception& e) {
-            // For http_curl_setup and http_file_operation exceptions
-            throw Module::ProcessingError(lth_loc::format("Downloading the task file failed. Reason: {1}", e.what()));
+            LOG_WARNING("The local task archive {1}'s sha differs from the provided sha", local_archive.string());
+        } catch (const std::exception& e) {
+            LOG_WARNING("Failed to extract the local task archive {1}: {2}", local_archive.string(), e.what());
+        }
+    }
+
+    if (!extracted_locally) {
+        if (master_uris.empty()) {
+            throw Module::ProcessingError(lth_loc::format("Cannot download task. No master-uris were provided"));
         }
 
-        if (fs::exists(file_path)) {
-            std::get<0>(result) = true;
-            return result;
+        auto download_result = downloadTaskFile(master_uris, curl_pool, staging_dir,
+                                                file.get<lth_jc::JsonContainer>("uri"),
+                                                compression, digest, &extractor);
+        if (!std::get<0>(download_result)) {
+            throw Module::ProcessingError(lth_loc::format(
+                  "Downloading the task archive {1} failed after trying all the available master-uris. Most recent error message: {2}",
+                  filename,
+                  std::get<1>(download_result)));
+        }
+
+        if (sha256 != digest.hexDigest()) {
+          throw Module::ProcessingError(lth_loc::format("The downloaded {1}'s sha differs from the provided sha", filename));
         }
     }
 
-    return result;
+    const auto& members = extractor.members();
+    if (std::none_of(members.begin(), members.end(),
+                     [&filename](const Util::TarExtractor::Member& m) { return m.path == filename; })) {
+        throw Module::ProcessingError(lth_loc::format("The downloaded task archive does not contain {1}", filename));
+    }
+
+    // The manifest is removed first, so that an interrupted update is detected
+    fs::remove(cache_dir / TASK_ARCHIVE_MANIFEST);
+    std::vector<lth_jc::JsonContainer> manifest_members;
+
+    for (const auto& member : members) {
+        if (member.path == TASK_ARCHIVE_MANIFEST) {
+            continue;
+        }
+        auto member_path = cache_dir / member.path;
+        fs::create_directories(member_path.parent_path());
+        fs::rename(staging_dir / member.path, member_path);
+
+        lth_jc::JsonContainer manifest_member;
+        manifest_member.set<std::string>("path", member.path);
+        manifest_member.set<std::string>("sha256", member.sha256);
+        manifest_members.push_back(std::move(manifest_member));
+    }
+
+    lth_jc::JsonContainer manifest;
+    manifest.set<std::vector<lth_jc::JsonContainer>>("members", manifest_members);
+    lth_file::atomic_write_to_file(manifest.toString(), (cache_dir / TASK_ARCHIVE_MANIFEST).string(),
+                                   NIX_FILE_PERMS, std::ios::binary);
+
+    LOG_DEBUG("Extracted {1} members of the task archive {2} into {3}",
+              manifest_members.size(), sha256, cache_dir.string());
+    return filepath;
 }
 
 // This method does the following. If the file matching the "filename" field of the
 // file_obj JSON does not exist OR if its hash does not match the sha value in the
-// "sha256" field of file_obj, then:
-//    (1) The file is downloaded using Leatherman.curl by trying each of the master_uris
-//    until one of them succeeds. If this download fails, a PXP error is thrown.
+// "sha256" field of file_obj (the sha of the uncompressed content, also in case the
+// "compression" field requests a compressed transfer), then:
+//    (0) If a pre-staged copy of the file with a matching sha is found in the local
+//    source directories, it's copied to cache_dir/<filename>, without any
+//    download.
+//
+//    (0') Else, if the "delta" field is present and the version of the file with
+//    its "base_sha256" is cached, the file is reconstructed by downloading and
+//    applying the binary delta; on any failure, it falls back to (1).
+//
+//    (1) Otherwise, the file is downloaded using the pooled curl handles by trying each of the
+//    master_uris until one of them succeeds. If a previous download of the file was
+//    interrupted, the partial file kept in cache_dir is claimed (by renaming it to
+//    a temporary file, so that only a single thread can resume it) and resumed. If
+//    this download fails, what was downloaded is kept as the partial file and a PXP
+//    error is thrown.
 //
 //    (2) If the downloaded file's sha does not match the provided sha, then a PXP
 //        error is returned. TODO: Now that we are trying all the master_uris for
@@ -313,9 +946,14 @@ static std::tuple<bool, std::string> downloadTaskFile(const std::vector<std::str
 //    (3) If (1) and (2) both succeed, then the downloaded file is atomically
 //        renamed to cache_dir/<filename>
 static fs::path updateTaskFile(const std::vector<std::string>& master_uris,
-                               lth_curl::client& client,
+                               const std::vector<std::string>& local_sources,
+                               Util::CurlPool& curl_pool,
                                const fs::path& cache_dir,
                                const lth_jc::JsonContainer& file) {
+    if (file.includes("archive")) {
+        return updateTaskArchive(master_uris, local_sources, curl_pool, cache_dir, file);
+    }
+
     auto filename = file.get<std::string>("filename");
     auto sha256 = file.get<std::string>("sha256");
     auto filepath = cache_dir / filename;
@@ -325,20 +963,46 @@ static fs::path updateTaskFile(const std::vector<std::string>& master_uris,
         return filepath;
     }
 
+    if (fetchLocalTaskFile(local_sources, cache_dir, filepath, filename, sha256)) {
+        return filepath;
+    }
+
+    if (file.includes("delta") && patchTaskFile(master_uris, curl_pool, cache_dir, filepath, file)) {
+        return filepath;
+    }
+
     if (master_uris.empty()) {
         throw Module::ProcessingError(lth_loc::format("Cannot download task. No master-uris were provided"));
     }
 
+    auto compression = file.includes("compression") ? file.get<std::string>("compression")
+                                                     : std::string {};
     auto tempname = cache_dir / fs::unique_path("temp_task_%%%%-%%%%-%%%%-%%%%");
-    auto download_result = downloadTaskFile(master_uris, client, tempname, file.get<lth_jc::JsonContainer>("uri"));
+    auto partial_path = cache_dir / (PARTIAL_TASK_FILE_PREFIX + filename);
+    {
+        boost::system::error_code ec;
+        fs::rename(partial_path, tempname, ec);
+    }
+
+    Util::Sha256Digest digest;
+    std::tuple<bool, std::string> download_result;
+    try {
+        download_result = downloadTaskFile(master_uris, curl_pool, tempname,
+                                           file.get<lth_jc::JsonContainer>("uri"),
+                                           compression, digest);
+    } catch (Module::ProcessingError&) {
+        keepPartialTaskFile(tempname, partial_path);
+        throw;
+    }
     if (!std::get<0>(download_result)) {
+        keepPartialTaskFile(tempname, partial_path);
         throw Module::ProcessingError(lth_loc::format(
               "Downloading the task file {1} failed after trying all the available master-uris. Most recent error message: {2}",
               file.get<std::string>("filename"),
               std::get<1>(download_result)));
     }
 
-    if (sha256 != calculateSha256(tempname.string())) {
+    if (sha256 != digest.hexDigest()) {
       fs::remove(tempname);
       throw Module::ProcessingError(lth_loc::format("The downloaded {1}'s sha differs from the provided sha", filename));
     }
@@ -346,31 +1010,60 @@ static fs::path updateTaskFile(const std::vector<std::string>& master_uris,
     return filepath;
 }
 
+// Verify (this includes checking the SHA256 checksums) that the specified task file
+// is present in the task cache, downloading it if necessary.
+// In case the index reports the file as already verified, its path is returned
+// right away, without accessing the filesystem nor locking the task cache;
+// otherwise the file is verified (or downloaded) and added to the index.
+// Return the full path of the cached file.
+static fs::path getCachedFile(const fs::path& task_cache_dir,
+                              PCPClient::Util::mutex& task_cache_dir_mutex,
+                              Util::TaskCacheIndex& task_cache_index,
+                              const std::vector<std::string>& master_uris,
+                              const std::vector<std::string>& local_sources,
+                              Util::CurlPool& curl_pool,
+                              const lth_jc::JsonContainer& file) {
+    auto sha256 = file.get<std::string>("sha256");
+    auto filename = file.get<std::string>("filename");
+    fs::path cached_path;
+
+    if (task_cache_index.lookupVerified(sha256, filename, cached_path)) {
+        LOG_TRACE("Task file {1} with sha {2} is cached", filename, sha256);
+        return cached_path;
+    }
+
+    LOG_DEBUG("Verifying task file based on {1}", file.toString());
+
+    try {
+        auto cache_dir = [&]() {
+            pcp_util::lock_guard<pcp_util::mutex> the_lock { task_cache_dir_mutex };
+            return createCacheDir(task_cache_dir, sha256);
+        }();
+        cached_path = updateTaskFile(master_uris, local_sources, curl_pool, cache_dir, file);
+        task_cache_index.addVerified(sha256, filename, cached_path, fs::file_size(cached_path));
+        return cached_path;
+    } catch (fs::filesystem_error& e) {
+        throw toModuleProcessingError(e);
+    }
+}
+
 // Verify (this includes checking the SHA256 checksums) that *all* task files are present
 // in the task cache downloading them if necessary.
 // Return the full path of the cached version of the first file from the list (which
 // is assumed to be the task executable).
 static fs::path getCachedTaskFile(const fs::path& task_cache_dir,
                                   PCPClient::Util::mutex& task_cache_dir_mutex,
+                                  Util::TaskCacheIndex& task_cache_index,
                                   const std::vector<std::string>& master_uris,
-                                  lth_curl::client& client,
+                                  const std::vector<std::string>& local_sources,
+                                  Util::CurlPool& curl_pool,
                                   const std::vector<lth_jc::JsonContainer> &files) {
     if (files.empty()) {
         throw Module::ProcessingError {
             lth_loc::format("at least one file must be specified for a task") };
     }
-    auto file = files[0];
-    LOG_DEBUG("Verifying task file based on {1}", file.toString());
-
-    try {
-        auto cache_dir = [&]() {
-            pcp_util::lock_guard<pcp_util::mutex> the_lock { task_cache_dir_mutex };
-            return createCacheDir(task_cache_dir, file.get<std::string>("sha256"));
-        }();
-        return updateTaskFile(master_uris, client, cache_dir, file);
-    } catch (fs::filesystem_error& e) {
-        throw toModuleProcessingError(e);
-    }
+    return getCachedFile(task_cache_dir, task_cache_dir_mutex, task_cache_index,
+                         master_uris, local_sources, curl_pool, files[0]);
 }
 
 void Task::callBlockingAction(
@@ -403,11 +1096,76 @@ void Task::callNonBlockingAction(
     ActionResponse &response
 ) {
     const fs::path &results_dir = request.resultsDir();
+    auto write_pid_file = [results_dir](size_t pid) {
+        auto pid_file = (results_dir / "pid").string();
+        lth_file::atomic_write_to_file(std::to_string(pid) + "\n", pid_file,
+                                       NIX_FILE_PERMS, std::ios::binary);
+    };
+
+    // Large inputs are read by the task from file, so that neither the agent
+    // nor the task_wrapper has to feed them through a pipe
+    std::string input_path;
+    if (input.size() > TASK_INPUT_FILE_THRESHOLD) {
+        input_path = (results_dir / TASK_INPUT_FILE).string();
+        LOG_DEBUG("Storing the {1} bytes input of the {2} in {3}",
+                  input.size(), request.prettyLabel(), input_path);
+        try {
+            lth_file::atomic_write_to_file(input, input_path, NIX_FILE_PERMS, std::ios::binary);
+        } catch (const std::exception& e) {
+            throw Module::ProcessingError(lth_loc::format("Failed to store the task input: {1}", e.what()));
+        }
+    }
+    lth_util::scope_exit input_remover { [&input_path]() {
+        if (!input_path.empty()) {
+            boost::system::error_code ec;
+            fs::remove(input_path, ec);
+        }
+    } };
+
+#ifndef _WIN32
+    if (task_direct_exec_) {
+        int exitcode;
+        try {
+            if (input_path.empty()) {
+                exitcode = Util::DetachedTask::run(
+                    command.executable,
+                    command.arguments,
+                    input,
+                    environment,
+                    (results_dir / "stdout").string(),
+                    (results_dir / "stderr").string(),
+                    (results_dir / "exitcode").string(),
+                    write_pid_file);
+            } else {
+                exitcode = Util::DetachedTask::runWithInputFile(
+                    command.executable,
+                    command.arguments,
+                    input_path,
+                    environment,
+                    (results_dir / "stdout").string(),
+                    (results_dir / "stderr").string(),
+                    (results_dir / "exitcode").string(),
+                    write_pid_file);
+            }
+        } catch (Util::DetachedTask::Error& e) {
+            throw Module::ProcessingError(lth_loc::format("Failed to run the task: {1}", e.what()));
+        }
+
+        response.output = storage_->getOutput(request.transactionId(), exitcode);
+        processOutputAndUpdateMetadata(response);
+        return;
+    }
+#endif
+
     lth_jc::JsonContainer wrapper_input;
 
     wrapper_input.set<std::string>("executable", command.executable);
     wrapper_input.set<std::vector<std::string>>("arguments", command.arguments);
-    wrapper_input.set<std::string>("input", input);
+    if (input_path.empty()) {
+        wrapper_input.set<std::string>("input", input);
+    } else {
+        wrapper_input.set<std::string>("input_file", input_path);
+    }
     wrapper_input.set<std::string>("stdout", (results_dir / "stdout").string());
     wrapper_input.set<std::string>("stderr", (results_dir / "stderr").string());
     wrapper_input.set<std::string>("exitcode", (results_dir / "exitcode").string());
@@ -417,11 +1175,7 @@ void Task::callNonBlockingAction(
         {},
         wrapper_input.toString(),
         environment,
-        [results_dir](size_t pid) {
-            auto pid_file = (results_dir / "pid").string();
-            lth_file::atomic_write_to_file(std::to_string(pid) + "\n", pid_file,
-                                           NIX_FILE_PERMS, std::ios::binary);
-        },  // pid callback
+        write_pid_file,  // pid callback
         0,  // timeout
         leatherman::util::option_set<lth_exec::execution_options> {
             lth_exec::execution_options::thread_safe,
@@ -434,8 +1188,71 @@ void Task::callNonBlockingAction(
     processOutputAndUpdateMetadata(response);
 }
 
+void Task::prefetchTaskFiles(const ActionRequest& request, ActionResponse& response)
+{
+    auto files = request.params().get<std::vector<lth_jc::JsonContainer>>("files");
+    std::vector<lth_jc::JsonContainer> cached_files;
+    std::vector<std::string> errors;
+
+    // Try all files, so that a single failure doesn't prevent
+    // caching the remaining ones
+    for (const auto& file : files) {
+        try {
+            getCachedFile(task_cache_dir_, task_cache_dir_mutex_, task_cache_index_,
+                          master_uris_, task_local_sources_, curl_pool_, file);
+            lth_jc::JsonContainer cached_file;
+            cached_file.set<std::string>("filename", file.get<std::string>("filename"));
+            cached_file.set<std::string>("sha256", file.get<std::string>("sha256"));
+            cached_files.push_back(std::move(cached_file));
+        } catch (const Module::ProcessingError& e) {
+            LOG_WARNING("Failed to prefetch the task file {1} for the {2}: {3}",
+                        file.get<std::string>("filename"), request.prettyLabel(), e.what());
+            errors.push_back(lth_loc::format("{1}: {2}",
+                                             file.get<std::string>("filename"), e.what()));
+        }
+    }
+
+    if (!errors.empty()) {
+        throw Module::ProcessingError {
+            lth_loc::format("Failed to prefetch {1} of {2} task files. {3}",
+                            errors.size(), files.size(), boost::algorithm::join(errors, "; ")) };
+    }
+
+    LOG_INFO("Prefetched {1} task files for the {2}", files.size(), request.prettyLabel());
+    lth_jc::JsonContainer results;
+    results.set<std::vector<lth_jc::JsonContainer>>("files", cached_files);
+    response.setValidResultsAndEnd(std::move(results));
+}
+
 ActionResponse Task::callAction(const ActionRequest& request)
 {
+    if (request.action() == TASK_PREFETCH_ACTION) {
+        // Only fill the cache; a non-blocking request does that in the
+        // background, without involving the task wrapper
+        ActionResponse response { ModuleType::Internal, request };
+        prefetchTaskFiles(request, response);
+
+        if (request.type() == RequestType::NonBlocking) {
+            // Store an empty output, as a completed action would, so
+            // that the status requests can retrieve it; the exitcode
+            // file is written last, as it marks the output as ready
+            const fs::path &results_dir = request.resultsDir();
+            try {
+                for (auto name : { "stdout", "stderr" })
+                    lth_file::atomic_write_to_file("", (results_dir / name).string(),
+                                                   NIX_FILE_PERMS, std::ios::binary);
+                lth_file::atomic_write_to_file("0", (results_dir / "exitcode").string(),
+                                               NIX_FILE_PERMS, std::ios::binary);
+            } catch (const std::exception& e) {
+                throw Module::ProcessingError {
+                    lth_loc::format("Failed to store the prefetch output: {1}", e.what()) };
+            }
+            response.output = ActionOutput { 0, "", "" };
+        }
+
+        return response;
+    }
+
     auto task_execution_params = request.params();
     auto task_input_method = task_execution_params.includes("input_method") ?
         task_execution_params.get<std::string>("input_method") : std::string{""};
@@ -448,8 +1265,10 @@ ActionResponse Task::callAction(const ActionRequest& request)
 
     auto task_file = getCachedTaskFile(task_cache_dir_,
                                        task_cache_dir_mutex_,
+                                       task_cache_index_,
                                        master_uris_,
-                                       client_,
+                                       task_local_sources_,
+                                       curl_pool_,
                                        task_execution_params.get<std::vector<lth_jc::JsonContainer>>("files"));
 
     // Use powershell input method by default if task uses .ps1 extension.
@@ -474,6 +1293,17 @@ ActionResponse Task::callAction(const ActionRequest& request)
 
         if (task_input_method.empty() || task_input_method == "environment") {
             addParametersToEnvironment(task_execution_params.get<lth_jc::JsonContainer>("input"), task_environment);
+
+            if (!fitsInEnvironment(task_environment)) {
+                if (!task_input_method.empty()) {
+                    throw Module::ProcessingError {
+                        lth_loc::translate("the task input is too large to be passed via "
+                                           "environment variables; use the stdin input method") };
+                }
+                LOG_WARNING("The input of the {1} is too large to be passed via environment "
+                            "variables; it will only be passed on stdin", request.prettyLabel());
+                task_environment.clear();
+            }
         }
 
         task_command = getTaskCommand(task_file);
@@ -558,47 +1388,165 @@ void Task::processOutputAndUpdateMetadata(ActionResponse& response)
 unsigned int Task::purge(
     const std::string& ttl,
     std::vector<std::string> ongoing_transactions,
-    std::function<void(const std::string& dir_path)> purge_callback)
+    std::function<void(const std::string& dir_path)> purge_callback,
+    Util::PurgeBudget* budget)
 {
     unsigned int num_purged_dirs { 0 };
-    Timestamp ts { ttl };
-    if (purge_callback == nullptr)
-        purge_callback = &Purgeable::defaultDirPurgeCallback;
+    bool use_tombstones { purge_callback == nullptr };
+    if (use_tombstones)
+        purge_callback = [this](const std::string& dir_path) {
+            task_cache_tombstones_.bury(dir_path);
+        };
+
+    // Ensure the last modification time of the cache dirs reflects
+    // the last use of the tasks
+    task_cache_index_.flush();
+
+    if (Timestamp::getMinutes(ttl) > 0) {
+        Timestamp ts { ttl };
+        std::time_t expiry {
+            (ts.time_point - boost::posix_time::from_time_t(0)).total_seconds() };
+
+        LOG_INFO("About to purge cached tasks from '{1}'; TTL = {2}",
+                 task_cache_dir_, ttl);
+
+        lth_file::each_subdirectory(
+            task_cache_dir_,
+            [&](std::string const& s) -> bool {
+                fs::path dir_path { s };
+                if (dir_path.filename() == TASK_CACHE_TOMBSTONE_DIR)
+                    return true;
+
+                if (budgetExhausted(budget))
+                    return false;
+
+                LOG_TRACE("Inspecting '{1}' for purging", s);
+
+                boost::system::error_code ec;
+                pcp_util::lock_guard<pcp_util::mutex> the_lock { task_cache_dir_mutex_ };
+                auto last_update = fs::last_write_time(dir_path, ec);
+                auto sha256 = dir_path.filename().string();
+                if (ec) {
+                    LOG_ERROR("Failed to remove '{1}': {2}", s, ec.message());
+                } else if (ts.isNewerThan(last_update)
+                           && task_cache_index_.removeIfUnusedSince(sha256, expiry)) {
+                    LOG_TRACE("Removing '{1}'", s);
+
+                    try {
+                        purgeDirectory(dir_path.string(), purge_callback, budget);
+                        num_purged_dirs++;
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Failed to remove '{1}': {2}", s, e.what());
+                    }
+                }
+
+                return true;
+            });
+
+        LOG_INFO(lth_loc::format_n(
+            // LOCALE: info
+            "Removed {1} directory from '{2}'",
+            "Removed {1} directories from '{2}'",
+            num_purged_dirs, num_purged_dirs, task_cache_dir_));
+    }
+
+    if (task_cache_dir_max_size_ > 0 && !budgetExhausted(budget))
+        num_purged_dirs += evictLeastRecentlyUsed(purge_callback, budget);
+
+    // NB: this also deletes the tombstones left by a previous run
+    if (use_tombstones)
+        task_cache_tombstones_.reap();
+
+    return num_purged_dirs;
+}
+
+unsigned int Task::evictLeastRecentlyUsed(
+    std::function<void(const std::string& dir_path)> purge_callback,
+    Util::PurgeBudget* budget)
+{
+    struct CachedTask {
+        fs::path dir_path;
+        std::time_t last_use;
+        uint64_t size;
+    };
 
-    LOG_INFO("About to purge cached tasks from '{1}'; TTL = {2}",
-             task_cache_dir_, ttl);
+    std::vector<CachedTask> cached_tasks;
+    uint64_t cache_size { 0 };
 
     lth_file::each_subdirectory(
         task_cache_dir_,
         [&](std::string const& s) -> bool {
+            boost::system::error_code ec;
             fs::path dir_path { s };
-            LOG_TRACE("Inspecting '{1}' for purging", s);
+            if (dir_path.filename() == TASK_CACHE_TOMBSTONE_DIR)
+                return true;
 
-            boost::system::error_code ec;
-            pcp_util::lock_guard<pcp_util::mutex> the_lock { task_cache_dir_mutex_ };
-            auto last_update = fs::last_write_time(dir_path, ec);
+            auto last_use = fs::last_write_time(dir_path, ec);
             if (ec) {
-                LOG_ERROR("Failed to remove '{1}': {2}", s, ec.message());
-            } else if (ts.isNewerThan(last_update)) {
-                LOG_TRACE("Removing '{1}'", s);
-
-                try {
-                    purge_callback(dir_path.string());
-                    num_purged_dirs++;
-                } catch (const std::exception& e) {
-                    LOG_ERROR("Failed to remove '{1}': {2}", s, e.what());
-                }
+                LOG_WARNING("Failed to retrieve the last use time of '{1}': {2}",
+                            s, ec.message());
+            } else {
+                auto size = getDirectorySize(dir_path);
+                cache_size += size;
+                cached_tasks.push_back(CachedTask { dir_path, last_use, size });
             }
 
             return true;
         });
 
+    if (cache_size <= task_cache_dir_max_size_) {
+        LOG_DEBUG("The task cache '{1}' uses {2} bytes out of {3}; no eviction needed",
+                  task_cache_dir_, cache_size, task_cache_dir_max_size_);
+        return 0;
+    }
+
+    LOG_INFO("The task cache '{1}' uses {2} bytes, exceeding its maximum size of "
+             "{3} bytes; about to evict the least recently used tasks",
+             task_cache_dir_, cache_size, task_cache_dir_max_size_);
+
+    std::sort(cached_tasks.begin(), cached_tasks.end(),
+              [](const CachedTask& a, const CachedTask& b) {
+                  return a.last_use < b.last_use;
+              });
+
+    unsigned int num_evicted_dirs { 0 };
+
+    for (const auto& cached_task : cached_tasks) {
+        if (cache_size <= task_cache_dir_max_size_ || budgetExhausted(budget))
+            break;
+
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { task_cache_dir_mutex_ };
+        boost::system::error_code ec;
+
+        // Skip tasks that were used since the cache was inspected
+        auto sha256 = cached_task.dir_path.filename().string();
+        auto last_use = fs::last_write_time(cached_task.dir_path, ec);
+        if (ec || last_use != cached_task.last_use
+               || !task_cache_index_.removeIfUnusedSince(sha256, cached_task.last_use)) {
+            LOG_TRACE("Not evicting '{1}' as it was used in the meantime",
+                      cached_task.dir_path.string());
+            continue;
+        }
+
+        LOG_TRACE("Evicting '{1}'", cached_task.dir_path.string());
+
+        try {
+            purge_callback(cached_task.dir_path.string());
+            if (budget != nullptr)
+                budget->charge(cached_task.size);
+            cache_size -= cached_task.size;
+            num_evicted_dirs++;
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to remove '{1}': {2}", cached_task.dir_path.string(), e.what());
+        }
+    }
+
     LOG_INFO(lth_loc::format_n(
         // LOCALE: info
-        "Removed {1} directory from '{2}'",
-        "Removed {1} directories from '{2}'",
-        num_purged_dirs, num_purged_dirs, task_cache_dir_));
-    return num_purged_dirs;
+        "Evicted {1} directory from '{2}'; the task cache now uses {3} bytes",
+        "Evicted {1} directories from '{2}'; the task cache now uses {3} bytes",
+        num_evicted_dirs, num_evicted_dirs, task_cache_dir_, cache_size));
+    return num_evicted_dirs;
 }
 
 }  // namespace Modules
@@ -1,5 +1,6 @@
 #include <pxp-agent/request_processor.hpp>
 #include <pxp-agent/results_mutex.hpp>
+#include <pxp-agent/log_results_storage.hpp>
 #include <pxp-agent/action_response.hpp>
 #include <pxp-agent/action_status.hpp>
 #include <pxp-agent/pxp_schemas.hpp>
@@ -30,6 +31,7 @@
 #include <boost/format.hpp>
 #include <boost/math/common_factor_rt.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <atomic>
 #include <functional>
@@ -51,6 +53,10 @@ namespace pcp_util = PCPClient::Util;
 // named mutex lock, before updating the metadata
 static const uint32_t METADATA_RACE_MS { 100 };
 
+// Maximum number of threads scanning the spool at startup; the scan is
+// mostly bound by the latency of the metadata reads
+static const unsigned int RECOVERY_MAX_THREADS { 8 };
+
 //
 // Static functions
 //
@@ -160,6 +166,38 @@ void nonBlockingActionTask(std::shared_ptr<Module> module_ptr,
         LOG_ERROR("Failed to write metadata of the {1}: {2}",
                   request.prettyLabel(), e.what());
     }
+
+    // The output won't change anymore; shrink it for the time it's
+    // kept in the spool
+    storage_ptr->compressOutput(request.transactionId());
+}
+
+static std::shared_ptr<ResultsStorage>
+makeResultsStorage(const Configuration::Agent& agent_configuration)
+{
+    ResultsStorage::Quotas quotas {
+        agent_configuration.spool_dir_max_size,
+        agent_configuration.spool_dir_max_transactions,
+        agent_configuration.spool_dir_max_transactions_per_requester };
+
+    auto durability = Util::Durability::Relaxed;
+    if (agent_configuration.spool_durability == "strict") {
+        durability = Util::Durability::Strict;
+    } else if (agent_configuration.spool_durability == "group-commit") {
+        durability = Util::Durability::GroupCommit;
+    }
+
+    if (agent_configuration.spool_backend == "log") {
+        LOG_INFO("Storing the metadata of the action results in a transaction log");
+        return std::make_shared<LogResultsStorage>(agent_configuration.spool_dir,
+                                                   agent_configuration.spool_dir_purge_ttl,
+                                                   quotas,
+                                                   durability);
+    }
+    return std::make_shared<ResultsStorage>(agent_configuration.spool_dir,
+                                            agent_configuration.spool_dir_purge_ttl,
+                                            quotas,
+                                            durability);
 }
 
 //
@@ -171,16 +209,24 @@ RequestProcessor::RequestProcessor(std::shared_ptr<PXPConnector> connector_ptr,
         : thread_container_ { "Action Executer" },
           thread_container_mutex_ {},
           connector_ptr_ { connector_ptr },
-          storage_ptr_ { new ResultsStorage(agent_configuration.spool_dir,
-                                            agent_configuration.spool_dir_purge_ttl) },
+          storage_ptr_ { makeResultsStorage(agent_configuration) },
           spool_dir_path_ { agent_configuration.spool_dir },
           modules_ {},
           modules_config_dir_ { agent_configuration.modules_config_dir },
           modules_config_ {},
-          is_destructing_ { false }
+          is_destructing_ { false },
+          is_recovered_ { false },
+          quota_exceeded_ { false }
 {
     assert(!spool_dir_path_.string().empty());
-    registerPurgeable(storage_ptr_);
+
+    if (storage_ptr_->hasQuotas()) {
+        // The spool quotas must be enforced even if its TTL is 0
+        purgeables_.push_back(storage_ptr_);
+    } else {
+        registerPurgeable(storage_ptr_);
+    }
+
     loadModulesConfiguration();
     loadInternalModules(agent_configuration);
 
@@ -193,10 +239,12 @@ RequestProcessor::RequestProcessor(std::shared_ptr<PXPConnector> connector_ptr,
 
     logLoadedModules();
 
+    // NB: started after loading the modules, to process the output of
+    // the interrupted transactions
+    recovery_thread_ptr_.reset(
+        new pcp_util::thread(&RequestProcessor::recoveryTask, this));
+
     if (!purgeables_.empty()) {
-        for (auto purgeable : purgeables_) {
-            purgeable->purge(purgeable->get_ttl(), thread_container_.getThreadNames());
-        }
         purge_thread_ptr_.reset(
             new pcp_util::thread(&RequestProcessor::purgeTask, this));
     }
@@ -212,6 +260,9 @@ RequestProcessor::~RequestProcessor()
 
     if (purge_thread_ptr_ != nullptr && purge_thread_ptr_->joinable())
         purge_thread_ptr_->join();
+
+    if (recovery_thread_ptr_ != nullptr && recovery_thread_ptr_->joinable())
+        recovery_thread_ptr_->join();
 }
 
 void RequestProcessor::processRequest(const RequestType& request_type,
@@ -358,8 +409,7 @@ void RequestProcessor::processBlockingRequest(const ActionRequest& request)
 
 void RequestProcessor::processNonBlockingRequest(const ActionRequest& request)
 {
-    request.setResultsDir(
-        std::move((spool_dir_path_ / request.transactionId()).string()));
+    request.setResultsDir(storage_ptr_->getResultsPath(request.transactionId()).string());
     std::string err_msg {};
 
     LOG_DEBUG("Preparing the task for the {1}, request ID {2} by {3} (using the "
@@ -412,6 +462,14 @@ void RequestProcessor::processNonBlockingRequest(const ActionRequest& request)
         err_msg += e.what();
     }
 
+    // Enforce the spool quotas as soon as a new transaction exceeds
+    // one, rather than at the next purge round
+    if (err_msg.empty() && storage_ptr_->hasQuotas() && storage_ptr_->quotaExceeded()) {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_mutex_ };
+        quota_exceeded_ = true;
+        purge_cond_var_.notify_one();
+    }
+
     if (err_msg.empty()) {
         connector_ptr_->sendProvisionalResponse(request);
     } else {
@@ -836,9 +894,20 @@ void RequestProcessor::loadInternalModules(const Configuration::Agent& agent_con
         agent_configuration.ca,
         agent_configuration.crt,
         agent_configuration.key,
-        storage_ptr_);
+        storage_ptr_,
+        agent_configuration.task_cache_dir_max_size,
+        agent_configuration.task_download_limit,
+        agent_configuration.task_download_rate,
+        agent_configuration.task_local_sources,
+        agent_configuration.task_direct_exec);
     registerModule(task);
-    registerPurgeable(task);
+
+    if (agent_configuration.task_cache_dir_max_size > 0) {
+        // The task cache size must be enforced even if its TTL is 0
+        purgeables_.emplace_back(std::move(task));
+    } else {
+        registerPurgeable(task);
+    }
 }
 
 void RequestProcessor::loadExternalModulesFrom(fs::path dir_path)
@@ -940,31 +1009,193 @@ static unsigned int minutes_gcd(std::vector<std::shared_ptr<Util::Purgeable>> pu
     }
 }
 
+// Each purge slice removes at most these many directories and bytes,
+// and stops removing after the specified time; the slices of a round
+// are run at the specified interval, until nothing expired is left.
+static const unsigned int PURGE_SLICE_MAX_DIRS { 100 };
+static const uint64_t PURGE_SLICE_MAX_BYTES { 64 * 1024 * 1024 };
+static const pcp_util::chrono::milliseconds PURGE_SLICE_MAX_DURATION { 1000 };
+static const pcp_util::chrono::seconds PURGE_SLICE_INTERVAL { 5 };
+
+void RequestProcessor::recoveryTask()
+{
+    auto num_threads = std::max(1u, std::min(RECOVERY_MAX_THREADS,
+                                             pcp_util::thread::hardware_concurrency()));
+    LOG_INFO("Scanning the spool for the transactions of previous runs; thread id {1}",
+             pcp_util::this_thread::get_id());
+    auto start = pcp_util::chrono::steady_clock::now();
+
+    try {
+        auto num_transactions = storage_ptr_->recover(
+            num_threads,
+            [this](const std::string& transaction_id, lth_jc::JsonContainer metadata) {
+                recoverTransaction(transaction_id, std::move(metadata));
+            },
+            [this]() -> bool {
+                // Don't delay the shutdown until the whole spool is scanned
+                pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_mutex_ };
+                return is_destructing_;
+            });
+        LOG_INFO("Scanned {1} transactions of the spool in {2} ms", num_transactions,
+                 pcp_util::chrono::duration_cast<pcp_util::chrono::milliseconds>(
+                     pcp_util::chrono::steady_clock::now() - start).count());
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to scan the spool for the transactions of previous runs: {1}",
+                  e.what());
+    }
+
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_mutex_ };
+    is_recovered_ = true;
+    purge_cond_var_.notify_one();
+}
+
+void RequestProcessor::recoverTransaction(const std::string& t_id,
+                                          lth_jc::JsonContainer metadata)
+{
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_mutex_ };
+        if (is_destructing_)
+            return;
+    }
+
+    // Started by this run, while the spool was being scanned
+    if (thread_container_.find(t_id))
+        return;
+
+    const auto& AS = ACTION_STATUS_NAMES;
+
+    try {
+        // Without PID information, or with the action process still
+        // running, the transaction is left to the status requests
+        if (!storage_ptr_->pidFileExists(t_id)
+                || Util::processExists(storage_ptr_->getPID(t_id)))
+            return;
+
+        auto mod = metadata.get<std::string>("module");
+        auto act = metadata.get<std::string>("action");
+        if (!hasModule(mod) || !modules_.at(mod)->hasAction(act)) {
+            LOG_WARNING("Cannot finalise the transaction {1} of the unknown action "
+                        "'{2} {3}'", t_id, mod, act);
+            return;
+        }
+
+        if (!storage_ptr_->outputIsReady(t_id)) {
+            LOG_WARNING("The action process of the transaction {1} is not "
+                        "running; updating its status to 'undetermined' "
+                        "on its metadata file",
+                        t_id);
+            metadata.set<std::string>("status", AS.at(ActionStatus::Undetermined));
+            if (!metadata.includes("execution_error"))
+                metadata.set<std::string>(
+                    "execution_error",
+                    lth_loc::translate("task process is not running, but no output "
+                                       "is available"));
+            storage_ptr_->updateMetadataFile(t_id, metadata);
+            return;
+        }
+
+        std::shared_ptr<Module> mod_ptr { modules_.at(mod) };
+        ActionResponse a_r { mod_ptr->type(),
+                             RequestType::NonBlocking,
+                             storage_ptr_->getOutput(t_id),
+                             std::move(metadata) };
+
+        mod_ptr->processOutputAndUpdateMetadata(a_r);
+
+        if (a_r.action_metadata.get<bool>("results_are_valid"))
+            mod_ptr->validateOutputAndUpdateMetadata(a_r);
+
+        LOG_INFO("Setting the status of the transaction {1}, interrupted by a "
+                 "restart, to '{2}' on its metadata file",
+                 t_id, a_r.action_metadata.get<std::string>("status"));
+        storage_ptr_->updateMetadataFile(t_id, a_r.action_metadata);
+        storage_ptr_->compressOutput(t_id);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to finalise the transaction {1}: {2}", t_id, e.what());
+    }
+}
+
 void RequestProcessor::purgeTask()
 {
-    // Use min of 1h and gcd of purgeable TTLs.
-    auto num_minutes = std::min(60u, minutes_gcd(purgeables_));
+    Util::lowerThreadPriority();
+
+    // The first round relies on the purge index built by the recovery task
+    {
+        pcp_util::unique_lock<pcp_util::mutex> the_lock { purge_mutex_ };
+        while (!is_recovered_ && !is_destructing_)
+            purge_cond_var_.wait(the_lock);
+    }
+
+    // Use min of 1h and gcd of purgeable TTLs (a purgeable with a 0
+    // TTL, like a size-bounded task cache, does not affect the gcd).
+    auto num_minutes = minutes_gcd(purgeables_);
+    num_minutes = (num_minutes == 0u) ? 60u : std::min(60u, num_minutes);
     LOG_INFO(lth_loc::format_n(
         // LOCALE: info
         "Scheduling the check every {1} minute for directories to purge; thread id {2}",
         "Scheduling the check every {1} minutes for directories to purge; thread id {2}",
         num_minutes, num_minutes, pcp_util::this_thread::get_id()));
 
+    // Purgeables that may have expired directories left in the
+    // current round; the first round starts immediately
+    std::vector<std::shared_ptr<Util::Purgeable>> pending {};
+    auto next_round = pcp_util::chrono::system_clock::now();
+
     while (true) {
-        pcp_util::unique_lock<pcp_util::mutex> the_lock { purge_mutex_ };
-        auto now = pcp_util::chrono::system_clock::now();
+        bool quota_exceeded { false };
+        {
+            pcp_util::unique_lock<pcp_util::mutex> the_lock { purge_mutex_ };
 
-        if (!is_destructing_)
+            // NB: an exceeded quota only interrupts the wait between rounds,
+            // as the storage is purged by the next slice otherwise
             purge_cond_var_.wait_until(
                 the_lock,
-                now + pcp_util::chrono::minutes(num_minutes));
+                pending.empty()
+                    ? next_round
+                    : pcp_util::chrono::system_clock::now() + PURGE_SLICE_INTERVAL,
+                [this, &pending]() {
+                    return is_destructing_ || (quota_exceeded_ && pending.empty());
+                });
+
+            if (is_destructing_)
+                return;
+
+            quota_exceeded = quota_exceeded_;
+            quota_exceeded_ = false;
+        }
 
-        if (is_destructing_)
-            return;
+        auto now = pcp_util::chrono::system_clock::now();
+        if (pending.empty() && now >= next_round) {
+            pending = purgeables_;
+            next_round = now + pcp_util::chrono::minutes(num_minutes);
+        } else if (quota_exceeded
+                   && std::find(pending.begin(), pending.end(), storage_ptr_) == pending.end()) {
+            pending.push_back(storage_ptr_);
+        }
 
-        for (auto purgeable : purgeables_) {
-            purgeable->purge(purgeable->get_ttl(), thread_container_.getThreadNames());
+        if (pending.empty())
+            continue;
+
+        Util::PurgeBudget budget { PURGE_SLICE_MAX_DIRS,
+                                   PURGE_SLICE_MAX_BYTES,
+                                   PURGE_SLICE_MAX_DURATION };
+        auto ongoing_transactions = thread_container_.getThreadNames();
+
+        while (!pending.empty()) {
+            auto purgeable = pending.front();
+            purgeable->purge(purgeable->get_ttl(), ongoing_transactions, nullptr, &budget);
+
+            // The purgeable may have stopped before purging everything
+            if (budget.exhausted())
+                break;
+
+            pending.erase(pending.begin());
         }
+
+        if (!pending.empty())
+            LOG_DEBUG("Purge slice done ({1} directories, {2} bytes); resuming in {3} "
+                      "seconds", budget.numDirs(), budget.numBytes(),
+                      PURGE_SLICE_INTERVAL.count());
     }
 }
 
@@ -2,9 +2,10 @@
 #include <pxp-agent/action_response.hpp>
 #include <pxp-agent/configuration.hpp>
 #include <pxp-agent/time.hpp>
+#include <pxp-agent/util/compressor.hpp>
+#include <pxp-agent/util/decompressor.hpp>
 
 #include <leatherman/file_util/file.hpp>
-#include <leatherman/file_util/directory.hpp>
 
 #include <leatherman/locale/locale.hpp>
 
@@ -13,8 +14,14 @@
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/nowide/fstream.hpp>
 
-#include <algorithm>  // std::find
+#include <algorithm>  // std::all_of, std::min, std::max
+#include <atomic>
+#include <cctype>     // isdigit()
+#include <unordered_set>
+#include <vector>
 
 namespace PXPAgent {
 
@@ -22,53 +29,148 @@ namespace fs = boost::filesystem;
 namespace lth_jc   = leatherman::json_container;
 namespace lth_file = leatherman::file_util;
 namespace lth_loc  = leatherman::locale;
+namespace pcp_util = PCPClient::Util;
 
+// The metadata is split in the request entries, written once, and the
+// state ones, rewritten at each update; previous versions stored both
+// in a single metadata file
+static const std::string REQUEST { "request" };
+static const std::string STATE { "state" };
 static const std::string METADATA { "metadata" };
 static const std::string STDOUT { "stdout" };
 static const std::string STDERR { "stderr" };
 static const std::string EXITCODE { "exitcode" };
 static const std::string PID { "pid" };
 
-ResultsStorage::ResultsStorage(std::string spool_dir, std::string spool_dir_ttl)
-        : Purgeable { std::move(spool_dir_ttl) }, spool_dir_path_ { std::move(spool_dir) }
+struct OutputCompression {
+    std::string compression;
+    std::string extension;
+};
+
+// The format used to compress the output files, followed by the other
+// ones that can be read
+static const std::vector<OutputCompression> OUTPUT_COMPRESSIONS {
+#ifdef PXP_AGENT_HAS_ZSTD
+    { "zstd", ".zst" },
+#endif
+    { "gzip", ".gz" }
+};
+
+// Length of the names of the first and second level shards
+static const size_t SHARD_NAME_LENGTH { 2 };
+static const size_t SUBSHARD_NAME_LENGTH { 1 };
+
+// Output files smaller than this are not worth compressing
+static const uintmax_t OUTPUT_COMPRESSION_MIN_SIZE { 4096 };
+
+static const size_t OUTPUT_CHUNK_SIZE { 0x10000 };  // 64 kB
+
+ResultsStorage::ResultsStorage(std::string spool_dir,
+                               std::string spool_dir_ttl,
+                               Quotas quotas,
+                               Util::Durability durability)
+        : Purgeable { std::move(spool_dir_ttl) },
+          spool_dir_path_ { std::move(spool_dir) },
+          file_syncer_ { durability },
+          quotas_ { quotas },
+          purge_index_ {},
+          indexed_transactions_ {},
+          requester_transactions_ {},
+          indexed_size_ { 0 }
 {
+    migrateFlatLayout();
+}
+
+// FNV-1a; unlike std::hash, stable across platforms and builds, as the
+// layout of the spool must be
+static uint32_t hashTransactionId(const std::string& transaction_id)
+{
+    uint32_t hash { 2166136261u };
+    for (auto c : transaction_id) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool isShardName(const std::string& name, size_t length)
+{
+    return name.size() == length
+           && std::all_of(name.begin(), name.end(),
+                          [](char c) { return std::isdigit(c) || (c >= 'a' && c <= 'f'); });
+}
+
+fs::path ResultsStorage::getResultsPath(const std::string& transaction_id) const
+{
+    static const char HEX_DIGITS[] { "0123456789abcdef" };
+    auto hash = hashTransactionId(transaction_id);
+    std::string shard { HEX_DIGITS[(hash >> 4) & 0xf], HEX_DIGITS[hash & 0xf] };
+    std::string subshard { HEX_DIGITS[(hash >> 8) & 0xf] };
+    return spool_dir_path_ / shard / subshard / transaction_id;
 }
 
 bool ResultsStorage::find(const std::string& transaction_id)
 {
-    auto p = spool_dir_path_ / transaction_id;
+    auto p = getResultsPath(transaction_id);
     return fs::exists(p) && fs::is_directory(p);
 }
 
-static void writeMetadata(const std::string& txt, const std::string& file_path) {
+static void writeMetadata(Util::FileSyncer& file_syncer,
+                          const std::string& txt,
+                          const std::string& file_path) {
     try {
-        lth_file::atomic_write_to_file(txt, file_path, NIX_FILE_PERMS, std::ios::binary);
+        file_syncer.writeFile(txt, file_path, NIX_FILE_PERMS);
     } catch (const std::exception& e) {
         throw ResultsStorage::Error {
             lth_loc::format("failed to write metadata: {1}", e.what()) };
     }
 }
 
-void ResultsStorage::initializeMetadataFile(const std::string& transaction_id,
-                                            const lth_jc::JsonContainer& metadata)
+// Creates the directory and its missing parents, all with the
+// pxp-agent permissions
+static void createDirectories(const fs::path& dir_path)
 {
-    auto results_path = spool_dir_path_ / transaction_id;
+    if (fs::exists(dir_path))
+        return;
+
+    createDirectories(dir_path.parent_path());
+    fs::create_directory(dir_path);
+    fs::permissions(dir_path, NIX_DIR_PERMS);
+}
+
+void ResultsStorage::createResultsDirectory(const std::string& transaction_id)
+{
+    auto results_path = getResultsPath(transaction_id);
 
     if (!fs::exists(results_path)) {
         LOG_DEBUG("Creating results directory for the  transaction {1} in '{2}'",
                   transaction_id, results_path.string());
         try {
-            fs::create_directories(results_path);
-            fs::permissions(results_path, NIX_DIR_PERMS);
-        } catch (const fs::filesystem_error& e) {
+            createDirectories(results_path);
+            file_syncer_.syncEntry(results_path.string());
+        } catch (const std::exception& e) {
             throw ResultsStorage::Error {
                 lth_loc::format("failed to create results directory '{1}'",
                                 e.what()) };
         }
     }
+}
 
-    auto metadata_file = (results_path / METADATA).string();
-    writeMetadata(metadata.toString() + "\n", metadata_file);
+void ResultsStorage::initializeMetadataFile(const std::string& transaction_id,
+                                            const lth_jc::JsonContainer& metadata)
+{
+    createResultsDirectory(transaction_id);
+    auto results_path = getResultsPath(transaction_id);
+
+    // NB: the state file is written first, so that both files exist
+    // once the request one does
+    writeMetadata(file_syncer_,
+                  ActionResponse::getStateMetadata(metadata).toString() + "\n",
+                  (results_path / STATE).string());
+    writeMetadata(file_syncer_,
+                  ActionResponse::getRequestMetadata(metadata).toString() + "\n",
+                  (results_path / REQUEST).string());
+    indexTransaction(transaction_id, metadata);
 }
 
 void ResultsStorage::updateMetadataFile(const std::string& transaction_id,
@@ -79,50 +181,101 @@ void ResultsStorage::updateMetadataFile(const std::string& transaction_id,
             lth_loc::format("no results directory for the transaction {1}",
                             transaction_id) };
 
-    auto metadata_file = (spool_dir_path_ / transaction_id / METADATA).string();
-    writeMetadata(metadata.toString() + "\n", metadata_file);
+    auto results_path = getResultsPath(transaction_id);
+    writeMetadata(file_syncer_,
+                  ActionResponse::getStateMetadata(metadata).toString() + "\n",
+                  (results_path / STATE).string());
+
+    // Stored in a single metadata file by a previous version; split it
+    if (!fs::exists(results_path / REQUEST)) {
+        writeMetadata(file_syncer_,
+                      ActionResponse::getRequestMetadata(metadata).toString() + "\n",
+                      (results_path / REQUEST).string());
+        boost::system::error_code ec;
+        fs::remove(results_path / METADATA, ec);
+    }
+
+    indexTransaction(transaction_id, metadata);
 }
 
-lth_jc::JsonContainer
-ResultsStorage::getActionMetadata(const std::string& transaction_id)
+static lth_jc::JsonContainer readMetadataFile(const std::string& transaction_id,
+                                              const fs::path& file_path)
 {
-    auto metadata_file = (spool_dir_path_ / transaction_id / METADATA).string();
     std::string metadata_txt {};
 
-    if (!fs::exists(metadata_file))
-        throw Error {
+    if (!fs::exists(file_path))
+        throw ResultsStorage::Error {
             lth_loc::format("metadata file of the transaction {1} does not exist",
                             transaction_id) };
 
-    if (!lth_file::read(metadata_file, metadata_txt))
-        throw Error {
+    if (!lth_file::read(file_path.string(), metadata_txt))
+        throw ResultsStorage::Error {
             lth_loc::format("failed to read metadata file of the transaction {1}",
                             transaction_id) };
 
     try {
-        lth_jc::JsonContainer metadata { metadata_txt };
-
-        if (!ActionResponse::isValidActionMetadata(metadata)) {
-            LOG_DEBUG("The file '{1}' contains invalid action metadata:\n{2}",
-                      metadata_file, metadata.toString());
-            throw Error  {
-                lth_loc::format("invalid action metadata of the transaction {1}",
-                                transaction_id) };
-        }
-
-        return metadata;
+        return lth_jc::JsonContainer { metadata_txt };
     } catch (const lth_jc::data_parse_error& e) {
-        LOG_DEBUG("The metadata file '{1}' is not valid JSON: {2}",
-                  metadata_file, e.what());
-        throw Error {
+        LOG_DEBUG("The metadata in '{1}' is not valid JSON: {2}",
+                  file_path.string(), e.what());
+        throw ResultsStorage::Error {
             lth_loc::format("invalid JSON in metadata file of the transaction {1}",
                             transaction_id) };
     }
 }
 
+lth_jc::JsonContainer
+ResultsStorage::getActionMetadata(const std::string& transaction_id)
+{
+    auto results_path = getResultsPath(transaction_id);
+    auto request_file = results_path / REQUEST;
+
+    if (!fs::exists(request_file)) {
+        auto metadata_file = results_path / METADATA;
+        return validateActionMetadata(transaction_id,
+                                      readMetadataFile(transaction_id, metadata_file),
+                                      metadata_file.string());
+    }
+
+    return validateActionMetadata(
+        transaction_id,
+        ActionResponse::mergeMetadata(readMetadataFile(transaction_id, request_file),
+                                      readMetadataFile(transaction_id, results_path / STATE)),
+        results_path.string());
+}
+
+bool ResultsStorage::hasMetadataFiles(const std::string& transaction_id)
+{
+    auto results_path = getResultsPath(transaction_id);
+    return fs::exists(results_path / REQUEST) || fs::exists(results_path / METADATA);
+}
+
+void ResultsStorage::removeMetadataFiles(const std::string& transaction_id)
+{
+    auto results_path = getResultsPath(transaction_id);
+    for (const auto& file_name : { REQUEST, STATE, METADATA })
+        fs::remove(results_path / file_name);
+}
+
+lth_jc::JsonContainer
+ResultsStorage::validateActionMetadata(const std::string& transaction_id,
+                                       lth_jc::JsonContainer metadata,
+                                       const std::string& source)
+{
+    if (!ActionResponse::isValidActionMetadata(metadata)) {
+        LOG_DEBUG("The metadata in '{1}' is invalid:\n{2}",
+                  source, metadata.toString());
+        throw Error  {
+            lth_loc::format("invalid action metadata of the transaction {1}",
+                            transaction_id) };
+    }
+
+    return metadata;
+}
+
 bool ResultsStorage::pidFileExists(const std::string& transaction_id)
 {
-    return fs::exists(spool_dir_path_ / transaction_id / PID);
+    return fs::exists(getResultsPath(transaction_id) / PID);
 }
 
 static int readIntegerFromFile(const std::string& file_path)
@@ -145,18 +298,98 @@ static int readIntegerFromFile(const std::string& file_path)
 
 int ResultsStorage::getPID(const std::string& transaction_id)
 {
-    return readIntegerFromFile((spool_dir_path_ / transaction_id / PID).string());
+    return readIntegerFromFile((getResultsPath(transaction_id) / PID).string());
 }
 
 bool ResultsStorage::outputIsReady(const std::string& transaction_id)
 {
-    return fs::exists(spool_dir_path_ / transaction_id / EXITCODE);
+    return fs::exists(getResultsPath(transaction_id) / EXITCODE);
+}
+
+// Maps the specified file read-only; the output files are no longer
+// written once the action completed, so the mapping is never truncated.
+// Returns a closed source for empty files, which can't be mapped.
+// Throws an Error in case of failure.
+static boost::iostreams::mapped_file_source mapOutputFile(const fs::path& file_path)
+{
+    boost::iostreams::mapped_file_source mapped_file {};
+
+    try {
+        if (fs::file_size(file_path) > 0)
+            mapped_file.open(file_path);
+    } catch (const std::exception& e) {
+        throw ResultsStorage::Error {
+            lth_loc::format("failed to read '{1}': {2}", file_path.string(), e.what()) };
+    }
+
+    return mapped_file;
+}
+
+static std::string decompressOutputFile(const fs::path& file_path,
+                                       const std::string& compression)
+{
+    std::string content {};
+    auto decompressor = Util::Decompressor::create(compression);
+    auto mapped_file = mapOutputFile(file_path);
+    auto append = [&content](const char* data, size_t size) { content.append(data, size); };
+
+    for (size_t offset = 0; offset < mapped_file.size(); offset += OUTPUT_CHUNK_SIZE)
+        decompressor->decompress(mapped_file.data() + offset,
+                                 std::min(OUTPUT_CHUNK_SIZE, mapped_file.size() - offset),
+                                 append);
+
+    decompressor->finish();
+    return content;
+}
+
+// Reads the specified output file or, if it was compressed, its
+// compressed version. Returns false in case neither exists.
+// The file is mapped and copied once into the content string, sized
+// upfront, rather than through stream buffers, as the output of an
+// action may be large.
+// Throws an Error in case of failure.
+static bool readOutputFile(const fs::path& file_path, std::string& content)
+{
+    // NB: the uncompressed file may be removed by compressOutput()
+    // after checking it exists, once its compressed version is in place
+    if (fs::exists(file_path)) {
+        try {
+            auto mapped_file = mapOutputFile(file_path);
+            if (mapped_file.is_open())
+                content.assign(mapped_file.data(), mapped_file.size());
+            else
+                content.clear();
+            return true;
+        } catch (const ResultsStorage::Error& e) {
+            LOG_TRACE("Failed to read '{1}': {2}", file_path.string(), e.what());
+        }
+    }
+
+    for (const auto& output_compression : OUTPUT_COMPRESSIONS) {
+        auto compressed_path = file_path.string() + output_compression.extension;
+        if (!fs::exists(compressed_path))
+            continue;
+
+        try {
+            content = decompressOutputFile(compressed_path, output_compression.compression);
+            return true;
+        } catch (const Util::Decompressor::Error& e) {
+            throw ResultsStorage::Error {
+                lth_loc::format("failed to decompress '{1}': {2}", compressed_path, e.what()) };
+        }
+    }
+
+    if (fs::exists(file_path))
+        throw ResultsStorage::Error {
+            lth_loc::format("failed to read '{1}'", file_path.string()) };
+
+    return false;
 }
 
 ActionOutput ResultsStorage::getOutput_(const std::string& transaction_id,
                                         bool get_exitcode)
 {
-    auto results_path = (spool_dir_path_ / transaction_id);
+    auto results_path = getResultsPath(transaction_id);
 
     ActionOutput output {};
 
@@ -166,26 +399,23 @@ ActionOutput ResultsStorage::getOutput_(const std::string& transaction_id,
         output.exitcode = readIntegerFromFile(exitcode_file);
     }
 
-    auto stderr_file = (results_path / STDERR).string();
-    auto stdout_file = (results_path / STDOUT).string();
+    auto stderr_file = results_path / STDERR;
+    auto stdout_file = results_path / STDOUT;
 
-    if (fs::exists(stderr_file)) {
-        if (!lth_file::read(stderr_file, output.std_err)) {
-            LOG_ERROR("Failed to read error file '{1}'; this failure will be ignored",
-                      stderr_file);
-        } else {
-            LOG_TRACE("Successfully read error file '{1}'", stderr_file);
-        }
+    try {
+        if (readOutputFile(stderr_file, output.std_err))
+            LOG_TRACE("Successfully read error file '{1}'", stderr_file.string());
+    } catch (const Error& e) {
+        LOG_ERROR("Failed to read error file '{1}'; this failure will be ignored: {2}",
+                  stderr_file.string(), e.what());
     }
 
-    if (!fs::exists(stdout_file)) {
-        LOG_DEBUG("Output file '{1}' does not exist", stdout_file);
-    } else if (!lth_file::read(stdout_file, output.std_out)) {
-        throw Error { lth_loc::format("failed to read '{1}'", stdout_file) };
+    if (!readOutputFile(stdout_file, output.std_out)) {
+        LOG_DEBUG("Output file '{1}' does not exist", stdout_file.string());
     } else if (output.std_out.empty()) {
-        LOG_TRACE("Output file '{1}' is empty", stdout_file);
+        LOG_TRACE("Output file '{1}' is empty", stdout_file.string());
     } else {
-        LOG_TRACE("Successfully read output file '{1}'", stdout_file);
+        LOG_TRACE("Successfully read output file '{1}'", stdout_file.string());
     }
 
     return output;
@@ -204,66 +434,546 @@ ActionOutput ResultsStorage::getOutput(const std::string& transaction_id,
     return output;
 }
 
+// Writes the compressed file next to the original one, then removes
+// the latter, so that readers always find one of the two
+static void compressOutputFile(const fs::path& file_path)
+{
+    boost::system::error_code ec;
+    auto size = fs::file_size(file_path, ec);
+    if (ec || size < OUTPUT_COMPRESSION_MIN_SIZE)
+        return;
+
+    const auto& output_compression = OUTPUT_COMPRESSIONS.front();
+    auto compressed_path = file_path.string() + output_compression.extension;
+    auto temp_path = compressed_path + ".tmp";
+
+    try {
+        {
+            boost::nowide::ifstream file_stream { file_path.string(), std::ios::binary };
+            boost::nowide::ofstream compressed_stream { temp_path,
+                                                        std::ios::binary | std::ios::trunc };
+            if (!file_stream || !compressed_stream)
+                throw ResultsStorage::Error {
+                    lth_loc::format("failed to open '{1}' or '{2}'",
+                                    file_path.string(), temp_path) };
+
+            auto compressor = Util::Compressor::create(output_compression.compression);
+            auto write = [&compressed_stream](const char* data, size_t size) {
+                compressed_stream.write(data, static_cast<std::streamsize>(size));
+            };
+            std::vector<char> buffer(OUTPUT_CHUNK_SIZE);
+
+            while (file_stream) {
+                file_stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                if (file_stream.gcount() > 0)
+                    compressor->compress(buffer.data(),
+                                         static_cast<size_t>(file_stream.gcount()),
+                                         write);
+            }
+
+            if (file_stream.bad())
+                throw ResultsStorage::Error {
+                    lth_loc::format("failed to read '{1}'", file_path.string()) };
+
+            compressor->finish(write);
+            compressed_stream.close();
+            if (compressed_stream.fail())
+                throw ResultsStorage::Error {
+                    lth_loc::format("failed to write '{1}'", temp_path) };
+        }
+
+        fs::permissions(temp_path, NIX_FILE_PERMS);
+        fs::rename(temp_path, compressed_path);
+    } catch (const std::exception& e) {
+        fs::remove(temp_path, ec);
+        LOG_WARNING("Failed to compress '{1}' (it will be kept uncompressed): {2}",
+                    file_path.string(), e.what());
+        return;
+    }
+
+    fs::remove(file_path, ec);
+    if (ec) {
+        // E.g. the file is being read, on Windows; keep it instead
+        LOG_DEBUG("Failed to remove '{1}' after compressing it: {2}",
+                  file_path.string(), ec.message());
+        fs::remove(compressed_path, ec);
+        return;
+    }
+
+    LOG_TRACE("Compressed '{1}'", file_path.string());
+}
+
+void ResultsStorage::compressOutput(const std::string& transaction_id)
+{
+    if (!outputIsReady(transaction_id))
+        return;
+
+    for (const auto& file_name : { STDOUT, STDERR })
+        compressOutputFile(getResultsPath(transaction_id) / file_name);
+
+    updateTransactionSize(transaction_id);
+}
+
+bool ResultsStorage::hasQuotas() const
+{
+    return quotas_.max_size > 0 || quotas_.max_transactions > 0
+           || quotas_.max_transactions_per_requester > 0;
+}
+
+bool ResultsStorage::quotaExceeded()
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+    return quotaExceededLocked();
+}
+
+bool ResultsStorage::quotaExceededLocked() const
+{
+    if ((quotas_.max_size > 0 && indexed_size_ > quotas_.max_size)
+            || (quotas_.max_transactions > 0
+                && indexed_transactions_.size() > quotas_.max_transactions))
+        return true;
+
+    if (quotas_.max_transactions_per_requester > 0)
+        for (const auto& requester : requester_transactions_)
+            if (requester.second > quotas_.max_transactions_per_requester)
+                return true;
+
+    return false;
+}
+
 unsigned int ResultsStorage::purge(
                 const std::string& ttl,
                 std::vector<std::string> ongoing_transactions,
-                std::function<void(const std::string& dir_path)> purge_callback)
+                std::function<void(const std::string& dir_path)> purge_callback,
+                Util::PurgeBudget* budget)
 {
     unsigned int num_purged_dirs { 0 };
-    Timestamp ts { ttl };
     if (purge_callback == nullptr)
         purge_callback = &Purgeable::defaultDirPurgeCallback;
 
-    LOG_INFO("About to purge the results directories from '{1}'; TTL = {2}",
-             spool_dir_path_.string(), ttl);
+    if (Timestamp::getMinutes(ttl) > 0) {
+        Timestamp ts { ttl };
 
-    lth_file::each_subdirectory(
-        spool_dir_path_.string(),
-        [&](std::string const& s) -> bool {
-            fs::path dir_path { s };
-            auto transaction_id = dir_path.filename().string();
-            LOG_TRACE("Inspecting '{1}' for purging", s);
+        LOG_DEBUG("About to purge the results directories from '{1}'; TTL = {2}",
+                 spool_dir_path_.string(), ttl);
 
-            if (!ongoing_transactions.empty()
-                    && std::find(ongoing_transactions.begin(),
-                                 ongoing_transactions.end(),
-                                 transaction_id) != ongoing_transactions.end())
-                return true;
+        for (const auto& transaction_id
+                : getExpiredTransactions(ts.time_point, ongoing_transactions)) {
+            if (budgetExhausted(budget)) {
+                LOG_DEBUG("The purge budget is exhausted; the remaining expired "
+                          "transactions will be purged later");
+                break;
+            }
+
+            LOG_TRACE("Removing the results of the transaction {1}", transaction_id);
 
             try {
-                auto md = getActionMetadata(transaction_id);
-
-                if (md.get<std::string>("status") == "running") {
-                    LOG_TRACE("Skipping '{1}' as the action status is 'running'", s);
-                } else if (ts.isNewerThan(md.get<std::string>("start"))) {
-                    LOG_TRACE("Removing '{1}'", s);
-
-                    try {
-                        purge_callback(dir_path.string());
-                        num_purged_dirs++;
-                    } catch (const std::exception& e) {
-                        LOG_ERROR("Failed to remove '{1}': {2}", s, e.what());
-                    }
-                }
-            } catch (const Error& e) {
-                LOG_WARNING("Failed to retrieve the metadata for the transaction {1} "
-                            "(the results directory will not be removed): {2}",
-                            transaction_id, e.what());
-            } catch (const Timestamp::Error& e) {
-                LOG_WARNING("Failed to process the metadata for the transaction {1} "
-                            "(the results directory will not be removed): {2}",
-                            transaction_id, e.what());
+                removeTransaction(transaction_id, purge_callback, budget);
+                num_purged_dirs++;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Failed to remove '{1}': {2}",
+                          getResultsPath(transaction_id).string(), e.what());
             }
+        }
 
-            return true;
-        });
+        LOG_INFO(lth_loc::format_n(
+            // LOCALE: info
+            "Removed {1} directory from '{2}'",
+            "Removed {1} directories from '{2}'",
+            num_purged_dirs, num_purged_dirs, spool_dir_path_.string()));
+    }
+
+    if (hasQuotas() && !budgetExhausted(budget))
+        num_purged_dirs += evictOverQuota(ongoing_transactions, purge_callback, budget);
+
+    return num_purged_dirs;
+}
+
+void ResultsStorage::removeTransaction(
+                const std::string& transaction_id,
+                const std::function<void(const std::string& dir_path)>& purge_callback,
+                Util::PurgeBudget* budget)
+{
+    purgeDirectory(getResultsPath(transaction_id).string(), purge_callback, budget);
+    unindexTransaction(transaction_id);
+}
+
+std::vector<std::string> ResultsStorage::getTransactionsOverQuota(
+                const std::vector<std::string>& ongoing_transactions)
+{
+    std::unordered_set<std::string> ongoing { ongoing_transactions.begin(),
+                                              ongoing_transactions.end() };
+    std::vector<std::string> transactions_over_quota {};
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+
+    // What would be left after evicting the selected transactions
+    auto num_transactions = indexed_transactions_.size();
+    auto size = indexed_size_;
+    std::unordered_map<std::string, uint32_t> requester_excess {};
+    if (quotas_.max_transactions_per_requester > 0)
+        for (const auto& requester : requester_transactions_)
+            if (requester.second > quotas_.max_transactions_per_requester)
+                requester_excess.emplace(
+                    requester.first,
+                    requester.second - quotas_.max_transactions_per_requester);
+
+    for (const auto& entry : purge_index_) {
+        bool over_quota {
+            (quotas_.max_size > 0 && size > quotas_.max_size)
+            || (quotas_.max_transactions > 0 && num_transactions > quotas_.max_transactions) };
+        if (!over_quota && requester_excess.empty())
+            break;
+
+        const auto& transaction = indexed_transactions_.at(entry.second);
+        auto excess = requester_excess.find(transaction.requester);
+        if (!over_quota && excess == requester_excess.end())
+            continue;
+
+        if (ongoing.count(entry.second)) {
+            LOG_TRACE("Skipping the transaction {1} as it's ongoing", entry.second);
+            continue;
+        }
+
+        transactions_over_quota.push_back(entry.second);
+        num_transactions--;
+        size -= transaction.size;
+        if (excess != requester_excess.end() && --excess->second == 0)
+            requester_excess.erase(excess);
+    }
+
+    return transactions_over_quota;
+}
+
+unsigned int ResultsStorage::evictOverQuota(
+                const std::vector<std::string>& ongoing_transactions,
+                const std::function<void(const std::string& dir_path)>& purge_callback,
+                Util::PurgeBudget* budget)
+{
+    auto transactions_over_quota = getTransactionsOverQuota(ongoing_transactions);
+    if (transactions_over_quota.empty()) {
+        LOG_DEBUG("The spool '{1}' is within its quotas; no eviction needed",
+                  spool_dir_path_.string());
+        return 0;
+    }
+
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+        LOG_INFO("The spool '{1}' holds {2} transactions and {3} bytes of finalised "
+                 "ones, exceeding its quotas; about to evict the oldest finalised "
+                 "transactions", spool_dir_path_.string(),
+                 indexed_transactions_.size(), indexed_size_);
+    }
+
+    unsigned int num_evicted_dirs { 0 };
+
+    for (const auto& transaction_id : transactions_over_quota) {
+        if (budgetExhausted(budget))
+            break;
+
+        LOG_TRACE("Evicting the results of the transaction {1}", transaction_id);
+
+        try {
+            removeTransaction(transaction_id, purge_callback, budget);
+            num_evicted_dirs++;
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to remove '{1}': {2}",
+                      getResultsPath(transaction_id).string(), e.what());
+        }
+    }
 
     LOG_INFO(lth_loc::format_n(
         // LOCALE: info
-        "Removed {1} directory from '{2}'",
-        "Removed {1} directories from '{2}'",
-        num_purged_dirs, num_purged_dirs, spool_dir_path_.string()));
-    return num_purged_dirs;
+        "Evicted {1} directory from '{2}'",
+        "Evicted {1} directories from '{2}'",
+        num_evicted_dirs, num_evicted_dirs, spool_dir_path_.string()));
+    return num_evicted_dirs;
+}
+
+void ResultsStorage::indexTransaction(const std::string& transaction_id,
+                                      const lth_jc::JsonContainer& metadata)
+{
+    boost::posix_time::ptime start {};
+    bool finalised { false };
+
+    try {
+        finalised = metadata.includes("status")
+                    && metadata.get<std::string>("status") != "running"
+                    && metadata.includes("start");
+        if (finalised)
+            start = Timestamp::getTimePoint(metadata.get<std::string>("start"));
+    } catch (const std::exception& e) {
+        LOG_WARNING("Failed to process the metadata for the transaction {1} "
+                    "(its results will not be removed): {2}",
+                    transaction_id, e.what());
+        finalised = false;
+    }
+
+    // NB: the output won't grow anymore
+    uint64_t size { 0 };
+    if (finalised && quotas_.max_size > 0)
+        size = getDirectorySize(getResultsPath(transaction_id));
+
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+    auto entry = indexed_transactions_.find(transaction_id);
+
+    if (entry == indexed_transactions_.end()) {
+        // NB: the metadata of a state update may not include the requester
+        auto requester = metadata.getWithDefault<std::string>("requester", "");
+        entry = indexed_transactions_.emplace(
+            transaction_id,
+            IndexedTransaction { requester, 0, false, purge_index_.end() }).first;
+        requester_transactions_[requester]++;
+    } else if (entry->second.finalised) {
+        if (finalised && entry->second.position->first == start
+                && entry->second.size == size)
+            return;
+        purge_index_.erase(entry->second.position);
+    }
+
+    indexed_size_ = indexed_size_ - entry->second.size + size;
+    entry->second.size = size;
+    entry->second.finalised = finalised;
+    entry->second.position =
+        finalised ? purge_index_.emplace(start, transaction_id) : purge_index_.end();
+}
+
+void ResultsStorage::unindexTransaction(const std::string& transaction_id)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+    auto entry = indexed_transactions_.find(transaction_id);
+
+    if (entry != indexed_transactions_.end()) {
+        if (entry->second.finalised)
+            purge_index_.erase(entry->second.position);
+        indexed_size_ -= entry->second.size;
+
+        auto requester = requester_transactions_.find(entry->second.requester);
+        if (--requester->second == 0)
+            requester_transactions_.erase(requester);
+
+        indexed_transactions_.erase(entry);
+    }
+}
+
+void ResultsStorage::updateTransactionSize(const std::string& transaction_id)
+{
+    if (quotas_.max_size == 0)
+        return;
+
+    auto size = getDirectorySize(getResultsPath(transaction_id));
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+    auto entry = indexed_transactions_.find(transaction_id);
+
+    if (entry != indexed_transactions_.end() && entry->second.finalised) {
+        indexed_size_ = indexed_size_ - entry->second.size + size;
+        entry->second.size = size;
+    }
+}
+
+std::vector<std::string> ResultsStorage::getExpiredTransactions(
+                const boost::posix_time::ptime& instant,
+                const std::vector<std::string>& ongoing_transactions)
+{
+    std::unordered_set<std::string> ongoing { ongoing_transactions.begin(),
+                                              ongoing_transactions.end() };
+    std::vector<std::string> expired_transactions {};
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+
+    for (auto entry = purge_index_.begin();
+            entry != purge_index_.end() && entry->first < instant;
+            entry++) {
+        if (ongoing.count(entry->second)) {
+            LOG_TRACE("Skipping the transaction {1} as it's ongoing", entry->second);
+            continue;
+        }
+        expired_transactions.push_back(entry->second);
+    }
+
+    return expired_transactions;
+}
+
+// Returns the paths of the first level shards of the spool
+static std::vector<fs::path> listShards(const fs::path& spool_dir_path)
+{
+    std::vector<fs::path> shards {};
+    if (!fs::is_directory(spool_dir_path))
+        return shards;
+
+    // NB: entries that are not shards are not results directories
+    // (e.g. the transaction log) or failed to be migrated
+    for (fs::directory_iterator shard { spool_dir_path }, end; shard != end; ++shard)
+        if (fs::is_directory(shard->status())
+                && isShardName(shard->path().filename().string(), SHARD_NAME_LENGTH))
+            shards.push_back(shard->path());
+
+    return shards;
+}
+
+// Calls the callback with the transaction ID of each results directory
+// of the shard; returns false if the callback did
+static bool eachShardResultsDirectory(
+                const fs::path& shard_path,
+                const std::function<bool(const std::string& transaction_id)>& callback)
+{
+    for (fs::directory_iterator subshard { shard_path }, end; subshard != end; ++subshard) {
+        if (!fs::is_directory(subshard->status())
+                || !isShardName(subshard->path().filename().string(),
+                                SUBSHARD_NAME_LENGTH))
+            continue;
+
+        for (fs::directory_iterator results { subshard->path() }; results != end; ++results)
+            if (fs::is_directory(results->status())
+                    && !callback(results->path().filename().string()))
+                return false;
+    }
+
+    return true;
+}
+
+void ResultsStorage::eachResultsDirectory(
+                const std::function<bool(const std::string& transaction_id)>& callback)
+{
+    for (const auto& shard_path : listShards(spool_dir_path_))
+        if (!eachShardResultsDirectory(shard_path, callback))
+            return;
+}
+
+void ResultsStorage::migrateFlatLayout()
+{
+    if (!fs::is_directory(spool_dir_path_))
+        return;
+
+    // NB: collected first, as the shards are created in the spool
+    std::vector<std::string> transaction_ids {};
+    try {
+        for (fs::directory_iterator it { spool_dir_path_ }, end; it != end; ++it) {
+            auto name = it->path().filename().string();
+            if (fs::is_directory(it->status()) && name.front() != '.'
+                    && !isShardName(name, SHARD_NAME_LENGTH))
+                transaction_ids.push_back(std::move(name));
+        }
+    } catch (const fs::filesystem_error& e) {
+        LOG_WARNING("Failed to inspect '{1}' for results directories to move to "
+                    "their shard: {2}", spool_dir_path_.string(), e.what());
+        return;
+    }
+
+    if (transaction_ids.empty())
+        return;
+
+    LOG_INFO("Moving {1} results directories of '{2}' to their shard",
+             transaction_ids.size(), spool_dir_path_.string());
+    unsigned int num_moved { 0 };
+
+    for (const auto& transaction_id : transaction_ids) {
+        auto results_path = getResultsPath(transaction_id);
+        try {
+            createDirectories(results_path.parent_path());
+            fs::rename(spool_dir_path_ / transaction_id, results_path);
+            num_moved++;
+        } catch (const fs::filesystem_error& e) {
+            LOG_WARNING("Failed to move '{1}' to '{2}' (its results will be "
+                        "unavailable until the next restart): {3}",
+                        (spool_dir_path_ / transaction_id).string(),
+                        results_path.string(), e.what());
+        }
+    }
+
+    LOG_INFO("Moved {1} results directories to their shard", num_moved);
+}
+
+unsigned int ResultsStorage::recover(unsigned int num_threads,
+                                     RecoveryCallback callback,
+                                     RecoveryStopper stopper)
+{
+    std::vector<fs::path> shards {};
+    try {
+        shards = listShards(spool_dir_path_);
+    } catch (const fs::filesystem_error& e) {
+        LOG_WARNING("Failed to inspect the results directories in '{1}' (they will not "
+                    "be removed until the next restart): {2}",
+                    spool_dir_path_.string(), e.what());
+        return 0;
+    }
+
+    // Each thread takes the next shard to scan, until none is left
+    std::atomic<size_t> next_shard { 0 };
+    std::atomic<unsigned int> num_scanned { 0 };
+    std::atomic<bool> stopped { false };
+    auto scanShards =
+        [&]() {
+            for (auto shard = next_shard++;
+                 shard < shards.size() && !stopped;
+                 shard = next_shard++) {
+                try {
+                    eachShardResultsDirectory(
+                        shards[shard],
+                        [&](const std::string& transaction_id) -> bool {
+                            if (stopped || (stopper != nullptr && stopper())) {
+                                stopped = true;
+                                return false;
+                            }
+                            recoverTransaction(transaction_id, callback);
+                            num_scanned++;
+                            return true;
+                        });
+                } catch (const fs::filesystem_error& e) {
+                    LOG_WARNING("Failed to inspect the results directories in '{1}' "
+                                "(they will not be removed until the next restart): {2}",
+                                shards[shard].string(), e.what());
+                }
+            }
+        };
+
+    num_threads = static_cast<unsigned int>(
+        std::max<size_t>(1, std::min<size_t>(num_threads, shards.size())));
+    LOG_DEBUG("Scanning {1} shards of '{2}' with {3} threads",
+              shards.size(), spool_dir_path_.string(), num_threads);
+
+    std::vector<pcp_util::thread> scanners {};
+    for (unsigned int i = 1; i < num_threads; i++)
+        scanners.emplace_back(scanShards);
+    scanShards();
+    for (auto& scanner : scanners)
+        scanner.join();
+
+    if (stopped)
+        LOG_DEBUG("Stopped scanning '{1}' after {2} transactions",
+                  spool_dir_path_.string(), num_scanned.load());
+
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { purge_index_mutex_ };
+        LOG_DEBUG("Indexed {1} finalised transactions of '{2}' for purging",
+                  purge_index_.size(), spool_dir_path_.string());
+    }
+
+    return num_scanned;
+}
+
+void ResultsStorage::recoverTransaction(const std::string& transaction_id,
+                                        const RecoveryCallback& callback)
+{
+    lth_jc::JsonContainer metadata;
+    try {
+        metadata = ResultsStorage::getActionMetadata(transaction_id);
+    } catch (const Error& e) {
+        LOG_WARNING("Failed to retrieve the metadata for the transaction {1} "
+                    "(the results directory will not be removed): {2}",
+                    transaction_id, e.what());
+        return;
+    }
+
+    indexTransaction(transaction_id, metadata);
+
+    if (callback == nullptr || metadata.get<std::string>("status") != "running")
+        return;
+
+    try {
+        callback(transaction_id, std::move(metadata));
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to recover the transaction {1}: {2}",
+                  transaction_id, e.what());
+    }
 }
 
 }  // namespace PXPAgent
@@ -0,0 +1,160 @@
+#include <pxp-agent/util/compressor.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#include <zlib.h>
+
+#ifdef PXP_AGENT_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_loc = leatherman::locale;
+
+// Size of the buffer used for the compressed output
+static const size_t OUTPUT_CHUNK_SIZE { 0x10000 };  // 64 kB
+
+//
+// gzip
+//
+
+class GzipCompressor : public Compressor {
+  public:
+    GzipCompressor()
+            : stream_ {},
+              output_buffer_(OUTPUT_CHUNK_SIZE)
+    {
+        // NB: 16 + MAX_WBITS makes zlib write a gzip header
+        if (deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK)
+            throw Error { lth_loc::translate("failed to initialize the gzip compressor") };
+    }
+
+    ~GzipCompressor()
+    {
+        deflateEnd(&stream_);
+    }
+
+    void compress(const char* data,
+                  size_t size,
+                  const OutputCallback& output_callback) override
+    {
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+        deflate_(Z_NO_FLUSH, output_callback);
+    }
+
+    void finish(const OutputCallback& output_callback) override
+    {
+        stream_.next_in = nullptr;
+        stream_.avail_in = 0;
+        deflate_(Z_FINISH, output_callback);
+    }
+
+  private:
+    z_stream stream_;
+    std::vector<char> output_buffer_;
+
+    // Deflates the pending input; with Z_FINISH, until the end of
+    // the stream is written
+    void deflate_(int flush, const OutputCallback& output_callback)
+    {
+        int result { Z_OK };
+
+        do {
+            stream_.next_out = reinterpret_cast<Bytef*>(output_buffer_.data());
+            stream_.avail_out = static_cast<uInt>(output_buffer_.size());
+
+            result = deflate(&stream_, flush);
+            if (result == Z_STREAM_ERROR)
+                throw Error {
+                    lth_loc::format("failed to compress: {1}",
+                                    (stream_.msg != nullptr ? stream_.msg : zError(result))) };
+
+            auto num_bytes = output_buffer_.size() - stream_.avail_out;
+            if (num_bytes > 0)
+                output_callback(output_buffer_.data(), num_bytes);
+        } while (flush == Z_FINISH ? result != Z_STREAM_END : stream_.avail_out == 0);
+    }
+};
+
+#ifdef PXP_AGENT_HAS_ZSTD
+
+//
+// zstd
+//
+
+class ZstdCompressor : public Compressor {
+  public:
+    ZstdCompressor()
+            : cctx_ { ZSTD_createCCtx() },
+              output_buffer_(ZSTD_CStreamOutSize())
+    {
+        if (cctx_ == nullptr)
+            throw Error { lth_loc::translate("failed to initialize the zstd compressor") };
+    }
+
+    ~ZstdCompressor()
+    {
+        ZSTD_freeCCtx(cctx_);
+    }
+
+    void compress(const char* data,
+                  size_t size,
+                  const OutputCallback& output_callback) override
+    {
+        ZSTD_inBuffer input { data, size, 0 };
+
+        while (input.pos < input.size)
+            compressStream(input, ZSTD_e_continue, output_callback);
+    }
+
+    void finish(const OutputCallback& output_callback) override
+    {
+        ZSTD_inBuffer input { nullptr, 0, 0 };
+
+        // 0 means that the frame was completely flushed
+        while (compressStream(input, ZSTD_e_end, output_callback) != 0) {}
+    }
+
+  private:
+    ZSTD_CCtx* cctx_;
+    std::vector<char> output_buffer_;
+
+    size_t compressStream(ZSTD_inBuffer& input,
+                          ZSTD_EndDirective directive,
+                          const OutputCallback& output_callback)
+    {
+        ZSTD_outBuffer output { output_buffer_.data(), output_buffer_.size(), 0 };
+        auto result = ZSTD_compressStream2(cctx_, &output, &input, directive);
+        if (ZSTD_isError(result))
+            throw Error {
+                lth_loc::format("failed to compress: {1}", ZSTD_getErrorName(result)) };
+
+        if (output.pos > 0)
+            output_callback(output_buffer_.data(), output.pos);
+
+        return result;
+    }
+};
+
+#endif  // PXP_AGENT_HAS_ZSTD
+
+std::unique_ptr<Compressor> Compressor::create(const std::string& compression)
+{
+    if (compression == "gzip")
+        return std::unique_ptr<Compressor>(new GzipCompressor());
+#ifdef PXP_AGENT_HAS_ZSTD
+    if (compression == "zstd")
+        return std::unique_ptr<Compressor>(new ZstdCompressor());
+#endif
+
+    throw Error { lth_loc::format("unsupported compression: {1}", compression) };
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
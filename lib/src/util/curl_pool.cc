@@ -0,0 +1,262 @@
+#include <pxp-agent/util/curl_pool.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.curl_pool"
+#include <leatherman/logging/logging.hpp>
+
+#include <exception>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_loc  = leatherman::locale;
+namespace lth_util = leatherman::util;
+namespace pcp_util = PCPClient::Util;
+
+const size_t CurlPool::MAX_IDLE_HANDLES { 8 };
+
+// Maximum number of bytes of an error response body that are retained
+static const size_t MAX_ERROR_BODY_SIZE { 0x1000 };  // 4 kB
+
+// State of a single transfer, passed to the write callback
+struct Transfer {
+    CURL* handle;
+    const CurlPool::WriteCallback* write_callback;
+    std::string* error_body;
+    TokenBucket* bandwidth;
+    std::exception_ptr callback_error;
+};
+
+static size_t writeData(char* ptr, size_t size, size_t nmemb, void* user_ptr)
+{
+    auto transfer = static_cast<Transfer*>(user_ptr);
+    auto num_bytes = size * nmemb;
+    long status_code { 0 };
+    curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &status_code);
+
+    if (status_code >= 400) {
+        auto room = MAX_ERROR_BODY_SIZE - std::min(MAX_ERROR_BODY_SIZE,
+                                                   transfer->error_body->size());
+        transfer->error_body->append(ptr, std::min(room, num_bytes));
+        return num_bytes;
+    }
+
+    // Throttle the transfer before handing the data over; the
+    // resulting back pressure slows down the server via TCP
+    transfer->bandwidth->consume(num_bytes);
+
+    // Exceptions must not go through libcurl; store them and abort
+    try {
+        (*transfer->write_callback)(status_code, ptr, num_bytes);
+    } catch (...) {
+        transfer->callback_error = std::current_exception();
+        return 0;
+    }
+
+    return num_bytes;
+}
+
+template <typename T>
+static void setOption(CURL* handle, CURLoption option, T value)
+{
+    auto result = curl_easy_setopt(handle, option, value);
+    if (result != CURLE_OK)
+        throw CurlPool::Error {
+            lth_loc::format("failed to set up the HTTP request: {1}",
+                            curl_easy_strerror(result)) };
+}
+
+CurlPool::CurlPool(std::string ca,
+                   std::string crt,
+                   std::string key,
+                   uint32_t max_transfers,
+                   uint64_t max_bytes_per_second)
+        : ca_ { std::move(ca) },
+          crt_ { std::move(crt) },
+          key_ { std::move(key) },
+          share_ { nullptr },
+          idle_handles_ {},
+          num_active_transfers_ { 0 },
+          max_transfers_ { max_transfers },
+          bandwidth_ { max_bytes_per_second }
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    share_ = curl_share_init();
+
+    if (share_ == nullptr) {
+        LOG_WARNING("Failed to initialize the curl share object; connections "
+                    "and TLS sessions will not be shared among task downloads");
+        return;
+    }
+
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &CurlPool::lockShare);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &CurlPool::unlockShare);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // Sharing the connection cache requires libcurl 7.57.0
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlPool::~CurlPool()
+{
+    for (auto handle : idle_handles_)
+        curl_easy_cleanup(handle);
+
+    if (share_ != nullptr)
+        curl_share_cleanup(share_);
+
+    curl_global_cleanup();
+}
+
+long CurlPool::get(const std::string& url,
+                   const WriteCallback& write_callback,
+                   std::string& error_body,
+                   long connection_timeout_ms,
+                   uint64_t range_start)
+{
+    auto handle = checkout();
+    lth_util::scope_exit handle_releaser { [&]() { checkin(handle); } };
+
+    char error_buffer[CURL_ERROR_SIZE];
+    error_buffer[0] = '\0';
+    Transfer transfer { handle, &write_callback, &error_body, &bandwidth_, nullptr };
+
+    // NB: curl_easy_reset() keeps the handle's connections, DNS and
+    // TLS session caches; it resets the options, including the share
+    curl_easy_reset(handle);
+    if (share_ != nullptr)
+        setOption(handle, CURLOPT_SHARE, share_);
+    setOption(handle, CURLOPT_URL, url.c_str());
+    setOption(handle, CURLOPT_HTTPGET, 1L);
+    setOption(handle, CURLOPT_NOSIGNAL, 1L);
+    setOption(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    setOption(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x075500
+    setOption(handle, CURLOPT_PROTOCOLS_STR, "https");
+    setOption(handle, CURLOPT_REDIR_PROTOCOLS_STR, "https");
+#else
+    setOption(handle, CURLOPT_PROTOCOLS, static_cast<long>(CURLPROTO_HTTPS));
+    setOption(handle, CURLOPT_REDIR_PROTOCOLS, static_cast<long>(CURLPROTO_HTTPS));
+#endif
+    setOption(handle, CURLOPT_CONNECTTIMEOUT_MS, connection_timeout_ms);
+
+    // NB: CURLOPT_RANGE is used instead of CURLOPT_RESUME_FROM_LARGE
+    // as the latter makes the transfer fail if the server ignores
+    // the range; the caller can instead start over
+    std::string range {};
+    if (range_start > 0) {
+        range = std::to_string(range_start) + "-";
+        setOption(handle, CURLOPT_RANGE, range.c_str());
+    }
+    setOption(handle, CURLOPT_CAINFO, ca_.c_str());
+    setOption(handle, CURLOPT_SSLCERT, crt_.c_str());
+    setOption(handle, CURLOPT_SSLKEY, key_.c_str());
+    setOption(handle, CURLOPT_ERRORBUFFER, error_buffer);
+    setOption(handle, CURLOPT_WRITEFUNCTION, &writeData);
+    setOption(handle, CURLOPT_WRITEDATA, &transfer);
+
+    auto result = curl_easy_perform(handle);
+
+    if (transfer.callback_error)
+        std::rethrow_exception(transfer.callback_error);
+
+    if (result != CURLE_OK)
+        throw TransferError {
+            lth_loc::format("request to {1} failed: {2}",
+                            url,
+                            (error_buffer[0] != '\0' ? std::string { error_buffer }
+                                                     : curl_easy_strerror(result))) };
+
+    long status_code { 0 };
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code);
+    return status_code;
+}
+
+size_t CurlPool::numIdleHandles()
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { idle_handles_mutex_ };
+    return idle_handles_.size();
+}
+
+uint32_t CurlPool::numActiveTransfers()
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { idle_handles_mutex_ };
+    return num_active_transfers_;
+}
+
+CURL* CurlPool::checkout()
+{
+    {
+        pcp_util::unique_lock<pcp_util::mutex> the_lock { idle_handles_mutex_ };
+
+        if (max_transfers_ > 0 && num_active_transfers_ >= max_transfers_) {
+            LOG_DEBUG("Waiting for one of the {1} ongoing task downloads to complete",
+                      num_active_transfers_);
+            while (num_active_transfers_ >= max_transfers_)
+                transfer_slot_cond_var_.wait(the_lock);
+        }
+
+        num_active_transfers_++;
+
+        if (!idle_handles_.empty()) {
+            auto handle = idle_handles_.back();
+            idle_handles_.pop_back();
+            return handle;
+        }
+    }
+
+    auto handle = curl_easy_init();
+    if (handle == nullptr) {
+        {
+            pcp_util::lock_guard<pcp_util::mutex> the_lock { idle_handles_mutex_ };
+            num_active_transfers_--;
+        }
+        transfer_slot_cond_var_.notify_one();
+        throw Error { lth_loc::translate("failed to initialize a curl handle") };
+    }
+
+    LOG_TRACE("Created a new curl handle for downloading task files");
+    return handle;
+}
+
+void CurlPool::checkin(CURL* handle)
+{
+    bool keep_handle { false };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { idle_handles_mutex_ };
+        num_active_transfers_--;
+        if (idle_handles_.size() < MAX_IDLE_HANDLES) {
+            idle_handles_.push_back(handle);
+            keep_handle = true;
+        }
+    }
+
+    transfer_slot_cond_var_.notify_one();
+
+    if (!keep_handle)
+        curl_easy_cleanup(handle);
+}
+
+void CurlPool::lockShare(CURL* handle,
+                         curl_lock_data data,
+                         curl_lock_access access,
+                         void* user_ptr)
+{
+    static_cast<CurlPool*>(user_ptr)->share_mutexes_[data].lock();
+}
+
+void CurlPool::unlockShare(CURL* handle,
+                           curl_lock_data data,
+                           void* user_ptr)
+{
+    static_cast<CurlPool*>(user_ptr)->share_mutexes_[data].unlock();
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
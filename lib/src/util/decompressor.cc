@@ -0,0 +1,156 @@
+#include <pxp-agent/util/decompressor.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#include <zlib.h>
+
+#ifdef PXP_AGENT_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_loc = leatherman::locale;
+
+// Size of the buffer used for the decompressed output
+static const size_t OUTPUT_CHUNK_SIZE { 0x10000 };  // 64 kB
+
+//
+// gzip
+//
+
+class GzipDecompressor : public Decompressor {
+  public:
+    GzipDecompressor()
+            : stream_ {},
+              stream_ended_ { false },
+              output_buffer_(OUTPUT_CHUNK_SIZE)
+    {
+        // NB: 16 + MAX_WBITS makes zlib expect a gzip header
+        if (inflateInit2(&stream_, 16 + MAX_WBITS) != Z_OK)
+            throw Error { lth_loc::translate("failed to initialize the gzip decompressor") };
+    }
+
+    ~GzipDecompressor()
+    {
+        inflateEnd(&stream_);
+    }
+
+    void decompress(const char* data,
+                    size_t size,
+                    const OutputCallback& output_callback) override
+    {
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+
+        while (stream_.avail_in > 0) {
+            if (stream_ended_) {
+                // Concatenated gzip members
+                inflateReset(&stream_);
+                stream_ended_ = false;
+            }
+
+            stream_.next_out = reinterpret_cast<Bytef*>(output_buffer_.data());
+            stream_.avail_out = static_cast<uInt>(output_buffer_.size());
+
+            auto result = inflate(&stream_, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+                throw Error {
+                    lth_loc::format("invalid gzip content: {1}",
+                                    (stream_.msg != nullptr ? stream_.msg : zError(result))) };
+
+            auto num_bytes = output_buffer_.size() - stream_.avail_out;
+            if (num_bytes > 0)
+                output_callback(output_buffer_.data(), num_bytes);
+
+            if (result == Z_STREAM_END)
+                stream_ended_ = true;
+        }
+    }
+
+    void finish() override
+    {
+        if (!stream_ended_)
+            throw Error { lth_loc::translate("the gzip content is truncated") };
+    }
+
+  private:
+    z_stream stream_;
+    bool stream_ended_;
+    std::vector<char> output_buffer_;
+};
+
+#ifdef PXP_AGENT_HAS_ZSTD
+
+//
+// zstd
+//
+
+class ZstdDecompressor : public Decompressor {
+  public:
+    ZstdDecompressor()
+            : dctx_ { ZSTD_createDCtx() },
+              frame_ended_ { true },
+              output_buffer_(ZSTD_DStreamOutSize())
+    {
+        if (dctx_ == nullptr)
+            throw Error { lth_loc::translate("failed to initialize the zstd decompressor") };
+    }
+
+    ~ZstdDecompressor()
+    {
+        ZSTD_freeDCtx(dctx_);
+    }
+
+    void decompress(const char* data,
+                    size_t size,
+                    const OutputCallback& output_callback) override
+    {
+        ZSTD_inBuffer input { data, size, 0 };
+
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output { output_buffer_.data(), output_buffer_.size(), 0 };
+            auto result = ZSTD_decompressStream(dctx_, &output, &input);
+            if (ZSTD_isError(result))
+                throw Error {
+                    lth_loc::format("invalid zstd content: {1}", ZSTD_getErrorName(result)) };
+
+            if (output.pos > 0)
+                output_callback(output_buffer_.data(), output.pos);
+
+            // 0 means that a frame was completely decoded and flushed
+            frame_ended_ = (result == 0);
+        }
+    }
+
+    void finish() override
+    {
+        if (!frame_ended_)
+            throw Error { lth_loc::translate("the zstd content is truncated") };
+    }
+
+  private:
+    ZSTD_DCtx* dctx_;
+    bool frame_ended_;
+    std::vector<char> output_buffer_;
+};
+
+#endif  // PXP_AGENT_HAS_ZSTD
+
+std::unique_ptr<Decompressor> Decompressor::create(const std::string& compression)
+{
+    if (compression == "gzip")
+        return std::unique_ptr<Decompressor>(new GzipDecompressor());
+#ifdef PXP_AGENT_HAS_ZSTD
+    if (compression == "zstd")
+        return std::unique_ptr<Decompressor>(new ZstdDecompressor());
+#endif
+
+    throw Error { lth_loc::format("unsupported compression: {1}", compression) };
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,189 @@
+#include <pxp-agent/util/file_syncer.hpp>
+
+#include <leatherman/file_util/file.hpp>
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.file_syncer"
+#include <leatherman/logging/logging.hpp>
+
+#include <boost/nowide/fstream.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <utility>  // std::swap
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_file = leatherman::file_util;
+namespace lth_loc  = leatherman::locale;
+namespace pcp_util = PCPClient::Util;
+
+const pcp_util::chrono::milliseconds FileSyncer::GROUP_COMMIT_INTERVAL { 50 };
+
+FileSyncer::FileSyncer(Durability durability,
+                       pcp_util::chrono::milliseconds group_commit_interval)
+        : durability_ { durability },
+          group_commit_interval_ { group_commit_interval },
+          queued_files_ {},
+          queued_directories_ {},
+          stopping_ { false },
+          group_commit_thread_ptr_ { nullptr }
+{
+    if (durability_ == Durability::GroupCommit)
+        group_commit_thread_ptr_.reset(
+            new pcp_util::thread(&FileSyncer::groupCommitTask, this));
+}
+
+FileSyncer::~FileSyncer()
+{
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        stopping_ = true;
+    }
+
+    cond_var_.notify_one();
+
+    if (group_commit_thread_ptr_ != nullptr && group_commit_thread_ptr_->joinable())
+        group_commit_thread_ptr_->join();
+}
+
+void FileSyncer::writeFile(const std::string& content,
+                           const std::string& file_path,
+                           fs::perms perms)
+{
+    if (durability_ != Durability::Strict) {
+        try {
+            lth_file::atomic_write_to_file(content, file_path, perms, std::ios::binary);
+        } catch (const std::exception& e) {
+            throw Error { e.what() };
+        }
+        sync(file_path);
+        syncEntry(file_path);
+        return;
+    }
+
+    auto temp_path = file_path + "~";
+    {
+        boost::nowide::ofstream temp_stream { temp_path, std::ios::binary | std::ios::trunc };
+        temp_stream.write(content.data(), content.size());
+        temp_stream.close();
+        if (temp_stream.fail()) {
+            boost::system::error_code ec;
+            fs::remove(temp_path, ec);
+            throw Error { lth_loc::format("failed to write '{1}'", temp_path) };
+        }
+    }
+
+    try {
+        syncFile(temp_path);
+        fs::permissions(temp_path, perms);
+        fs::rename(temp_path, file_path);
+    } catch (const std::exception& e) {
+        boost::system::error_code ec;
+        fs::remove(temp_path, ec);
+        throw Error {
+            lth_loc::format("failed to replace '{1}': {2}", file_path, e.what()) };
+    }
+
+    syncDirectory(fs::path(file_path).parent_path().string());
+}
+
+void FileSyncer::sync(const std::string& file_path)
+{
+    if (durability_ == Durability::Strict) {
+        syncFile(file_path);
+    } else if (durability_ == Durability::GroupCommit) {
+        enqueue(queued_files_, file_path);
+    }
+}
+
+void FileSyncer::syncEntry(const std::string& path)
+{
+    auto dir_path = fs::path(path).parent_path().string();
+
+    if (durability_ == Durability::Strict) {
+        syncDirectory(dir_path);
+    } else if (durability_ == Durability::GroupCommit) {
+        enqueue(queued_directories_, dir_path);
+    }
+}
+
+void FileSyncer::enqueue(std::unordered_set<std::string>& queue, const std::string& path)
+{
+    bool was_idle { false };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        was_idle = queued_files_.empty() && queued_directories_.empty();
+        queue.insert(path);
+    }
+
+    // The first queued path starts the interval of the next flush
+    if (was_idle)
+        cond_var_.notify_one();
+}
+
+void FileSyncer::flush()
+{
+    std::unordered_set<std::string> files {};
+    std::unordered_set<std::string> directories {};
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        std::swap(files, queued_files_);
+        std::swap(directories, queued_directories_);
+    }
+
+    // NB: a queued file may have been removed meanwhile (e.g. purged)
+    for (const auto& file_path : files) {
+        try {
+            syncFile(file_path);
+        } catch (const Error& e) {
+            boost::system::error_code ec;
+            if (fs::exists(file_path, ec))
+                LOG_WARNING("Failed to flush '{1}' to disk: {2}", file_path, e.what());
+        }
+    }
+
+    for (const auto& dir_path : directories) {
+        try {
+            syncDirectory(dir_path);
+        } catch (const Error& e) {
+            boost::system::error_code ec;
+            if (fs::exists(dir_path, ec))
+                LOG_WARNING("Failed to flush '{1}' to disk: {2}", dir_path, e.what());
+        }
+    }
+
+    if (!files.empty() || !directories.empty())
+        LOG_TRACE("Flushed {1} files and {2} directories to disk",
+                  files.size(), directories.size());
+}
+
+void FileSyncer::groupCommitTask()
+{
+    while (true) {
+        bool stopping { false };
+        {
+            pcp_util::unique_lock<pcp_util::mutex> the_lock { mutex_ };
+            cond_var_.wait(the_lock,
+                           [this]() {
+                               return stopping_ || !queued_files_.empty()
+                                      || !queued_directories_.empty();
+                           });
+
+            // Let the writes of the interval join the flush
+            if (!stopping_)
+                cond_var_.wait_for(the_lock, group_commit_interval_,
+                                   [this]() { return stopping_; });
+            stopping = stopping_;
+        }
+
+        flush();
+
+        if (stopping)
+            return;
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,565 @@
+#include <pxp-agent/util/posix/detached_task.hpp>
+
+#include <leatherman/execution/execution.hpp>
+#include <leatherman/locale/locale.hpp>
+#include <leatherman/util/scope_exit.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.posix.detached_task"
+#include <leatherman/logging/logging.hpp>
+
+#include <algorithm>
+#include <cstring>          // strerror(), strlen()
+#include <errno.h>
+#include <fcntl.h>          // open() flags
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>       // fchmod()
+#include <sys/wait.h>       // waitpid()
+#include <unistd.h>         // fork(), execve(), dup2()
+
+#ifdef __linux__
+#include <sys/syscall.h>    // SYS_close_range
+#endif
+
+extern char** environ;
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_exec = leatherman::execution;
+namespace lth_loc  = leatherman::locale;
+namespace lth_util = leatherman::util;
+
+// Same permissions as the files written by the task_wrapper
+static const mode_t RESULTS_FILE_PERMS { 0640 };
+
+static const int EXEC_FAILURE_EXITCODE { 127 };
+
+static const size_t PIPE_CHUNK_SIZE { 65536 };
+
+namespace {
+
+// Owns the strings of a NULL terminated array, as passed to
+// execve(); it must be built before forking
+class CStringArray {
+  public:
+    explicit CStringArray(std::vector<std::string> strings)
+            : strings_ { std::move(strings) } {
+        for (auto& s : strings_)
+            pointers_.push_back(&s[0]);
+        pointers_.push_back(nullptr);
+    }
+
+    // Moving the vector of strings doesn't move its elements
+    CStringArray(CStringArray&&) = default;
+    CStringArray(const CStringArray&) = delete;
+
+    char* const* get() { return pointers_.data(); }
+
+  private:
+    std::vector<std::string> strings_;
+    std::vector<char*> pointers_;
+};
+
+// Everything the reaper process needs, prepared before forking, as
+// it must only call async-signal-safe functions afterwards
+struct ReaperContext {
+    int stdin_fd;           // -1 if the input is fed through a pipe
+    int stdout_fd;
+    int stderr_fd;
+    long max_fd;
+    const char* executable;
+    char* const* argv;
+    char* const* envp;
+    const std::string& input;
+    const std::string& error_prefix;
+    const char* exitcode_path;
+    const char* exitcode_temp_path;
+};
+
+}  // namespace
+
+static std::string resolveExecutable(const std::string& executable)
+{
+    if (executable.find('/') == std::string::npos) {
+        auto found = lth_exec::which(executable);
+        if (!found.empty())
+            return found;
+    }
+    return executable;
+}
+
+static CStringArray getArgv(const std::string& executable_path,
+                            const std::vector<std::string>& arguments)
+{
+    std::vector<std::string> argv_strings { executable_path };
+    argv_strings.insert(argv_strings.end(), arguments.begin(), arguments.end());
+    return CStringArray { std::move(argv_strings) };
+}
+
+// Merges the environment with the agent's one
+static CStringArray getEnvp(const std::map<std::string, std::string>& environment)
+{
+    std::map<std::string, std::string> merged_environment;
+    for (auto var = environ; var != nullptr && *var != nullptr; var++) {
+        std::string name_value { *var };
+        auto equals = name_value.find('=');
+        if (equals != std::string::npos)
+            merged_environment.emplace(name_value.substr(0, equals), name_value.substr(equals + 1));
+    }
+    for (const auto& name_value : environment)
+        merged_environment[name_value.first] = name_value.second;
+
+    std::vector<std::string> envp_strings;
+    for (const auto& name_value : merged_environment)
+        envp_strings.push_back(name_value.first + "=" + name_value.second);
+    return CStringArray { std::move(envp_strings) };
+}
+
+static long getMaxFileDescriptor()
+{
+    auto max_fd = sysconf(_SC_OPEN_MAX);
+    return max_fd > 0 ? max_fd : 1024;
+}
+
+static int openResultsFile(const std::string& path)
+{
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, RESULTS_FILE_PERMS);
+    if (fd == -1)
+        throw DetachedTask::Error {
+            lth_loc::format("failed to open '{1}': {2}", path, strerror(errno)) };
+    // The mode passed to open() is subject to the umask
+    fchmod(fd, RESULTS_FILE_PERMS);
+    return fd;
+}
+
+static void closeFileDescriptor(int& fd)
+{
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+static int toExitCode(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return EXEC_FAILURE_EXITCODE;
+}
+
+static pid_t waitForProcess(pid_t pid, int& status)
+{
+    pid_t result;
+    do {
+        result = waitpid(pid, &status, 0);
+    } while (result == -1 && errno == EINTR);
+    return result;
+}
+
+// The functions below are called by the forked processes
+
+static void writeAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        auto written = write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// Writes the reason of a failure; strerror() is not async-signal-safe
+// (it may translate or allocate the message), so the common errors of
+// exec and fork have static messages and the others their number
+static void writeErrorReason(int error)
+{
+    static const struct { int number; const char* message; } ERROR_MESSAGES[] {
+        { ENOENT, "No such file or directory" },
+        { EACCES, "Permission denied" },
+        { ENOEXEC, "Exec format error" },
+        { ENOTDIR, "Not a directory" },
+        { ELOOP, "Too many levels of symbolic links" },
+        { ETXTBSY, "Text file busy" },
+        { E2BIG, "Argument list too long" },
+        { ENOMEM, "Cannot allocate memory" },
+        { EAGAIN, "Resource temporarily unavailable" },
+        { EMFILE, "Too many open files" } };
+
+    for (const auto& error_message : ERROR_MESSAGES) {
+        if (error_message.number == error) {
+            writeAll(STDERR_FILENO, error_message.message, strlen(error_message.message));
+            return;
+        }
+    }
+
+    char text[24] = "errno ";
+    size_t size { 6 };
+    char digits[12];
+    size_t num_digits { 0 };
+    auto value = static_cast<unsigned int>(error < 0 ? -error : error);
+    do {
+        digits[num_digits++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (num_digits > 0)
+        text[size++] = digits[--num_digits];
+    writeAll(STDERR_FILENO, text, size);
+}
+
+static void closeFileDescriptorsFrom3(long max_fd)
+{
+#if defined(__linux__) && defined(SYS_close_range)
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0)
+        return;
+#endif
+    for (long fd = 3; fd < max_fd; fd++)
+        close(static_cast<int>(fd));
+}
+
+// Detaches from the agent's session and undoes its signal setup
+static void detachFromAgent()
+{
+    setsid();
+    sigset_t empty_set;
+    sigemptyset(&empty_set);
+    sigprocmask(SIG_SETMASK, &empty_set, nullptr);
+    for (auto signal_number : { SIGCHLD, SIGHUP, SIGINT, SIGTERM, SIGPIPE })
+        signal(signal_number, SIG_DFL);
+}
+
+[[noreturn]] static void execTask(const char* executable,
+                                  char* const* argv,
+                                  char* const* envp,
+                                  const std::string& error_prefix)
+{
+    execve(executable, argv, envp);
+
+    auto error = errno;
+    writeAll(STDERR_FILENO, error_prefix.data(), error_prefix.size());
+    writeErrorReason(error);
+    _exit(EXEC_FAILURE_EXITCODE);
+}
+
+static void writeExitCode(const ReaperContext& context, int exit_code)
+{
+    char text[4];
+    size_t size { 0 };
+    for (int divisor = 100; divisor > 0; divisor /= 10) {
+        if (exit_code >= divisor || divisor == 1 || size > 0)
+            text[size++] = static_cast<char>('0' + (exit_code / divisor) % 10);
+    }
+
+    auto fd = open(context.exitcode_temp_path, O_WRONLY | O_CREAT | O_TRUNC, RESULTS_FILE_PERMS);
+    if (fd == -1)
+        return;
+    fchmod(fd, RESULTS_FILE_PERMS);
+    writeAll(fd, text, size);
+    close(fd);
+    rename(context.exitcode_temp_path, context.exitcode_path);
+}
+
+[[noreturn]] static void failReaper(const ReaperContext& context)
+{
+    auto error = errno;
+    writeAll(STDERR_FILENO, context.error_prefix.data(), context.error_prefix.size());
+    writeErrorReason(error);
+    writeExitCode(context, EXEC_FAILURE_EXITCODE);
+    _exit(EXEC_FAILURE_EXITCODE);
+}
+
+[[noreturn]] static void waitForTask(const ReaperContext& context, pid_t task_pid)
+{
+    int status { 0 };
+    auto exit_code = (waitForProcess(task_pid, status) == -1 ? EXEC_FAILURE_EXITCODE
+                                                            : toExitCode(status));
+    writeExitCode(context, exit_code);
+    _exit(exit_code);
+}
+
+[[noreturn]] static void runReaper(const ReaperContext& context)
+{
+    detachFromAgent();
+
+    if (dup2(context.stdout_fd, STDOUT_FILENO) == -1
+            || dup2(context.stderr_fd, STDERR_FILENO) == -1
+            || (context.stdin_fd != -1 && dup2(context.stdin_fd, STDIN_FILENO) == -1))
+        _exit(EXEC_FAILURE_EXITCODE);
+    // Don't keep the agent's connections and files open
+    closeFileDescriptorsFrom3(context.max_fd);
+
+    if (context.stdin_fd != -1) {
+        // The task reads its input directly from the file
+        auto task_pid = fork();
+        if (task_pid == -1)
+            failReaper(context);
+        if (task_pid == 0)
+            execTask(context.executable, context.argv, context.envp, context.error_prefix);
+        close(STDIN_FILENO);
+        waitForTask(context, task_pid);
+    }
+
+    int stdin_pipe[2];
+    if (pipe(stdin_pipe) == -1)
+        failReaper(context);
+
+    auto task_pid = fork();
+    if (task_pid == -1)
+        failReaper(context);
+
+    if (task_pid == 0) {
+        if (dup2(stdin_pipe[0], STDIN_FILENO) == -1)
+            _exit(EXEC_FAILURE_EXITCODE);
+        close(stdin_pipe[0]);
+        close(stdin_pipe[1]);
+        execTask(context.executable, context.argv, context.envp, context.error_prefix);
+    }
+
+    // The task may exit without reading its whole input
+    close(stdin_pipe[0]);
+    signal(SIGPIPE, SIG_IGN);
+    writeAll(stdin_pipe[1], context.input.data(), context.input.size());
+    close(stdin_pipe[1]);
+    waitForTask(context, task_pid);
+}
+
+static int runDetached(const std::string& executable,
+                       const std::vector<std::string>& arguments,
+                       const std::string& input,
+                       int stdin_fd,
+                       const std::map<std::string, std::string>& environment,
+                       const std::string& stdout_path,
+                       const std::string& stderr_path,
+                       const std::string& exitcode_path,
+                       std::function<void(pid_t)> pid_callback)
+{
+    auto executable_path = resolveExecutable(executable);
+    auto argv = getArgv(executable_path, arguments);
+    auto envp = getEnvp(environment);
+    auto error_prefix = lth_loc::format("Task '{1}' failed to run: ", executable);
+    auto exitcode_temp_path = exitcode_path + ".tmp";
+
+    auto stdout_fd = openResultsFile(stdout_path);
+    lth_util::scope_exit stdout_closer { [stdout_fd]() { close(stdout_fd); } };
+    auto stderr_fd = openResultsFile(stderr_path);
+    lth_util::scope_exit stderr_closer { [stderr_fd]() { close(stderr_fd); } };
+
+    ReaperContext context { stdin_fd,
+                            stdout_fd,
+                            stderr_fd,
+                            getMaxFileDescriptor(),
+                            executable_path.c_str(),
+                            argv.get(),
+                            envp.get(),
+                            input,
+                            error_prefix,
+                            exitcode_path.c_str(),
+                            exitcode_temp_path.c_str() };
+
+    auto reaper_pid = fork();
+    if (reaper_pid == -1)
+        throw DetachedTask::Error {
+            lth_loc::format("failed to spawn the task process: {1}", strerror(errno)) };
+    if (reaper_pid == 0)
+        runReaper(context);
+
+    LOG_DEBUG("Spawned the process {1} running '{2}'", reaper_pid, executable);
+    if (pid_callback) {
+        try {
+            pid_callback(reaper_pid);
+        } catch (const std::exception& e) {
+            LOG_WARNING("Failed to process the PID of the task '{1}': {2}", executable, e.what());
+        }
+    }
+
+    int status { 0 };
+    if (waitForProcess(reaper_pid, status) == -1)
+        throw DetachedTask::Error {
+            lth_loc::format("failed to wait for the task process: {1}", strerror(errno)) };
+    return toExitCode(status);
+}
+
+int DetachedTask::run(const std::string& executable,
+                      const std::vector<std::string>& arguments,
+                      const std::string& input,
+                      const std::map<std::string, std::string>& environment,
+                      const std::string& stdout_path,
+                      const std::string& stderr_path,
+                      const std::string& exitcode_path,
+                      std::function<void(pid_t)> pid_callback)
+{
+    return runDetached(executable, arguments, input, -1, environment,
+                       stdout_path, stderr_path, exitcode_path, pid_callback);
+}
+
+int DetachedTask::runWithInputFile(const std::string& executable,
+                                   const std::vector<std::string>& arguments,
+                                   const std::string& input_path,
+                                   const std::map<std::string, std::string>& environment,
+                                   const std::string& stdout_path,
+                                   const std::string& stderr_path,
+                                   const std::string& exitcode_path,
+                                   std::function<void(pid_t)> pid_callback)
+{
+    auto stdin_fd = open(input_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (stdin_fd == -1)
+        throw Error { lth_loc::format("failed to open '{1}': {2}", input_path, strerror(errno)) };
+    lth_util::scope_exit stdin_closer { [stdin_fd]() { close(stdin_fd); } };
+
+    return runDetached(executable, arguments, "", stdin_fd, environment,
+                       stdout_path, stderr_path, exitcode_path, pid_callback);
+}
+
+int DetachedTask::capture(const std::string& executable,
+                          const std::vector<std::string>& arguments,
+                          const std::string& input,
+                          const std::map<std::string, std::string>& environment,
+                          std::function<void(pid_t)> pid_callback,
+                          const OutputCallback& stdout_callback,
+                          const OutputCallback& stderr_callback)
+{
+    auto executable_path = resolveExecutable(executable);
+    auto argv = getArgv(executable_path, arguments);
+    auto envp = getEnvp(environment);
+    auto error_prefix = lth_loc::format("Task '{1}' failed to run: ", executable);
+    auto max_fd = getMaxFileDescriptor();
+
+    int stdin_pipe[2] { -1, -1 };
+    int stdout_pipe[2] { -1, -1 };
+    int stderr_pipe[2] { -1, -1 };
+    lth_util::scope_exit pipes_closer { [&]() {
+        for (auto pipe_fds : { stdin_pipe, stdout_pipe, stderr_pipe }) {
+            closeFileDescriptor(pipe_fds[0]);
+            closeFileDescriptor(pipe_fds[1]);
+        }
+    } };
+    for (auto pipe_fds : { stdin_pipe, stdout_pipe, stderr_pipe }) {
+        if (pipe(pipe_fds) == -1)
+            throw Error { lth_loc::format("failed to create a pipe: {1}", strerror(errno)) };
+        fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    auto pid = fork();
+    if (pid == -1)
+        throw Error { lth_loc::format("failed to spawn the task process: {1}", strerror(errno)) };
+
+    if (pid == 0) {
+        detachFromAgent();
+        if (dup2(stdin_pipe[0], STDIN_FILENO) == -1
+                || dup2(stdout_pipe[1], STDOUT_FILENO) == -1
+                || dup2(stderr_pipe[1], STDERR_FILENO) == -1)
+            _exit(EXEC_FAILURE_EXITCODE);
+        closeFileDescriptorsFrom3(max_fd);
+        execTask(executable_path.c_str(), argv.get(), envp.get(), error_prefix);
+    }
+
+    closeFileDescriptor(stdin_pipe[0]);
+    closeFileDescriptor(stdout_pipe[1]);
+    closeFileDescriptor(stderr_pipe[1]);
+
+    // Reap the process also in case an output callback throws; closing
+    // the pipes beforehand makes it terminate if it keeps writing
+    bool reaped { false };
+    lth_util::scope_exit process_reaper { [&]() {
+        if (!reaped) {
+            closeFileDescriptor(stdin_pipe[1]);
+            closeFileDescriptor(stdout_pipe[0]);
+            closeFileDescriptor(stderr_pipe[0]);
+            int status;
+            waitForProcess(pid, status);
+        }
+    } };
+
+    LOG_DEBUG("Spawned the process {1} running '{2}'", pid, executable);
+    if (pid_callback) {
+        try {
+            pid_callback(pid);
+        } catch (const std::exception& e) {
+            LOG_WARNING("Failed to process the PID of the task '{1}': {2}", executable, e.what());
+        }
+    }
+
+    // Writing to the pipe once the process exited raises a SIGPIPE,
+    // which must not terminate the agent; it's blocked in this thread
+    // and discarded before unblocking it
+    sigset_t sigpipe_set, old_set;
+    sigemptyset(&sigpipe_set);
+    sigaddset(&sigpipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe_set, &old_set);
+    lth_util::scope_exit sigpipe_restorer { [&]() {
+        sigset_t pending_set;
+        int signal_number;
+        if (sigpending(&pending_set) == 0 && sigismember(&pending_set, SIGPIPE))
+            sigwait(&sigpipe_set, &signal_number);
+        pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    } };
+
+    size_t input_offset { 0 };
+    if (input.empty())
+        closeFileDescriptor(stdin_pipe[1]);
+    else
+        fcntl(stdin_pipe[1], F_SETFL, O_NONBLOCK);
+
+    std::vector<char> buffer(PIPE_CHUNK_SIZE);
+    while (stdout_pipe[0] != -1 || stderr_pipe[0] != -1) {
+        std::vector<pollfd> poll_fds;
+        if (stdin_pipe[1] != -1)
+            poll_fds.push_back({ stdin_pipe[1], POLLOUT, 0 });
+        if (stdout_pipe[0] != -1)
+            poll_fds.push_back({ stdout_pipe[0], POLLIN, 0 });
+        if (stderr_pipe[0] != -1)
+            poll_fds.push_back({ stderr_pipe[0], POLLIN, 0 });
+
+        if (poll(poll_fds.data(), poll_fds.size(), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            throw Error { lth_loc::format("failed to poll the task's pipes: {1}", strerror(errno)) };
+        }
+
+        for (const auto& poll_fd : poll_fds) {
+            if (poll_fd.revents == 0)
+                continue;
+
+            if (poll_fd.fd == stdin_pipe[1]) {
+                auto written = write(stdin_pipe[1], input.data() + input_offset,
+                                     std::min(input.size() - input_offset, PIPE_CHUNK_SIZE));
+                if (written > 0) {
+                    input_offset += static_cast<size_t>(written);
+                } else if (errno != EAGAIN && errno != EINTR) {
+                    // The task exited without reading its whole input
+                    input_offset = input.size();
+                }
+                if (input_offset == input.size())
+                    closeFileDescriptor(stdin_pipe[1]);
+                continue;
+            }
+
+            bool is_stdout { poll_fd.fd == stdout_pipe[0] };
+            auto num_read = read(poll_fd.fd, buffer.data(), buffer.size());
+            if (num_read > 0) {
+                (is_stdout ? stdout_callback : stderr_callback)(buffer.data(),
+                                                                static_cast<size_t>(num_read));
+            } else if (num_read == 0 || (errno != EAGAIN && errno != EINTR)) {
+                closeFileDescriptor(is_stdout ? stdout_pipe[0] : stderr_pipe[0]);
+            }
+        }
+    }
+    closeFileDescriptor(stdin_pipe[1]);
+
+    int status { 0 };
+    reaped = true;
+    if (waitForProcess(pid, status) == -1)
+        throw Error {
+            lth_loc::format("failed to wait for the task process: {1}", strerror(errno)) };
+    return toExitCode(status);
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,43 @@
+#include <pxp-agent/util/file_syncer.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#include <errno.h>
+#include <fcntl.h>      // open()
+#include <string.h>     // strerror()
+#include <unistd.h>     // fsync(), close()
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_loc = leatherman::locale;
+
+static void syncPath(const std::string& path, int flags)
+{
+    auto fd = open(path.c_str(), flags);
+    if (fd < 0)
+        throw FileSyncer::Error {
+            lth_loc::format("failed to open '{1}': {2}", path, strerror(errno)) };
+
+    auto result = fsync(fd);
+    auto fsync_errno = errno;
+    close(fd);
+
+    if (result != 0)
+        throw FileSyncer::Error {
+            lth_loc::format("failed to flush '{1}': {2}", path, strerror(fsync_errno)) };
+}
+
+void FileSyncer::syncFile(const std::string& file_path)
+{
+    syncPath(file_path, O_RDONLY);
+}
+
+// NB: needed for a created or renamed file to survive a crash
+void FileSyncer::syncDirectory(const std::string& dir_path)
+{
+    syncPath(dir_path, O_RDONLY | O_DIRECTORY);
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -3,6 +3,11 @@
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>         // getpid()
+#include <sys/resource.h>   // setpriority()
+
+#ifdef __linux__
+#include <sys/syscall.h>    // SYS_gettid, SYS_ioprio_set
+#endif
 
 namespace PXPAgent {
 namespace Util {
@@ -30,5 +35,25 @@ int getPid() {
     return getpid();
 }
 
+#ifdef __linux__
+// From linux/ioprio.h, which is not shipped by every distribution
+static const int IOPRIO_WHO_PROCESS { 1 };
+static const int IOPRIO_CLASS_BE { 2 };
+static const int IOPRIO_CLASS_SHIFT { 13 };
+#endif
+
+// NB: only Linux allows setting the nice value and the I/O priority
+// of a single thread; elsewhere they would apply to the whole process
+void lowerThreadPriority() {
+#ifdef __linux__
+    auto tid = static_cast<id_t>(syscall(SYS_gettid));
+    setpriority(PRIO_PROCESS, tid, 19);
+    // Lowest best-effort I/O priority, as 'ionice -c 2 -n 7'; the
+    // idle class could starve the thread on a busy disk
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+            (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7);
+#endif
+}
+
 }  // namespace Util
 }  // namespace PXPAgent
@@ -0,0 +1,71 @@
+#include <pxp-agent/util/purgeable.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace pcp_util = PCPClient::Util;
+
+PurgeBudget::PurgeBudget(unsigned int max_dirs,
+                         uint64_t max_bytes,
+                         pcp_util::chrono::milliseconds max_duration)
+        : max_dirs_ { max_dirs },
+          max_bytes_ { max_bytes },
+          limits_duration_ { max_duration.count() > 0 },
+          deadline_ { pcp_util::chrono::steady_clock::now() + max_duration },
+          num_dirs_ { 0 },
+          num_bytes_ { 0 }
+{
+}
+
+bool PurgeBudget::exhausted() const
+{
+    return (max_dirs_ > 0 && num_dirs_ >= max_dirs_)
+           || (max_bytes_ > 0 && num_bytes_ >= max_bytes_)
+           || (limits_duration_ && pcp_util::chrono::steady_clock::now() >= deadline_);
+}
+
+void PurgeBudget::charge(uint64_t num_bytes)
+{
+    num_dirs_++;
+    num_bytes_ += num_bytes;
+}
+
+void Purgeable::purgeDirectory(
+    const std::string& dir_path,
+    const std::function<void(const std::string& dir_path)>& purge_callback,
+    PurgeBudget* budget)
+{
+    uint64_t size { 0 };
+    if (budget != nullptr && budget->limitsBytes())
+        size = getDirectorySize(dir_path);
+
+    purge_callback(dir_path);
+
+    if (budget != nullptr)
+        budget->charge(size);
+}
+
+uint64_t Purgeable::getDirectorySize(const fs::path& dir_path)
+{
+    uint64_t size { 0 };
+    boost::system::error_code ec;
+    fs::recursive_directory_iterator it { dir_path, ec }, end;
+
+    for (; !ec && it != end; it.increment(ec)) {
+        boost::system::error_code size_ec;
+        if (fs::is_regular_file(it->status())) {
+            auto file_size = fs::file_size(it->path(), size_ec);
+            if (!size_ec)
+                size += file_size;
+        }
+    }
+
+    return size;
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
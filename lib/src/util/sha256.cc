@@ -0,0 +1,52 @@
+#include <pxp-agent/util/sha256.hpp>
+
+#include <boost/algorithm/hex.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace alg = boost::algorithm;
+
+Sha256Digest::Sha256Digest()
+        : mdctx_ { EVP_MD_CTX_create() }
+{
+    reset();
+}
+
+Sha256Digest::~Sha256Digest()
+{
+    EVP_MD_CTX_destroy(mdctx_);
+}
+
+void Sha256Digest::reset()
+{
+    EVP_DigestInit_ex(mdctx_, EVP_sha256(), nullptr);
+}
+
+void Sha256Digest::update(const char* data, size_t size)
+{
+    EVP_DigestUpdate(mdctx_, data, size);
+}
+
+std::string Sha256Digest::hexDigest()
+{
+    unsigned char md_value[EVP_MAX_MD_SIZE];
+    unsigned int md_len;
+
+    EVP_DigestFinal_ex(mdctx_, md_value, &md_len);
+
+    std::string md_value_hex;
+
+    md_value_hex.reserve(2*md_len);
+    // TODO use boost::algorithm::hex_lower and drop the std::transform below when we upgrade to boost 1.62.0 or newer
+    alg::hex(md_value, md_value+md_len, std::back_inserter(md_value_hex));
+    std::transform(md_value_hex.begin(), md_value_hex.end(), md_value_hex.begin(), ::tolower);
+
+    return md_value_hex;
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,76 @@
+#include <pxp-agent/util/spill_buffer.hpp>
+
+#include <leatherman/file_util/file.hpp>
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.spill_buffer"
+#include <leatherman/logging/logging.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_file = leatherman::file_util;
+namespace lth_loc = leatherman::locale;
+
+SpillBuffer::SpillBuffer(std::string file_path, size_t threshold, fs::perms file_perms)
+        : file_path_ { std::move(file_path) },
+          threshold_ { threshold },
+          file_perms_ { file_perms },
+          buffer_ {},
+          spilled_ { false },
+          ofs_ {}
+{
+}
+
+void SpillBuffer::openFile()
+{
+    ofs_.open(file_path_, std::ios::binary | std::ios::trunc);
+    if (!ofs_)
+        throw Error { lth_loc::format("failed to open {1} for writing", file_path_) };
+
+    boost::system::error_code ec;
+    fs::permissions(file_path_, file_perms_, ec);
+}
+
+void SpillBuffer::append(const char* data, size_t size)
+{
+    if (!spilled_ && buffer_.size() + size <= threshold_) {
+        buffer_.append(data, size);
+        return;
+    }
+
+    if (!spilled_) {
+        LOG_DEBUG("The output exceeds {1} bytes; moving it to {2}", threshold_, file_path_);
+        openFile();
+        ofs_.write(buffer_.data(), buffer_.size());
+        std::string {}.swap(buffer_);
+        spilled_ = true;
+    }
+
+    if (!ofs_.write(data, size))
+        throw Error { lth_loc::format("failed to write to {1}", file_path_) };
+}
+
+std::string SpillBuffer::finish()
+{
+    if (!spilled_) {
+        openFile();
+        ofs_.write(buffer_.data(), buffer_.size());
+    }
+
+    ofs_.close();
+    if (ofs_.fail())
+        throw Error { lth_loc::format("failed to write to {1}", file_path_) };
+
+    if (!spilled_)
+        return std::move(buffer_);
+
+    std::string content;
+    if (!lth_file::read(file_path_, content))
+        throw Error { lth_loc::format("failed to read {1}", file_path_) };
+    return content;
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,361 @@
+#include <pxp-agent/util/tar_extractor.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.tar_extractor"
+#include <leatherman/logging/logging.hpp>
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_loc = leatherman::locale;
+
+static const size_t BLOCK_SIZE { 512 };
+
+// Maximum size of the GNU long name and pax header members
+static const uint64_t MAX_METADATA_SIZE { 0x10000 };  // 64 kB
+
+// Offsets and sizes of the ustar header fields
+static const size_t NAME_OFFSET { 0 };
+static const size_t NAME_SIZE { 100 };
+static const size_t SIZE_OFFSET { 124 };
+static const size_t SIZE_SIZE { 12 };
+static const size_t CHECKSUM_OFFSET { 148 };
+static const size_t CHECKSUM_SIZE { 8 };
+static const size_t TYPEFLAG_OFFSET { 156 };
+static const size_t MAGIC_OFFSET { 257 };
+static const size_t PREFIX_OFFSET { 345 };
+static const size_t PREFIX_SIZE { 155 };
+
+// Returns the content of a NUL terminated header field
+static std::string getString(const std::string& header, size_t offset, size_t size)
+{
+    auto field = header.substr(offset, size);
+    return field.substr(0, field.find('\0'));
+}
+
+// Parses a numeric header field; the value is either in octal,
+// padded with spaces or NULs, or, for large sizes, base-256 encoded
+// (the GNU extension, denoted by the high bit of the first byte)
+static uint64_t getNumber(const std::string& header, size_t offset, size_t size)
+{
+    uint64_t value { 0 };
+
+    if (static_cast<unsigned char>(header[offset]) & 0x80) {
+        value = static_cast<unsigned char>(header[offset]) & 0x7f;
+        for (size_t i = offset + 1; i < offset + size; i++)
+            value = (value << 8) | static_cast<unsigned char>(header[i]);
+        return value;
+    }
+
+    size_t i { offset };
+    while (i < offset + size && (header[i] == ' ' || header[i] == '\0'))
+        i++;
+    for (; i < offset + size && header[i] >= '0' && header[i] <= '7'; i++)
+        value = (value << 3) | static_cast<uint64_t>(header[i] - '0');
+
+    return value;
+}
+
+// Returns the normalized relative path of a member; throws an Error
+// in case the path could escape the destination directory
+static std::string getRelativePath(const std::string& member_path)
+{
+    if (!member_path.empty() && (member_path[0] == '/' || member_path[0] == '\\'))
+        throw TarExtractor::Error {
+            lth_loc::format("the tar archive contains an absolute path: {1}", member_path) };
+
+    std::vector<std::string> components;
+    boost::algorithm::split(components, member_path,
+                            [](char c) { return c == '/' || c == '\\'; });
+
+    std::vector<std::string> normalized_components;
+    for (const auto& component : components) {
+        if (component.empty() || component == ".")
+            continue;
+        if (component == ".." || component.find(':') != std::string::npos)
+            throw TarExtractor::Error {
+                lth_loc::format("the tar archive contains an invalid path: {1}", member_path) };
+        normalized_components.push_back(component);
+    }
+
+    return boost::algorithm::join(normalized_components, "/");
+}
+
+TarExtractor::TarExtractor(fs::path dest_dir, fs::perms file_perms)
+        : dest_dir_ { std::move(dest_dir) },
+          file_perms_ { file_perms },
+          state_ { State::Header },
+          member_type_ { MemberType::Skipped },
+          header_ {},
+          remaining_ { 0 },
+          padding_ { 0 },
+          metadata_ {},
+          next_path_ {},
+          member_ {},
+          member_ofs_ {},
+          member_digest_ {},
+          members_ {}
+{
+    header_.reserve(BLOCK_SIZE);
+}
+
+void TarExtractor::extract(const char* data, size_t size)
+{
+    while (size > 0) {
+        size_t num_bytes { 0 };
+
+        switch (state_) {
+            case State::Header:
+                num_bytes = std::min(BLOCK_SIZE - header_.size(), size);
+                header_.append(data, num_bytes);
+                if (header_.size() == BLOCK_SIZE) {
+                    processHeader();
+                    header_.clear();
+                }
+                break;
+
+            case State::Data:
+                num_bytes = static_cast<size_t>(std::min<uint64_t>(remaining_, size));
+                processData(data, num_bytes);
+                remaining_ -= num_bytes;
+                if (remaining_ == 0) {
+                    completeMember();
+                    state_ = (padding_ > 0 ? State::Padding : State::Header);
+                }
+                break;
+
+            case State::Padding:
+                num_bytes = static_cast<size_t>(std::min<uint64_t>(padding_, size));
+                padding_ -= num_bytes;
+                if (padding_ == 0)
+                    state_ = State::Header;
+                break;
+
+            case State::End:
+                // Ignore the remaining zero blocks
+                return;
+        }
+
+        data += num_bytes;
+        size -= num_bytes;
+    }
+}
+
+void TarExtractor::finish()
+{
+    if (state_ == State::End || (state_ == State::Header && header_.empty()))
+        return;
+
+    throw Error { lth_loc::translate("the tar archive is truncated") };
+}
+
+void TarExtractor::reset()
+{
+    if (member_ofs_.is_open())
+        member_ofs_.close();
+    member_ofs_.clear();
+
+    boost::system::error_code ec;
+    fs::remove_all(dest_dir_, ec);
+    if (ec)
+        throw Error {
+            lth_loc::format("failed to remove {1}: {2}", dest_dir_.string(), ec.message()) };
+
+    state_ = State::Header;
+    member_type_ = MemberType::Skipped;
+    header_.clear();
+    remaining_ = 0;
+    padding_ = 0;
+    metadata_.clear();
+    next_path_.clear();
+    members_.clear();
+}
+
+void TarExtractor::processHeader()
+{
+    if (std::all_of(header_.begin(), header_.end(), [](char c) { return c == '\0'; })) {
+        state_ = State::End;
+        return;
+    }
+
+    // The checksum is computed by considering its own field as spaces
+    uint64_t checksum { 0 };
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        bool is_checksum_field { i >= CHECKSUM_OFFSET && i < CHECKSUM_OFFSET + CHECKSUM_SIZE };
+        checksum += (is_checksum_field ? ' ' : static_cast<unsigned char>(header_[i]));
+    }
+    if (checksum != getNumber(header_, CHECKSUM_OFFSET, CHECKSUM_SIZE))
+        throw Error { lth_loc::translate("invalid tar header checksum") };
+
+    auto size = getNumber(header_, SIZE_OFFSET, SIZE_SIZE);
+    auto typeflag = header_[TYPEFLAG_OFFSET];
+
+    std::string path;
+    if (!next_path_.empty()) {
+        path = std::move(next_path_);
+        next_path_.clear();
+    } else {
+        path = getString(header_, NAME_OFFSET, NAME_SIZE);
+        auto prefix = getString(header_, PREFIX_OFFSET, PREFIX_SIZE);
+        if (header_.compare(MAGIC_OFFSET, 5, "ustar") == 0 && !prefix.empty())
+            path = prefix + "/" + path;
+    }
+
+    remaining_ = size;
+    padding_ = (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+
+    try {
+        switch (typeflag) {
+            case '0':
+            case '\0':
+            case '7': {
+                auto relative_path = getRelativePath(path);
+                if (relative_path.empty())
+                    throw Error {
+                        lth_loc::format("the tar archive contains an invalid path: {1}", path) };
+
+                auto file_path = dest_dir_ / relative_path;
+                fs::create_directories(file_path.parent_path());
+                member_ofs_.clear();
+                member_ofs_.open(file_path.string(), std::ios::binary | std::ios::trunc);
+                if (!member_ofs_)
+                    throw Error {
+                        lth_loc::format("failed to open {1} for writing", file_path.string()) };
+                fs::permissions(file_path, file_perms_);
+
+                member_type_ = MemberType::File;
+                member_ = Member { relative_path, size, "" };
+                member_digest_.reset();
+                break;
+            }
+
+            case '5': {
+                auto relative_path = getRelativePath(path);
+                if (!relative_path.empty())
+                    fs::create_directories(dest_dir_ / relative_path);
+                member_type_ = MemberType::Skipped;
+                break;
+            }
+
+            case 'L':
+            case 'x':
+                if (size > MAX_METADATA_SIZE)
+                    throw Error {
+                        lth_loc::format("the tar archive contains a header of {1} bytes, "
+                                        "exceeding the maximum of {2}",
+                                        size, MAX_METADATA_SIZE) };
+                member_type_ = (typeflag == 'L' ? MemberType::LongName : MemberType::PaxHeader);
+                metadata_.clear();
+                break;
+
+            case 'g':
+            case 'K':
+                // Global pax headers and GNU long link names are irrelevant
+                member_type_ = MemberType::Skipped;
+                break;
+
+            default:
+                throw Error {
+                    lth_loc::format("the tar archive contains the unsupported member {1} "
+                                    "(type '{2}'); only regular files and directories "
+                                    "are supported",
+                                    path, std::string(1, typeflag)) };
+        }
+    } catch (const fs::filesystem_error& e) {
+        throw Error { lth_loc::format("failed to extract {1}: {2}", path, e.what()) };
+    }
+
+    if (remaining_ > 0) {
+        state_ = State::Data;
+    } else {
+        completeMember();
+        state_ = State::Header;
+    }
+}
+
+void TarExtractor::processData(const char* data, size_t size)
+{
+    switch (member_type_) {
+        case MemberType::File:
+            if (!member_ofs_.write(data, size))
+                throw Error {
+                    lth_loc::format("failed to write {1}", (dest_dir_ / member_.path).string()) };
+            member_digest_.update(data, size);
+            break;
+
+        case MemberType::LongName:
+        case MemberType::PaxHeader:
+            metadata_.append(data, size);
+            break;
+
+        case MemberType::Skipped:
+            break;
+    }
+}
+
+void TarExtractor::completeMember()
+{
+    switch (member_type_) {
+        case MemberType::File:
+            member_ofs_.close();
+            if (member_ofs_.fail())
+                throw Error {
+                    lth_loc::format("failed to write {1}", (dest_dir_ / member_.path).string()) };
+            member_.sha256 = member_digest_.hexDigest();
+            LOG_TRACE("Extracted {1} ({2} bytes)", member_.path, member_.size);
+            // A repeated path replaces the earlier member, as it did on file
+            members_.erase(std::remove_if(members_.begin(), members_.end(),
+                                          [this](const Member& m) {
+                                              return m.path == member_.path;
+                                          }),
+                           members_.end());
+            members_.push_back(std::move(member_));
+            break;
+
+        case MemberType::LongName:
+            next_path_ = metadata_.substr(0, metadata_.find('\0'));
+            break;
+
+        case MemberType::PaxHeader: {
+            // Records are formatted as "<length> <key>=<value>\n"
+            size_t offset { 0 };
+            while (offset < metadata_.size()) {
+                auto space = metadata_.find(' ', offset);
+                uint64_t length { 0 };
+                try {
+                    length = std::stoull(metadata_.substr(offset, space - offset));
+                } catch (const std::exception&) {
+                    length = 0;
+                }
+                if (space == std::string::npos || offset + length < space + 2
+                        || offset + length > metadata_.size()) {
+                    throw Error { lth_loc::translate("invalid pax header in the tar archive") };
+                }
+
+                auto record = metadata_.substr(space + 1, offset + length - space - 2);
+                auto equals = record.find('=');
+                if (equals != std::string::npos && record.substr(0, equals) == "path")
+                    next_path_ = record.substr(equals + 1);
+
+                offset += length;
+            }
+            break;
+        }
+
+        case MemberType::Skipped:
+            break;
+    }
+
+    member_type_ = MemberType::Skipped;
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,222 @@
+#include <pxp-agent/util/task_cache_index.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.task_cache_index"
+#include <leatherman/logging/logging.hpp>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <vector>
+#include <utility>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace pcp_util = PCPClient::Util;
+
+const size_t TaskCacheIndex::MAX_PENDING_LAST_USE_UPDATES { 64 };
+
+// Prefixes of the names of the files that are being downloaded
+static const std::vector<std::string> TRANSIENT_FILE_PREFIXES { "temp_task_", "partial_task_" };
+
+TaskCacheIndex::TaskCacheIndex(fs::path task_cache_dir)
+        : task_cache_dir_ { std::move(task_cache_dir) },
+          tasks_ {},
+          num_pending_last_use_updates_ { 0 }
+{
+}
+
+TaskCacheIndex::~TaskCacheIndex()
+{
+    flush();
+}
+
+void TaskCacheIndex::load()
+{
+    std::map<std::string, CachedTask> tasks;
+    size_t num_files { 0 };
+    boost::system::error_code ec;
+
+    for (fs::directory_iterator dir_it { task_cache_dir_, ec }, end;
+         !ec && dir_it != end;
+         dir_it.increment(ec)) {
+        // Hidden directories (e.g. purged tasks) are not cached tasks
+        boost::system::error_code entry_ec;
+        if (!fs::is_directory(dir_it->status(entry_ec)) || entry_ec
+                || boost::algorithm::starts_with(dir_it->path().filename().string(), "."))
+            continue;
+
+        CachedTask task { {}, 0, false };
+
+        for (fs::directory_iterator file_it { dir_it->path(), entry_ec };
+             !entry_ec && file_it != end;
+             file_it.increment(entry_ec)) {
+            auto filename = file_it->path().filename().string();
+            bool is_transient { false };
+            for (const auto& prefix : TRANSIENT_FILE_PREFIXES)
+                is_transient |= boost::algorithm::starts_with(filename, prefix);
+
+            boost::system::error_code file_ec;
+            if (is_transient || !fs::is_regular_file(file_it->status(file_ec)) || file_ec)
+                continue;
+
+            auto size = fs::file_size(file_it->path(), file_ec);
+            if (file_ec)
+                continue;
+
+            task.files.emplace(filename, CachedFile { file_it->path(), size, false });
+            num_files++;
+        }
+
+        if (entry_ec) {
+            LOG_WARNING("Failed to inspect the cached task '{1}': {2}",
+                        dir_it->path().string(), entry_ec.message());
+            continue;
+        }
+
+        tasks.emplace(dir_it->path().filename().string(), std::move(task));
+    }
+
+    if (ec && ec != boost::system::errc::no_such_file_or_directory)
+        LOG_WARNING("Failed to inspect the task cache '{1}': {2}",
+                    task_cache_dir_.string(), ec.message());
+
+    LOG_DEBUG("Indexed {1} files of {2} cached tasks in '{3}'",
+              num_files, tasks.size(), task_cache_dir_.string());
+
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    tasks_ = std::move(tasks);
+    num_pending_last_use_updates_ = 0;
+}
+
+bool TaskCacheIndex::lookupVerified(const std::string& sha256,
+                                    const std::string& filename,
+                                    fs::path& path)
+{
+    bool must_flush { false };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        auto task_it = tasks_.find(sha256);
+        if (task_it == tasks_.end())
+            return false;
+
+        auto file_it = task_it->second.files.find(filename);
+        if (file_it == task_it->second.files.end() || !file_it->second.verified)
+            return false;
+
+        path = file_it->second.path;
+        must_flush = recordUse(task_it->second);
+    }
+
+    if (must_flush)
+        flush();
+
+    return true;
+}
+
+void TaskCacheIndex::addVerified(const std::string& sha256,
+                                 const std::string& filename,
+                                 const fs::path& path,
+                                 uintmax_t size)
+{
+    bool must_flush { false };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        auto& task = tasks_[sha256];
+        task.files[filename] = CachedFile { path, size, true };
+        must_flush = recordUse(task);
+    }
+
+    if (must_flush)
+        flush();
+}
+
+void TaskCacheIndex::remove(const std::string& sha256)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    auto task_it = tasks_.find(sha256);
+    if (task_it == tasks_.end())
+        return;
+
+    if (task_it->second.last_use_pending)
+        num_pending_last_use_updates_--;
+    tasks_.erase(task_it);
+}
+
+bool TaskCacheIndex::removeIfUnusedSince(const std::string& sha256, std::time_t since)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    auto task_it = tasks_.find(sha256);
+    if (task_it == tasks_.end())
+        return true;
+
+    // NB: a pending use may be in the same second as the persisted one
+    if (task_it->second.last_use_pending || task_it->second.last_use > since)
+        return false;
+
+    tasks_.erase(task_it);
+    return true;
+}
+
+std::time_t TaskCacheIndex::lastUse(const std::string& sha256)
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    auto task_it = tasks_.find(sha256);
+    return (task_it == tasks_.end() ? 0 : task_it->second.last_use);
+}
+
+size_t TaskCacheIndex::numFiles()
+{
+    pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+    size_t num_files { 0 };
+    for (const auto& task : tasks_)
+        num_files += task.second.files.size();
+    return num_files;
+}
+
+void TaskCacheIndex::flush()
+{
+    pcp_util::lock_guard<pcp_util::mutex> flush_lock { flush_mutex_ };
+    std::vector<std::pair<std::string, std::time_t>> updates;
+
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        if (num_pending_last_use_updates_ == 0)
+            return;
+
+        for (auto& task : tasks_) {
+            if (task.second.last_use_pending) {
+                updates.emplace_back(task.first, task.second.last_use);
+                task.second.last_use_pending = false;
+            }
+        }
+        num_pending_last_use_updates_ = 0;
+    }
+
+    for (const auto& update : updates) {
+        boost::system::error_code ec;
+        fs::last_write_time(task_cache_dir_ / update.first, update.second, ec);
+        if (ec)
+            LOG_DEBUG("Failed to persist the last use time of the cached task '{1}': {2}",
+                      update.first, ec.message());
+    }
+
+    LOG_TRACE("Persisted the last use time of {1} cached tasks", updates.size());
+}
+
+bool TaskCacheIndex::recordUse(CachedTask& task)
+{
+    task.last_use = time(nullptr);
+    if (!task.last_use_pending) {
+        task.last_use_pending = true;
+        num_pending_last_use_updates_++;
+    }
+    return num_pending_last_use_updates_ >= MAX_PENDING_LAST_USE_UPDATES;
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
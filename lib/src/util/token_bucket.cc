@@ -0,0 +1,43 @@
+#include <pxp-agent/util/token_bucket.hpp>
+
+#include <algorithm>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace pcp_util = PCPClient::Util;
+
+TokenBucket::TokenBucket(uint64_t tokens_per_second)
+        : tokens_per_second_ { tokens_per_second },
+          tokens_ { static_cast<double>(tokens_per_second) },
+          last_refill_ { pcp_util::chrono::steady_clock::now() }
+{
+}
+
+void TokenBucket::consume(uint64_t num_tokens)
+{
+    if (tokens_per_second_ == 0)
+        return;
+
+    int64_t wait_us { 0 };
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        auto now = pcp_util::chrono::steady_clock::now();
+        auto elapsed_us = pcp_util::chrono::duration_cast<pcp_util::chrono::microseconds>(
+            now - last_refill_).count();
+        last_refill_ = now;
+
+        tokens_ = std::min(static_cast<double>(tokens_per_second_),
+                           tokens_ + elapsed_us * tokens_per_second_ / 1e6);
+        tokens_ -= num_tokens;
+
+        if (tokens_ < 0)
+            wait_us = static_cast<int64_t>(-tokens_ * 1e6 / tokens_per_second_);
+    }
+
+    if (wait_us > 0)
+        pcp_util::this_thread::sleep_for(pcp_util::chrono::microseconds(wait_us));
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
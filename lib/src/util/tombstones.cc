@@ -0,0 +1,139 @@
+#include <pxp-agent/util/tombstones.hpp>
+#include <pxp-agent/util/process.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#define LEATHERMAN_LOGGING_NAMESPACE "puppetlabs.pxp_agent.util.tombstones"
+#include <leatherman/logging/logging.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_loc = leatherman::locale;
+namespace pcp_util = PCPClient::Util;
+
+Tombstones::Tombstones(fs::path tombstone_dir)
+        : tombstone_dir_ { std::move(tombstone_dir) },
+          reap_requested_ { false },
+          reaping_ { false },
+          stopping_ { false },
+          reaper_thread_ptr_ { nullptr }
+{
+}
+
+Tombstones::~Tombstones()
+{
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        stopping_ = true;
+    }
+
+    reap_cond_var_.notify_one();
+
+    if (reaper_thread_ptr_ != nullptr && reaper_thread_ptr_->joinable())
+        reaper_thread_ptr_->join();
+}
+
+void Tombstones::bury(const fs::path& dir_path)
+{
+    boost::system::error_code ec;
+    fs::create_directories(tombstone_dir_, ec);
+
+    // The unique suffix prevents collisions with a previous
+    // tombstone of a directory with the same name
+    auto tombstone = tombstone_dir_
+                     / (dir_path.filename().string()
+                        + fs::unique_path(".%%%%-%%%%-%%%%").string());
+
+    if (!ec)
+        fs::rename(dir_path, tombstone, ec);
+
+    if (ec)
+        throw Error {
+            lth_loc::format("failed to move '{1}' to '{2}': {3}",
+                            dir_path.string(), tombstone_dir_.string(), ec.message()) };
+
+    LOG_TRACE("Moved '{1}' to '{2}'", dir_path.string(), tombstone.string());
+}
+
+void Tombstones::reap()
+{
+    {
+        pcp_util::lock_guard<pcp_util::mutex> the_lock { mutex_ };
+        reap_requested_ = true;
+
+        if (reaper_thread_ptr_ == nullptr)
+            reaper_thread_ptr_.reset(
+                new pcp_util::thread(&Tombstones::reaperTask, this));
+    }
+
+    reap_cond_var_.notify_one();
+}
+
+void Tombstones::waitForReaping()
+{
+    pcp_util::unique_lock<pcp_util::mutex> the_lock { mutex_ };
+
+    while ((reap_requested_ || reaping_) && !stopping_)
+        reaped_cond_var_.wait(the_lock);
+}
+
+void Tombstones::reaperTask()
+{
+    lowerThreadPriority();
+    pcp_util::unique_lock<pcp_util::mutex> the_lock { mutex_ };
+
+    while (true) {
+        while (!reap_requested_ && !stopping_)
+            reap_cond_var_.wait(the_lock);
+
+        if (stopping_)
+            break;
+
+        reap_requested_ = false;
+        reaping_ = true;
+        the_lock.unlock();
+
+        deleteTombstones();
+
+        the_lock.lock();
+        reaping_ = false;
+        reaped_cond_var_.notify_all();
+    }
+
+    reaping_ = false;
+    reaped_cond_var_.notify_all();
+}
+
+void Tombstones::deleteTombstones()
+{
+    unsigned int num_deleted { 0 };
+    boost::system::error_code ec;
+
+    for (fs::directory_iterator it { tombstone_dir_, ec }, end;
+         !ec && it != end && !stopping_;
+         it.increment(ec)) {
+        boost::system::error_code remove_ec;
+        fs::remove_all(it->path(), remove_ec);
+
+        if (remove_ec) {
+            LOG_WARNING("Failed to delete '{1}': {2}",
+                        it->path().string(), remove_ec.message());
+        } else {
+            num_deleted++;
+        }
+    }
+
+    if (ec && ec != boost::system::errc::no_such_file_or_directory)
+        LOG_WARNING("Failed to inspect '{1}': {2}", tombstone_dir_.string(), ec.message());
+
+    if (num_deleted > 0)
+        LOG_DEBUG("Deleted {1} directories from '{2}'", num_deleted, tombstone_dir_.string());
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,321 @@
+#include <pxp-agent/util/vcdiff_decoder.hpp>
+
+#include <leatherman/locale/locale.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/nowide/fstream.hpp>
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_loc = leatherman::locale;
+
+// Header and window indicators; VCD_APPHEADER and VCD_ADLER32 are
+// the xdelta3 extensions for application data and window checksums
+static const uint8_t VCD_DECOMPRESS { 0x01 };
+static const uint8_t VCD_CODETABLE { 0x02 };
+static const uint8_t VCD_APPHEADER { 0x04 };
+static const uint8_t VCD_SOURCE { 0x01 };
+static const uint8_t VCD_TARGET { 0x02 };
+static const uint8_t VCD_ADLER32 { 0x04 };
+
+// Guards against allocating memory for bogus window sizes
+static const uint64_t MAX_TARGET_WINDOW_SIZE { 0x40000000 };  // 1 GB
+
+namespace {
+
+enum class InstructionType : uint8_t { Noop, Add, Run, Copy };
+
+struct Instruction {
+    InstructionType type;
+    uint8_t size;
+    uint8_t mode;
+};
+
+struct CodeTableEntry {
+    Instruction first;
+    Instruction second;
+};
+
+// Builds the default instruction code table (RFC 3284, section 5.6)
+std::vector<CodeTableEntry> buildDefaultCodeTable()
+{
+    const Instruction NOOP { InstructionType::Noop, 0, 0 };
+    std::vector<CodeTableEntry> table;
+    table.reserve(256);
+
+    table.push_back({ { InstructionType::Run, 0, 0 }, NOOP });
+    for (uint8_t size = 0; size <= 17; size++)
+        table.push_back({ { InstructionType::Add, size, 0 }, NOOP });
+    for (uint8_t mode = 0; mode <= 8; mode++) {
+        table.push_back({ { InstructionType::Copy, 0, mode }, NOOP });
+        for (uint8_t size = 4; size <= 18; size++)
+            table.push_back({ { InstructionType::Copy, size, mode }, NOOP });
+    }
+    for (uint8_t mode = 0; mode <= 5; mode++)
+        for (uint8_t add_size = 1; add_size <= 4; add_size++)
+            for (uint8_t copy_size = 4; copy_size <= 6; copy_size++)
+                table.push_back({ { InstructionType::Add, add_size, 0 },
+                                  { InstructionType::Copy, copy_size, mode } });
+    for (uint8_t mode = 6; mode <= 8; mode++)
+        for (uint8_t add_size = 1; add_size <= 4; add_size++)
+            table.push_back({ { InstructionType::Add, add_size, 0 },
+                              { InstructionType::Copy, 4, mode } });
+    for (uint8_t mode = 0; mode <= 8; mode++)
+        table.push_back({ { InstructionType::Copy, 4, mode },
+                          { InstructionType::Add, 1, 0 } });
+
+    return table;
+}
+
+// Sequential reader of a delta section
+class Reader {
+  public:
+    Reader(const char* data, uint64_t size, std::string name)
+            : pos_ { data }, end_ { data + size }, name_ { std::move(name) } {}
+
+    bool atEnd() const { return pos_ == end_; }
+
+    uint8_t byte() {
+        if (pos_ == end_)
+            throw VcdiffDecoder::Error {
+                lth_loc::format("the {1} of the delta is truncated", name_) };
+        return static_cast<uint8_t>(*pos_++);
+    }
+
+    // Integers are big endian, base 128, with the most significant
+    // bit of each byte set except for the last one
+    uint64_t integer() {
+        uint64_t value { 0 };
+        for (auto i = 0; i < 10; i++) {
+            auto b = byte();
+            if (value > (UINT64_MAX >> 7))
+                break;
+            value = (value << 7) | (b & 0x7f);
+            if (!(b & 0x80))
+                return value;
+        }
+        throw VcdiffDecoder::Error {
+            lth_loc::format("the {1} of the delta contains an invalid integer", name_) };
+    }
+
+    const char* bytes(uint64_t size) {
+        if (static_cast<uint64_t>(end_ - pos_) < size)
+            throw VcdiffDecoder::Error {
+                lth_loc::format("the {1} of the delta is truncated", name_) };
+        auto data = pos_;
+        pos_ += size;
+        return data;
+    }
+
+  private:
+    const char* pos_;
+    const char* end_;
+    std::string name_;
+};
+
+// Default address cache (RFC 3284, section 5.1)
+class AddressCache {
+  public:
+    static const uint8_t NEAR_SIZE { 4 };
+    static const uint8_t SAME_SIZE { 3 };
+
+    AddressCache() : near_(NEAR_SIZE, 0), same_(SAME_SIZE * 256, 0), next_slot_ { 0 } {}
+
+    // Decodes the address of a COPY; "here" is the current position
+    // in the window's address space (source segment + target)
+    uint64_t decode(uint64_t here, uint8_t mode, Reader& addresses) {
+        uint64_t address { 0 };
+
+        if (mode == 0) {
+            address = addresses.integer();
+        } else if (mode == 1) {
+            auto offset = addresses.integer();
+            if (offset > here)
+                throw VcdiffDecoder::Error { lth_loc::translate("invalid COPY address in the delta") };
+            address = here - offset;
+        } else if (mode < 2 + NEAR_SIZE) {
+            address = near_[mode - 2] + addresses.integer();
+        } else if (mode < 2 + NEAR_SIZE + SAME_SIZE) {
+            address = same_[(mode - 2 - NEAR_SIZE) * 256 + addresses.byte()];
+        } else {
+            throw VcdiffDecoder::Error { lth_loc::translate("invalid COPY mode in the delta") };
+        }
+
+        if (address >= here)
+            throw VcdiffDecoder::Error { lth_loc::translate("invalid COPY address in the delta") };
+
+        near_[next_slot_] = address;
+        next_slot_ = (next_slot_ + 1) % NEAR_SIZE;
+        same_[address % (SAME_SIZE * 256)] = address;
+        return address;
+    }
+
+  private:
+    std::vector<uint64_t> near_;
+    std::vector<uint64_t> same_;
+    size_t next_slot_;
+};
+
+}  // namespace
+
+static const std::vector<CodeTableEntry> CODE_TABLE { buildDefaultCodeTable() };
+
+// Executes the instructions of a window, appending its content to target
+static void decodeWindow(const std::vector<char>& source,
+                         uint64_t target_size,
+                         Reader& data,
+                         Reader& instructions,
+                         Reader& addresses,
+                         std::vector<char>& target)
+{
+    AddressCache address_cache;
+
+    while (!instructions.atEnd()) {
+        const auto& entry = CODE_TABLE[instructions.byte()];
+
+        for (const auto& instruction : { entry.first, entry.second }) {
+            if (instruction.type == InstructionType::Noop)
+                continue;
+
+            uint64_t size { instruction.size == 0 ? instructions.integer() : instruction.size };
+            if (size > target_size - target.size())
+                throw VcdiffDecoder::Error { lth_loc::translate("a window of the delta exceeds its target size") };
+
+            switch (instruction.type) {
+                case InstructionType::Add: {
+                    auto bytes = data.bytes(size);
+                    target.insert(target.end(), bytes, bytes + size);
+                    break;
+                }
+
+                case InstructionType::Run:
+                    target.insert(target.end(), size, static_cast<char>(data.byte()));
+                    break;
+
+                case InstructionType::Copy: {
+                    auto here = source.size() + target.size();
+                    auto address = address_cache.decode(here, instruction.mode, addresses);
+                    if (address + size <= source.size()) {
+                        target.insert(target.end(),
+                                      source.begin() + address,
+                                      source.begin() + address + size);
+                    } else {
+                        // May overlap with the data being produced
+                        for (uint64_t i = 0; i < size; i++) {
+                            auto from = address + i;
+                            target.push_back(from < source.size() ? source[from]
+                                                                  : target[from - source.size()]);
+                        }
+                    }
+                    break;
+                }
+
+                case InstructionType::Noop:
+                    break;
+            }
+        }
+    }
+
+    if (target.size() != target_size)
+        throw VcdiffDecoder::Error { lth_loc::translate("a window of the delta doesn't match its target size") };
+}
+
+void VcdiffDecoder::decode(const std::string& delta,
+                           const fs::path& base_path,
+                           const OutputCallback& output_callback)
+{
+    Reader reader { delta.data(), delta.size(), lth_loc::translate("header") };
+
+    auto magic = reader.bytes(4);
+    if (static_cast<uint8_t>(magic[0]) != 0xD6 || static_cast<uint8_t>(magic[1]) != 0xC3
+            || static_cast<uint8_t>(magic[2]) != 0xC4 || magic[3] != 0)
+        throw Error { lth_loc::translate("the delta is not in the VCDIFF format") };
+
+    auto header_indicator = reader.byte();
+    if (header_indicator & VCD_DECOMPRESS)
+        throw Error { lth_loc::translate("secondary compression of the delta is not supported") };
+    if (header_indicator & VCD_CODETABLE)
+        throw Error { lth_loc::translate("custom code tables are not supported") };
+    if (header_indicator & VCD_APPHEADER)
+        reader.bytes(reader.integer());
+
+    boost::system::error_code ec;
+    auto base_size = fs::file_size(base_path, ec);
+    boost::nowide::ifstream base { base_path.string(), std::ios::binary };
+    if (ec || !base)
+        throw Error { lth_loc::format("failed to open {1}", base_path.string()) };
+
+    std::vector<char> source;
+    std::vector<char> target;
+
+    while (!reader.atEnd()) {
+        auto window_indicator = reader.byte();
+        if (window_indicator & VCD_TARGET)
+            throw Error { lth_loc::translate("delta windows based on the target are not supported") };
+
+        source.clear();
+        if (window_indicator & VCD_SOURCE) {
+            auto source_size = reader.integer();
+            auto source_position = reader.integer();
+            if (source_position > base_size || source_size > base_size - source_position)
+                throw Error { lth_loc::format("the delta refers to data beyond the end of {1}",
+                                              base_path.string()) };
+
+            source.resize(source_size);
+            base.seekg(static_cast<std::streamoff>(source_position));
+            if (!base.read(source.data(), static_cast<std::streamsize>(source_size)))
+                throw Error { lth_loc::format("failed to read {1}", base_path.string()) };
+        }
+
+        auto encoding_size = reader.integer();
+        Reader encoding { reader.bytes(encoding_size), encoding_size,
+                          lth_loc::translate("window") };
+
+        auto target_size = encoding.integer();
+        if (target_size > MAX_TARGET_WINDOW_SIZE)
+            throw Error { lth_loc::translate("a window of the delta is too large") };
+        if (encoding.byte() != 0)
+            throw Error { lth_loc::translate("compressed delta sections are not supported") };
+
+        auto data_size = encoding.integer();
+        auto instructions_size = encoding.integer();
+        auto addresses_size = encoding.integer();
+
+        uLong checksum { 0 };
+        if (window_indicator & VCD_ADLER32) {
+            auto checksum_bytes = encoding.bytes(4);
+            for (auto i = 0; i < 4; i++)
+                checksum = (checksum << 8) | static_cast<uint8_t>(checksum_bytes[i]);
+        }
+
+        Reader data { encoding.bytes(data_size), data_size,
+                      lth_loc::translate("data section") };
+        Reader instructions { encoding.bytes(instructions_size), instructions_size,
+                              lth_loc::translate("instructions section") };
+        Reader addresses { encoding.bytes(addresses_size), addresses_size,
+                           lth_loc::translate("addresses section") };
+
+        target.clear();
+        target.reserve(target_size);
+        decodeWindow(source, target_size, data, instructions, addresses, target);
+
+        if ((window_indicator & VCD_ADLER32)
+                && checksum != adler32(adler32(0L, Z_NULL, 0),
+                                       reinterpret_cast<const Bytef*>(target.data()),
+                                       static_cast<uInt>(target.size())))
+            throw Error { lth_loc::translate("the checksum of a window of the delta doesn't match") };
+
+        if (!target.empty())
+            output_callback(target.data(), target.size());
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
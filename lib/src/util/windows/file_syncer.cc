@@ -0,0 +1,44 @@
+#include <pxp-agent/util/file_syncer.hpp>
+
+#include <leatherman/locale/locale.hpp>
+#include <leatherman/windows/windows.hpp>
+#include <leatherman/windows/system_error.hpp>
+
+#include <boost/nowide/convert.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace lth_loc = leatherman::locale;
+namespace lth_win = leatherman::windows;
+
+void FileSyncer::syncFile(const std::string& file_path)
+{
+    // NB: FlushFileBuffers requires write access
+    auto f_handle = CreateFileW(boost::nowide::widen(file_path).c_str(),
+                                GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (f_handle == INVALID_HANDLE_VALUE)
+        throw FileSyncer::Error {
+            lth_loc::format("failed to open '{1}': {2}", file_path, lth_win::system_error()) };
+
+    auto flushed = FlushFileBuffers(f_handle);
+    auto error = lth_win::system_error();
+    CloseHandle(f_handle);
+
+    if (!flushed)
+        throw FileSyncer::Error {
+            lth_loc::format("failed to flush '{1}': {2}", file_path, error) };
+}
+
+// NTFS journals the directory entries; they can't be flushed separately
+void FileSyncer::syncDirectory(const std::string&)
+{
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -27,5 +27,12 @@ int getPid() {
     return GetCurrentProcessId();
 }
 
+// The background mode lowers the I/O priority as well
+void lowerThreadPriority() {
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN)
+            && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST))
+        LOG_DEBUG("Failed to lower the thread priority: {1}", lth_win::system_error());
+}
+
 }  // namespace Util
 }  // namespace PXPAgent
@@ -48,7 +48,17 @@ static Configuration::Agent AGENT_CONFIGURATION { MODULES,
                                                   5,     // association ttl
                                                   5,     // general PCP ttl
                                                   2,
-                                                  15 };  // keepalive timeouts
+                                                  15,    // keepalive timeouts
+                                                  0,     // unbounded task cache
+                                                  0,     // unlimited task downloads
+                                                  0,     // unlimited download rate
+                                                  {},    // no local task sources
+                                                  false, // use the task_wrapper
+                                                  "directory",  // metadata files
+                                                  0,     // unbounded spool
+                                                  0,     // no transaction quota
+                                                  0,     // no requester quota
+                                                  "relaxed" };  // no fsync
 
 static const std::string VALID_ENVELOPE_TXT {
     " { \"id\" : \"123456\","
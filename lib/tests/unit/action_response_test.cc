@@ -100,4 +100,36 @@ TEST_CASE("ActionResponse::toJSON", "[response]") {
     }
 }
 
+TEST_CASE("ActionResponse::getRequestMetadata", "[response]") {
+    lth_jc::JsonContainer envelope { ENVELOPE_TXT };
+    lth_jc::JsonContainer data { DATA_TXT };
+    std::vector<lth_jc::JsonContainer> debug {};
+
+    const PCPClient::ParsedChunks p_c { envelope, data, debug, 0 };
+    auto req = ActionRequest(RequestType::NonBlocking, p_c);
+    auto resp = ActionResponse(ModuleType::External, req);
+    resp.setBadResultsAndEnd("boom");
+
+    auto request_metadata = ActionResponse::getRequestMetadata(resp.action_metadata);
+    auto state_metadata = ActionResponse::getStateMetadata(resp.action_metadata);
+
+    SECTION("splits the metadata in the request and state entries") {
+        REQUIRE(request_metadata.includes("request_params"));
+        REQUIRE(request_metadata.includes("start"));
+        REQUIRE_FALSE(request_metadata.includes("status"));
+        REQUIRE(state_metadata.get<std::string>("execution_error") == "boom");
+        REQUIRE(state_metadata.includes("end"));
+        REQUIRE_FALSE(state_metadata.includes("request_params"));
+    }
+
+    SECTION("merges them back") {
+        auto metadata = ActionResponse::mergeMetadata(request_metadata, state_metadata);
+        REQUIRE(ActionResponse::isValidActionMetadata(metadata));
+        REQUIRE(metadata.keys().size() == resp.action_metadata.keys().size());
+        REQUIRE(metadata.get<std::string>("execution_error") == "boom");
+        REQUIRE(metadata.get<std::string>("transaction_id")
+                == resp.action_metadata.get<std::string>("transaction_id"));
+    }
+}
+
 }  // namespace PXPAgent
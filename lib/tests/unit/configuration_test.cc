@@ -361,6 +361,24 @@ TEST_CASE("Configuration::validate", "[configuration]") {
                           Configuration::Error);
     }
 
+    SECTION("it fails when --task-cache-dir-max-size is negative") {
+        HW::SetFlag<int>("task-cache-dir-max-size", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --task-download-limit is negative") {
+        HW::SetFlag<int>("task-download-limit", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --task-download-rate is negative") {
+        HW::SetFlag<int>("task-download-rate", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
     SECTION("it fails when --spool-dir is empty") {
         HW::SetFlag<std::string>("spool-dir", "");
         REQUIRE_THROWS_AS(Configuration::Instance().validate(),
@@ -389,6 +407,36 @@ TEST_CASE("Configuration::validate", "[configuration]") {
         REQUIRE_THROWS_AS(Configuration::Instance().validate(),
                           Configuration::Error);
     }
+
+    SECTION("it fails when --spool-backend is neither 'directory' nor 'log'") {
+        HW::SetFlag<std::string>("spool-backend", "database");
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --spool-dir-max-size is negative") {
+        HW::SetFlag<int>("spool-dir-max-size", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --spool-dir-max-transactions is negative") {
+        HW::SetFlag<int>("spool-dir-max-transactions", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --spool-dir-max-transactions-per-requester is negative") {
+        HW::SetFlag<int>("spool-dir-max-transactions-per-requester", -1);
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
+
+    SECTION("it fails when --spool-durability is not 'strict', 'group-commit' or 'relaxed'") {
+        HW::SetFlag<std::string>("spool-durability", "eventual");
+        REQUIRE_THROWS_AS(Configuration::Instance().validate(),
+                          Configuration::Error);
+    }
 }
 
 TEST_CASE("Configuration::validate with unknown config options", "[configuration]") {
@@ -212,11 +212,10 @@ TEST_CASE("ExternalModule::callAction - non blocking", "[modules]") {
                              EXTENSION,
                              STORAGE };
         ActionRequest request { RequestType::NonBlocking, NON_BLOCKING_CONTENT };
-        fs::path spool_path { SPOOL_DIR };
-        auto results_dir = (spool_path / request.transactionId()).string();
+        auto results_dir = STORAGE->getResultsPath(request.transactionId()).string();
         fs::create_directories(results_dir);
         request.setResultsDir(results_dir);
-        auto pid_path = spool_path / request.transactionId() / "pid";
+        auto pid_path = fs::path { results_dir } / "pid";
 
         REQUIRE_NOTHROW(e_m.executeAction(request));
         REQUIRE(fs::exists(pid_path));
@@ -228,6 +227,27 @@ TEST_CASE("ExternalModule::callAction - non blocking", "[modules]") {
             FAIL("fail to get pid");
         }
     }
+
+#ifndef _WIN32
+    SECTION("the output of a module with piped output is captured and stored") {
+        ExternalModule e_m { PXP_AGENT_ROOT_PATH
+                             "/lib/tests/resources/modules_piped/reverse_piped",
+                             STORAGE };
+        ActionRequest request { RequestType::NonBlocking, NON_BLOCKING_CONTENT };
+        auto results_path = STORAGE->getResultsPath(request.transactionId());
+        fs::create_directories(results_path);
+        request.setResultsDir(results_path.string());
+
+        auto response = e_m.executeAction(request);
+
+        REQUIRE(response.output.exitcode == 0);
+        REQUIRE(response.output.std_out.find("ociz") != std::string::npos);
+        REQUIRE(response.output.std_err.empty());
+        REQUIRE(lth_file::read((results_path / "stdout").string()) == response.output.std_out);
+        REQUIRE(lth_file::read((results_path / "exitcode").string()) == "0");
+        REQUIRE(fs::exists(results_path / "pid"));
+    }
+#endif
 }
 
 TEST_CASE("ExternalModule::getModuleMetadata", "[modules][metadata]") {
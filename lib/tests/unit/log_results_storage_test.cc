@@ -0,0 +1,277 @@
+#include "root_path.hpp"
+
+#include <pxp-agent/log_results_storage.hpp>
+
+#include <leatherman/json_container/json_container.hpp>
+#include <leatherman/file_util/file.hpp>
+#include <leatherman/util/time.hpp>
+
+#include <cpp-pcp-client/util/thread.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/nowide/fstream.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+
+namespace fs = boost::filesystem;
+namespace lth_jc = leatherman::json_container;
+namespace lth_file = leatherman::file_util;
+namespace lth_util = leatherman::util;
+namespace pcp_util = PCPClient::Util;
+
+static const std::string SPOOL_DIR { std::string { PXP_AGENT_ROOT_PATH }
+                                     + "/lib/tests/resources/test_log_spool" };
+
+static const std::string SPOOL_TTL { "0d" };
+
+static void configureTest() {
+    if (!fs::exists(SPOOL_DIR) && !fs::create_directories(SPOOL_DIR))
+        FAIL("Failed to create the spool directory");
+}
+
+static void resetTest() {
+    if (fs::exists(SPOOL_DIR))
+        fs::remove_all(SPOOL_DIR);
+}
+
+static lth_jc::JsonContainer getMetadata(const std::string& transaction_id,
+                                         const std::string& status,
+                                         const std::string& start)
+{
+    lth_jc::JsonContainer metadata {};
+    metadata.set<std::string>("requester", "me");
+    metadata.set<std::string>("module", "good_stuff");
+    metadata.set<std::string>("action", "do_stuff");
+    metadata.set<std::string>("request_params", "abc");
+    metadata.set<std::string>("transaction_id", transaction_id);
+    metadata.set<std::string>("request_id", "45");
+    metadata.set<bool>("notify_outcome", false);
+    metadata.set<std::string>("start", start);
+    metadata.set<std::string>("status", status);
+    return metadata;
+}
+
+static const std::string OLD_START { "2015-06-26T22:57:09.000000Z" };
+
+TEST_CASE("LogResultsStorage", "[module][results]") {
+    configureTest();
+
+    SECTION("stores and updates the metadata, creating the results directory") {
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE_FALSE(st.find("1234"));
+
+        st.initializeMetadataFile("1234", getMetadata("1234", "running", OLD_START));
+        REQUIRE(st.find("1234"));
+        REQUIRE(fs::is_directory(st.getResultsPath("1234")));
+        REQUIRE_FALSE(fs::exists(st.getResultsPath("1234") / "metadata"));
+        REQUIRE_FALSE(fs::exists(st.getResultsPath("1234") / "request"));
+
+        st.updateMetadataFile("1234", getMetadata("1234", "success", OLD_START));
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("status") == "success");
+    }
+
+    SECTION("throws an Error for unknown transactions") {
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE_THROWS_AS(st.getActionMetadata("1234"), ResultsStorage::Error);
+        REQUIRE_THROWS_AS(st.updateMetadataFile("1234", getMetadata("1234", "success", OLD_START)),
+                          ResultsStorage::Error);
+    }
+
+    SECTION("reloads the metadata from the log, ignoring a torn record") {
+        {
+            LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+            st.initializeMetadataFile("1234", getMetadata("1234", "running", OLD_START));
+            st.updateMetadataFile("1234", getMetadata("1234", "failure", OLD_START));
+            st.initializeMetadataFile("5678", getMetadata("5678", "running", OLD_START));
+        }
+
+        // Simulate a crash while appending
+        auto segment = (fs::directory_iterator { SPOOL_DIR + "/" + LogResultsStorage::LOG_DIR })->path();
+        boost::nowide::ofstream { segment.string(), std::ios::binary | std::ios::app }
+            << "{\"transaction_id\":\"5678\",\"meta";
+
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("status") == "failure");
+        REQUIRE(st.getActionMetadata("5678").get<std::string>("status") == "running");
+
+        // Records are appended to a new segment
+        st.updateMetadataFile("5678", getMetadata("5678", "success", OLD_START));
+        REQUIRE(st.numSegments() == 2);
+        REQUIRE(st.getActionMetadata("5678").get<std::string>("status") == "success");
+    }
+
+    SECTION("recovers the transactions that were running when loaded") {
+        {
+            LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+            st.initializeMetadataFile("1234", getMetadata("1234", "running", OLD_START));
+            st.updateMetadataFile("1234", getMetadata("1234", "success", OLD_START));
+            st.initializeMetadataFile("5678", getMetadata("5678", "running", OLD_START));
+            st.initializeMetadataFile("9012", getMetadata("9012", "running", OLD_START));
+        }
+
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        // Finalised after loading, before the recovery
+        st.updateMetadataFile("9012", getMetadata("9012", "failure", OLD_START));
+        std::vector<std::string> running {};
+        auto recoveryCallback =
+            [&running](const std::string& transaction_id, lth_jc::JsonContainer) -> void {
+                running.push_back(transaction_id);
+            };
+
+        REQUIRE(st.recover(4, recoveryCallback) == 3u);
+        REQUIRE(running == std::vector<std::string> { "5678" });
+    }
+
+    SECTION("removes the transactions evicted to meet the quotas from the log") {
+        {
+            LogResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 1, 0 } };
+            st.initializeMetadataFile("old", getMetadata("old", "success", OLD_START));
+            st.initializeMetadataFile("recent", getMetadata("recent", "success",
+                                                            lth_util::get_ISO8601_time()));
+            REQUIRE(st.purge("0d", {}) == 1);
+            REQUIRE_FALSE(st.find("old"));
+            REQUIRE_FALSE(fs::exists(st.getResultsPath("old")));
+        }
+
+        LogResultsStorage reloaded { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 1, 0 } };
+        REQUIRE_FALSE(reloaded.find("old"));
+        REQUIRE(reloaded.find("recent"));
+        REQUIRE_FALSE(reloaded.quotaExceeded());
+    }
+
+    SECTION("imports the metadata files of the existing results directories, "
+            "after moving them to their shard") {
+        fs::create_directories(SPOOL_DIR + "/1234");
+        lth_file::atomic_write_to_file(getMetadata("1234", "success", OLD_START).toString(),
+                                       SPOOL_DIR + "/1234/metadata");
+
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(st.find("1234"));
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("status") == "success");
+        REQUIRE_FALSE(fs::exists(SPOOL_DIR + "/1234"));
+        REQUIRE_FALSE(fs::exists(st.getResultsPath("1234") / "metadata"));
+    }
+
+    SECTION("purges the expired transactions that are not running") {
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        st.initializeMetadataFile("old", getMetadata("old", "success", OLD_START));
+        st.initializeMetadataFile("old_running", getMetadata("old_running", "running", OLD_START));
+        st.initializeMetadataFile("old_ongoing", getMetadata("old_ongoing", "success", OLD_START));
+        st.initializeMetadataFile("recent", getMetadata("recent", "success",
+                                                        lth_util::get_ISO8601_time()));
+
+        REQUIRE(st.purge("10d", { "old_ongoing" }) == 1);
+        REQUIRE_FALSE(st.find("old"));
+        REQUIRE_FALSE(fs::exists(st.getResultsPath("old")));
+        REQUIRE(st.find("old_running"));
+        REQUIRE(st.find("old_ongoing"));
+        REQUIRE(st.find("recent"));
+
+        // The removal is persisted
+        LogResultsStorage reloaded { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE_FALSE(reloaded.find("old"));
+        REQUIRE(reloaded.find("recent"));
+    }
+
+    SECTION("appends the request parameters only once") {
+        auto metadata = getMetadata("1234", "running", OLD_START);
+        metadata.set<std::string>("request_params", std::string(256 * 1024, 'x'));
+        {
+            LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+            st.initializeMetadataFile("1234", metadata);
+            for (auto i = 0; i < 60; i++)
+                st.updateMetadataFile("1234", metadata);
+            metadata.set<std::string>("status", "success");
+            st.updateMetadataFile("1234", metadata);
+            REQUIRE(st.numSegments() == 1);
+        }
+
+        auto segment = (fs::directory_iterator { SPOOL_DIR + "/" + LogResultsStorage::LOG_DIR })->path();
+        REQUIRE(fs::file_size(segment) < 256 * 1024 + 60 * 1024);
+
+        LogResultsStorage reloaded { SPOOL_DIR, SPOOL_TTL };
+        auto read_metadata = reloaded.getActionMetadata("1234");
+        REQUIRE(read_metadata.get<std::string>("status") == "success");
+        REQUIRE(read_metadata.get<std::string>("request_params").size() == 256 * 1024);
+        REQUIRE(read_metadata.get<std::string>("requester") == "me");
+    }
+
+    SECTION("compacts the log once most of it is superseded") {
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        auto metadata = getMetadata("1234", "running", OLD_START);
+        metadata.set<std::string>("request_params", std::string(1024, 'x'));
+        st.initializeMetadataFile("1234", metadata);
+        st.initializeMetadataFile("5678", getMetadata("5678", "success", OLD_START));
+        metadata.set<std::string>("results", std::string(256 * 1024, 'x'));
+        for (auto i = 0; i < 60; i++)
+            st.updateMetadataFile("1234", metadata);
+        REQUIRE(st.numSegments() > 1);
+
+        st.compactIfNeeded();
+        REQUIRE(st.numSegments() == 1);
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("results").size()
+                == 256 * 1024);
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("request_params").size()
+                == 1024);
+        REQUIRE(st.getActionMetadata("5678").get<std::string>("status") == "success");
+
+        LogResultsStorage reloaded { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(reloaded.numSegments() == 1);
+        REQUIRE(reloaded.getActionMetadata("1234").get<std::string>("results").size()
+                == 256 * 1024);
+        REQUIRE(reloaded.find("5678"));
+    }
+
+    SECTION("keeps the metadata stored while compacting") {
+        LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        auto metadata = getMetadata("1234", "running", OLD_START);
+        st.initializeMetadataFile("1234", metadata);
+        st.initializeMetadataFile("5678", getMetadata("5678", "running", OLD_START));
+        metadata.set<std::string>("results", std::string(256 * 1024, 'x'));
+        for (auto i = 0; i < 60; i++)
+            st.updateMetadataFile("1234", metadata);
+
+        pcp_util::thread updater { [&st]() {
+            for (auto i = 0; i < 100; i++)
+                st.updateMetadataFile("5678", getMetadata("5678", "running", OLD_START));
+            st.updateMetadataFile("5678", getMetadata("5678", "success", OLD_START));
+            st.initializeMetadataFile("9012", getMetadata("9012", "success", OLD_START));
+        } };
+        st.compactIfNeeded();
+        updater.join();
+
+        REQUIRE(st.getActionMetadata("1234").get<std::string>("results").size()
+                == 256 * 1024);
+        REQUIRE(st.getActionMetadata("5678").get<std::string>("status") == "success");
+        REQUIRE(st.getActionMetadata("9012").get<std::string>("status") == "success");
+
+        LogResultsStorage reloaded { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(reloaded.getActionMetadata("5678").get<std::string>("status") == "success");
+        REQUIRE(reloaded.find("9012"));
+    }
+
+    SECTION("appends and reloads the metadata in the durable modes") {
+        for (auto durability : { Util::Durability::Strict, Util::Durability::GroupCommit }) {
+            {
+                LogResultsStorage st { SPOOL_DIR, SPOOL_TTL, ResultsStorage::Quotas { 0, 0, 0 },
+                                       durability };
+                st.initializeMetadataFile("1234", getMetadata("1234", "running", OLD_START));
+                st.updateMetadataFile("1234", getMetadata("1234", "success", OLD_START));
+            }
+
+            LogResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+            REQUIRE(st.getActionMetadata("1234").get<std::string>("status") == "success");
+            resetTest();
+            configureTest();
+        }
+    }
+
+    resetTest();
+}
+
+}  // namespace PXPAgent
@@ -91,6 +91,7 @@ TEST_CASE("Modules::Task::hasAction", "[modules]") {
 
     SECTION("correctly reports true") {
         REQUIRE(mod.hasAction("run"));
+        REQUIRE(mod.hasAction("prefetch"));
     }
 }
 
@@ -150,11 +151,10 @@ TEST_CASE("Modules::Task::callAction - non blocking", "[modules]") {
     SECTION("the pid is written to file") {
         Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
         ActionRequest request { RequestType::NonBlocking, NON_BLOCKING_CONTENT };
-        fs::path spool_path { SPOOL_DIR };
-        auto results_dir = (spool_path / request.transactionId()).string();
+        auto results_dir = STORAGE->getResultsPath(request.transactionId()).string();
         fs::create_directories(results_dir);
         request.setResultsDir(results_dir);
-        auto pid_path = spool_path / request.transactionId() / "pid";
+        auto pid_path = fs::path { results_dir } / "pid";
 
         REQUIRE_NOTHROW(e_m.executeAction(request));
         REQUIRE(fs::exists(pid_path));
@@ -166,6 +166,54 @@ TEST_CASE("Modules::Task::callAction - non blocking", "[modules]") {
             FAIL("fail to get pid");
         }
     }
+
+#ifndef _WIN32
+    SECTION("the task can be run without the task_wrapper") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE,
+                            0, 0, 0, {}, true };
+        ActionRequest request { RequestType::NonBlocking, NON_BLOCKING_CONTENT };
+        auto results_path = STORAGE->getResultsPath(request.transactionId());
+        fs::create_directories(results_path);
+        request.setResultsDir(results_path.string());
+
+        auto response = e_m.executeAction(request);
+        REQUIRE(fs::exists(results_path / "pid"));
+        REQUIRE(lth_file::read((results_path / "exitcode").string()) == "0");
+        REQUIRE(response.output.exitcode == 0);
+        REQUIRE(boost::trim_copy(response.output.std_out) == "{\"message\":\"hello\"}");
+    }
+#endif
+
+    SECTION("a large input is passed to the task via file") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        std::string message(2 * 1024 * 1024, 'x');
+        auto large_echo_txt =
+            (NON_BLOCKING_DATA_FORMAT % "\"1988\""
+                                      % "\"task\""
+                                      % "\"run\""
+                                      % ("{\"task\":\"foo\",\"input\":{\"message\":\"" + message + "\"},"
+                                         "\"files\":[{\"uri\":{\"path\":\"/init" EXTENSION "\","
+                                                              "\"params\":{\"environment\":\"production\"}},"
+                                                              "\"sha256\":\"15f26bdeea9186293d256db95fed616a7b823de947f4e9bd0d8d23c5ac786d13\","
+                                                              "\"filename\":\"init\","
+                                                              "\"size_bytes\":131}]}")
+                                      % "false").str();
+        PCPClient::ParsedChunks large_echo_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(large_echo_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::NonBlocking, large_echo_content };
+        auto results_path = STORAGE->getResultsPath(request.transactionId());
+        fs::create_directories(results_path);
+        request.setResultsDir(results_path.string());
+
+        auto response = e_m.executeAction(request);
+        REQUIRE(response.output.exitcode == 0);
+        REQUIRE(boost::trim_copy(response.output.std_out) == "{\"message\":\"" + message + "\"}");
+        // The input file is removed once the task completes
+        REQUIRE_FALSE(fs::exists(results_path / "input"));
+    }
 }
 
 TEST_CASE("Modules::Task::executeAction", "[modules][output]") {
@@ -280,6 +328,34 @@ TEST_CASE("Modules::Task::executeAction", "[modules][output]") {
         REQUIRE(output == "hello");
     }
 
+    SECTION("fails if the input is too large for env variables when input_method is environment") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        std::string message(256 * 1024, 'x');
+        auto echo_txt =
+#ifndef _WIN32
+            (DATA_FORMAT % "\"0632\""
+                         % "\"task\""
+                         % "\"run\""
+                         % ("{\"input\":{\"message\":\"" + message + "\"}, \"input_method\": \"environment\", \"files\" : [{\"sha256\": \"823c013467ce03b12dbe005757a6c842894373e8bcfb0cf879329afb5abcd543\", \"filename\": \"multi\"}]}")).str();
+#else
+            (DATA_FORMAT % "\"0632\""
+                         % "\"task\""
+                         % "\"run\""
+                         % ("{\"input\":{\"message\":\"" + message + "\"}, \"input_method\": \"environment\", \"files\" : [{\"sha256\": \"88a07e5b672aa44a91aa7d63e22c91510af5d4707e12f75e0d5de2dfdbde1dec\", \"filename\": \"multi.bat\"}]}")).str();
+#endif
+        PCPClient::ParsedChunks echo_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(echo_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::Blocking, echo_content };
+
+        auto response = e_m.executeAction(request);
+        REQUIRE_FALSE(response.action_metadata.get<bool>("results_are_valid"));
+        REQUIRE_THAT(response.action_metadata.get<std::string>("execution_error"),
+                     Catch::Contains("too large to be passed via environment variables"));
+    }
+
     SECTION("succeeds on non-zero exit") {
         Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
         auto echo_txt =
@@ -396,6 +472,32 @@ TEST_CASE("Modules::Task::executeAction", "[modules][output]") {
         REQUIRE(fs::is_empty(cache));
     }
 
+    SECTION("keeps a partially downloaded file for resuming it if all master-uris fail") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        auto cache = fs::path(TEMP_TASK_CACHE_DIR) / "some_sha";
+        fs::create_directories(cache);
+        auto partial = cache / "partial_task_some_file";
+        lth_file::atomic_write_to_file("partial content", partial.string());
+
+        auto task_txt = (DATA_FORMAT % "\"0632\""
+                                     % "\"task\""
+                                     % "\"run\""
+                                     % "{\"task\": \"unparseable\", \"input\":{\"message\":\"hello\"}, "
+                                       "\"files\" : [{\"uri\": { \"path\": \"bad_path\", \"params\": {}}, \"sha256\": \"some_sha\", \"filename\": \"some_file\"}]}").str();
+        PCPClient::ParsedChunks task_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(task_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::Blocking, task_content };
+        auto response = e_m.executeAction(request);
+
+        REQUIRE_FALSE(response.action_metadata.get<bool>("results_are_valid"));
+        REQUIRE(lth_file::read(partial.string()) == "partial content");
+        // The partial file is the only file left in the cache dir
+        REQUIRE(std::distance(fs::directory_iterator(cache), fs::directory_iterator()) == 1);
+    }
+
     SECTION("creates the tasks-cache/<sha> directory with ower/group read and write permissions") {
         Modules::Task e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
         auto cache = fs::path(TEMP_TASK_CACHE_DIR) / "some_other_sha";
@@ -444,6 +546,153 @@ TEST_CASE("Modules::Task::executeAction", "[modules][output]") {
     }
 }
 
+TEST_CASE("Modules::Task::executeAction - prefetch", "[modules]") {
+    configureTest();
+    lth_util::scope_exit config_cleaner { resetTest };
+
+    SECTION("verifies cached files without running the task") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        auto task_txt = (DATA_FORMAT % "\"0632\""
+                                     % "\"task\""
+                                     % "\"prefetch\""
+                                     % "{\"files\" : [{\"uri\": {\"path\": \"/init\", \"params\": {}}, "
+                                       "\"sha256\": \"15f26bdeea9186293d256db95fed616a7b823de947f4e9bd0d8d23c5ac786d13\", "
+                                       "\"filename\": \"init\"}]}").str();
+        PCPClient::ParsedChunks task_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(task_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::Blocking, task_content };
+        auto response = e_m.executeAction(request);
+
+        REQUIRE(response.action_metadata.get<bool>("results_are_valid"));
+        auto files = response.action_metadata.get<std::vector<lth_jc::JsonContainer>>({ "results", "files" });
+        REQUIRE(files.size() == 1u);
+        REQUIRE(files[0].get<std::string>("filename") == "init");
+        REQUIRE_FALSE(response.action_metadata.get<lth_jc::JsonContainer>("results").includes("stdout"));
+    }
+
+    SECTION("stores an empty output for a non-blocking prefetch") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        auto task_txt = (NON_BLOCKING_DATA_FORMAT % "\"0633\""
+                                                  % "\"task\""
+                                                  % "\"prefetch\""
+                                                  % "{\"files\" : [{\"uri\": {\"path\": \"/init\", \"params\": {}}, "
+                                                    "\"sha256\": \"15f26bdeea9186293d256db95fed616a7b823de947f4e9bd0d8d23c5ac786d13\", "
+                                                    "\"filename\": \"init\"}]}"
+                                                  % "false").str();
+        PCPClient::ParsedChunks task_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(task_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::NonBlocking, task_content };
+        auto results_path = STORAGE->getResultsPath(request.transactionId());
+        fs::create_directories(results_path);
+        request.setResultsDir(results_path.string());
+
+        auto response = e_m.executeAction(request);
+        REQUIRE(response.action_metadata.get<bool>("results_are_valid"));
+
+        // As retrieved by a later status request
+        REQUIRE(STORAGE->outputIsReady(request.transactionId()));
+        auto output = STORAGE->getOutput(request.transactionId());
+        REQUIRE(output.exitcode == 0);
+        REQUIRE(output.std_out.empty());
+        REQUIRE(output.std_err.empty());
+    }
+
+    SECTION("reports the files that could not be downloaded") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        auto task_txt = (DATA_FORMAT % "\"0632\""
+                                     % "\"task\""
+                                     % "\"prefetch\""
+                                     % "{\"files\" : [{\"uri\": {\"path\": \"bad_path\", \"params\": {}}, "
+                                       "\"sha256\": \"some_sha\", \"filename\": \"some_file\"}]}").str();
+        PCPClient::ParsedChunks task_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(task_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::Blocking, task_content };
+        auto response = e_m.executeAction(request);
+
+        REQUIRE_FALSE(response.action_metadata.get<bool>("results_are_valid"));
+        REQUIRE_THAT(response.action_metadata.get<std::string>("execution_error"),
+                     Catch::Contains("some_file"));
+        REQUIRE(fs::is_empty(fs::path(TEMP_TASK_CACHE_DIR) / "some_sha"));
+    }
+
+    SECTION("caches files found in the local sources without downloading them") {
+        auto cache = fs::path(TEMP_TASK_CACHE_DIR) / "15f26bdeea9186293d256db95fed616a7b823de947f4e9bd0d8d23c5ac786d13";
+        lth_util::scope_exit cache_remover { [&cache]() { fs::remove_all(cache); } };
+
+        // The fixture task cache is used as a local source; no master-uris
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, {}, CA, CRT, KEY, STORAGE,
+                            0, 0, 0, { TASK_CACHE_DIR } };
+        auto task_txt = (DATA_FORMAT % "\"0632\""
+                                     % "\"task\""
+                                     % "\"prefetch\""
+                                     % "{\"files\" : [{\"uri\": {\"path\": \"/init\", \"params\": {}}, "
+                                       "\"sha256\": \"15f26bdeea9186293d256db95fed616a7b823de947f4e9bd0d8d23c5ac786d13\", "
+                                       "\"filename\": \"init\"}]}").str();
+        PCPClient::ParsedChunks task_content {
+            lth_jc::JsonContainer(ENVELOPE_TXT),
+            lth_jc::JsonContainer(task_txt),
+            {},
+            0 };
+        ActionRequest request { RequestType::Blocking, task_content };
+        auto response = e_m.executeAction(request);
+
+        REQUIRE(response.action_metadata.get<bool>("results_are_valid"));
+        REQUIRE(fs::exists(cache / "init"));
+        REQUIRE(lth_file::read((cache / "init").string())
+                == lth_file::read((fs::path(TASK_CACHE_DIR) / cache.filename() / "init").string()));
+    }
+
+    SECTION("verifies an extracted task archive by using its manifest") {
+        auto cache = fs::path(TEMP_TASK_CACHE_DIR) / "archive_sha";
+        lth_util::scope_exit cache_remover { [&cache]() { fs::remove_all(cache); } };
+        fs::create_directories(cache / "bin");
+        lth_file::atomic_write_to_file("#!/bin/sh\necho hi\n", (cache / "bin" / "task").string());
+        lth_file::atomic_write_to_file(
+            "{\"members\":[{\"path\":\"bin/task\",\"sha256\":"
+            "\"299001868fb8c02fd431c336c6d058f5558c5dff5b5af5e6fe04b870a6a9cbba\"}]}",
+            (cache / ".archive_manifest.json").string());
+
+        // No master-uris; the archive can't be downloaded
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, {}, CA, CRT, KEY, STORAGE };
+        auto prefetch = [](Modules::Task& module, const std::string& filename) {
+            auto task_txt = (DATA_FORMAT % "\"0632\""
+                                         % "\"task\""
+                                         % "\"prefetch\""
+                                         % ("{\"files\" : [{\"uri\": {\"path\": \"/archive\", \"params\": {}}, "
+                                            "\"sha256\": \"archive_sha\", \"archive\": \"tar\", "
+                                            "\"filename\": \"" + filename + "\"}]}")).str();
+            PCPClient::ParsedChunks task_content {
+                lth_jc::JsonContainer(ENVELOPE_TXT),
+                lth_jc::JsonContainer(task_txt),
+                {},
+                0 };
+            ActionRequest request { RequestType::Blocking, task_content };
+            return module.executeAction(request);
+        };
+
+        REQUIRE(prefetch(e_m, "bin/task").action_metadata.get<bool>("results_are_valid"));
+        // Not a member of the archive
+        REQUIRE_FALSE(prefetch(e_m, "bin/other").action_metadata.get<bool>("results_are_valid"));
+
+        // A modified member invalidates the archive
+        lth_file::atomic_write_to_file("modified", (cache / "bin" / "task").string());
+        Modules::Task other_e_m { PXP_AGENT_BIN_PATH, TEMP_TASK_CACHE_DIR, TASK_CACHE_TTL, {}, CA, CRT, KEY, STORAGE };
+        auto response = prefetch(other_e_m, "bin/task");
+        REQUIRE_FALSE(response.action_metadata.get<bool>("results_are_valid"));
+        REQUIRE_THAT(response.action_metadata.get<std::string>("execution_error"),
+                     Catch::Contains("No master-uris were provided"));
+    }
+}
+
 // Present in Boost 1.58. That's currently not required, so reproducing it here since it's simple.
 static std::time_t my_to_time_t(pt::ptime t)
 {
@@ -478,4 +727,54 @@ TEST_CASE("purge old tasks", "[modules]") {
     }
 }
 
+TEST_CASE("evict least recently used tasks", "[modules]") {
+    auto lru_cache = fs::temp_directory_path() / fs::unique_path("pxp_lru_test_%%%%-%%%%");
+    lth_util::scope_exit cache_remover { [&lru_cache]() { fs::remove_all(lru_cache); } };
+
+    auto now = pt::second_clock::universal_time();
+    int age_minutes { 30 };
+    for (auto sha : { "sha_old", "sha_middle", "sha_recent" }) {
+        fs::create_directories(lru_cache / sha);
+        lth_file::atomic_write_to_file(std::string(1024, 'x'), (lru_cache / sha / "task").string());
+        fs::last_write_time(lru_cache / sha, my_to_time_t(now - pt::minutes(age_minutes)));
+        age_minutes -= 10;
+    }
+
+    std::vector<std::string> evicted;
+    auto purgeCallback =
+        [&evicted](const std::string& dir_path) -> void {
+            evicted.push_back(fs::path(dir_path).filename().string());
+        };
+
+    SECTION("evicts nothing if the cache fits the maximum size") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, lru_cache.string(), TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE, 4096 };
+        REQUIRE(e_m.purge(TASK_CACHE_TTL, {}, purgeCallback) == 0);
+        REQUIRE(evicted.empty());
+    }
+
+    SECTION("evicts the least recently used tasks until the cache fits") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, lru_cache.string(), TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE, 1536 };
+        REQUIRE(e_m.purge(TASK_CACHE_TTL, {}, purgeCallback) == 2);
+        REQUIRE(evicted == (std::vector<std::string> { "sha_old", "sha_middle" }));
+    }
+
+    SECTION("evicted tasks are moved out of the cache when no callback is specified") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, lru_cache.string(), TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE, 1536 };
+        REQUIRE(e_m.purge(TASK_CACHE_TTL, {}) == 2);
+        REQUIRE_FALSE(fs::exists(lru_cache / "sha_old"));
+        REQUIRE_FALSE(fs::exists(lru_cache / "sha_middle"));
+        REQUIRE(fs::exists(lru_cache / "sha_recent"));
+
+        // The tombstone directory is not considered a cached task
+        REQUIRE(e_m.purge(TASK_CACHE_TTL, {}, purgeCallback) == 0);
+        REQUIRE(evicted.empty());
+    }
+
+    SECTION("an unbounded cache is not evicted") {
+        Modules::Task e_m { PXP_AGENT_BIN_PATH, lru_cache.string(), TASK_CACHE_TTL, MASTER_URIS, CA, CRT, KEY, STORAGE };
+        REQUIRE(e_m.purge(TASK_CACHE_TTL, {}, purgeCallback) == 0);
+        REQUIRE(evicted.empty());
+    }
+}
+
 }  // namespace PXPAgent
@@ -6,12 +6,18 @@
 #include <pxp-agent/request_type.hpp>
 
 #include <leatherman/json_container/json_container.hpp>
+#include <leatherman/file_util/file.hpp>
 #include <leatherman/util/time.hpp>
 
+#include <cpp-pcp-client/util/chrono.hpp>
+#include <cpp-pcp-client/util/thread.hpp>
+
 #include <boost/filesystem/operations.hpp>
 
 #include <catch.hpp>
 
+#include <algorithm>  // std::count_if
+#include <atomic>
 #include <string>
 #include <utility>  // std::move
 #include <vector>
@@ -20,7 +26,9 @@ namespace PXPAgent {
 
 namespace fs = boost::filesystem;
 namespace lth_jc = leatherman::json_container;
+namespace lth_file = leatherman::file_util;
 namespace lth_util = leatherman::util;
+namespace pcp_util = PCPClient::Util;
 
 TEST_CASE("ResultsStorage ctor", "[module]") {
     SECTION("can instantiate") {
@@ -43,6 +51,19 @@ static void resetTest() {
         fs::remove_all(SPOOL_DIR);
 }
 
+// Copies the results directories of the specified test resources to
+// the spool, in the flat layout of previous versions; ResultsStorage
+// moves them to their shard
+static void copyResultsToSpool(const std::string& results_dir) {
+    configureTest();
+    for (fs::directory_iterator dir_it { results_dir }, end; dir_it != end; ++dir_it) {
+        auto spool_results_dir = fs::path(SPOOL_DIR) / dir_it->path().filename();
+        fs::create_directories(spool_results_dir);
+        for (fs::directory_iterator file_it { dir_it->path() }; file_it != end; ++file_it)
+            fs::copy_file(file_it->path(), spool_results_dir / file_it->path().filename());
+    }
+}
+
 TEST_CASE("ResultsStorage::find", "[module][results]") {
     configureTest();
 
@@ -54,7 +75,7 @@ TEST_CASE("ResultsStorage::find", "[module][results]") {
 
     SECTION("returns true when the spool directory exists") {
         ResultsStorage storage { SPOOL_DIR, SPOOL_TTL };
-        auto dir = SPOOL_DIR + "/some_transaction_id";
+        auto dir = storage.getResultsPath("some_transaction_id");
 
         if (!fs::exists(dir) && !fs::create_directories(dir))
             FAIL("Failed to create the results directory");
@@ -76,7 +97,41 @@ TEST_CASE("ResultsStorage::initializeMetadataFile", "[module][results]") {
         metadata.set<std::string>("foo", "bar");
         storage.initializeMetadataFile("1234", metadata);
 
-        REQUIRE(fs::exists(SPOOL_DIR + "/1234"));
+        REQUIRE(fs::exists(storage.getResultsPath("1234")));
+    }
+
+    resetTest();
+}
+
+TEST_CASE("ResultsStorage spool layout", "[module][results]") {
+    configureTest();
+
+    SECTION("shards the results directories in two levels") {
+        ResultsStorage storage { SPOOL_DIR, SPOOL_TTL };
+        auto results_path = storage.getResultsPath("1234");
+
+        REQUIRE(results_path.filename().string() == "1234");
+        REQUIRE(results_path.parent_path().filename().string().size() == 1u);
+        REQUIRE(results_path.parent_path().parent_path().filename().string().size() == 2u);
+        REQUIRE(fs::equivalent(results_path.parent_path().parent_path().parent_path(),
+                               SPOOL_DIR));
+        REQUIRE(storage.getResultsPath("1234") == results_path);
+    }
+
+    SECTION("moves the results directories of the flat layout to their shard") {
+        fs::create_directories(SPOOL_DIR + "/1234");
+        lth_file::atomic_write_to_file("0", SPOOL_DIR + "/1234/exitcode");
+        fs::create_directories(SPOOL_DIR + "/.not_results");
+
+        ResultsStorage storage { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE_FALSE(fs::exists(SPOOL_DIR + "/1234"));
+        REQUIRE(storage.find("1234"));
+        REQUIRE(storage.outputIsReady("1234"));
+        REQUIRE(fs::exists(SPOOL_DIR + "/.not_results"));
+
+        // The shards are not mistaken for results directories
+        ResultsStorage restarted { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(restarted.find("1234"));
     }
 
     resetTest();
@@ -89,7 +144,8 @@ static const std::string VALID_TRANSACTION { "valid" };
 static const std::string BROKEN_TRANSACTION { "broken" };
 
 TEST_CASE("ResultsStorage::getActionMetadata", "[module][results]") {
-    ResultsStorage st { TESTING_RESULTS, SPOOL_TTL };
+    copyResultsToSpool(TESTING_RESULTS);
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
 
     SECTION("Throws an Error if the metadata file does not exist") {
         REQUIRE_THROWS_AS(st.getActionMetadata("does_not_exist"),
@@ -104,6 +160,8 @@ TEST_CASE("ResultsStorage::getActionMetadata", "[module][results]") {
     SECTION("Returns a JSON object if the metadata is valid") {
         REQUIRE_NOTHROW(st.getActionMetadata(VALID_TRANSACTION));
     }
+
+    resetTest();
 }
 
 TEST_CASE("ResultsStorage::updateMetadataFile", "[module][results]") {
@@ -137,11 +195,61 @@ TEST_CASE("ResultsStorage::updateMetadataFile", "[module][results]") {
         REQUIRE(read_metadata.get<std::string>("status") == "success");
     }
 
+    SECTION("Writes only the state entries at each update") {
+        auto results_dir = st.getResultsPath(valid_transaction_id).string();
+        st.initializeMetadataFile(valid_transaction_id, some_valid_metadata);
+        some_valid_metadata.set<std::string>("request_params", "changed");
+        some_valid_metadata.set<std::string>("status", "success");
+        some_valid_metadata.set<std::string>("end", "5:61");
+        st.updateMetadataFile(valid_transaction_id, some_valid_metadata);
+
+        std::string state_txt;
+        REQUIRE(lth_file::read(results_dir + "/state", state_txt));
+        REQUIRE(state_txt.find("request_params") == std::string::npos);
+
+        auto read_metadata = st.getActionMetadata(valid_transaction_id);
+        REQUIRE(read_metadata.get<std::string>("request_params") == "abc");
+        REQUIRE(read_metadata.get<std::string>("status") == "success");
+        REQUIRE(read_metadata.get<std::string>("end") == "5:61");
+    }
+
+    SECTION("Splits the metadata file of previous versions at the first update") {
+        auto results_dir = st.getResultsPath(valid_transaction_id).string();
+        fs::create_directories(results_dir);
+        lth_file::atomic_write_to_file(some_valid_metadata.toString(),
+                                       results_dir + "/metadata");
+        REQUIRE(st.getActionMetadata(valid_transaction_id).get<std::string>("status")
+                == "running");
+
+        some_valid_metadata.set<std::string>("status", "success");
+        st.updateMetadataFile(valid_transaction_id, some_valid_metadata);
+
+        REQUIRE_FALSE(fs::exists(results_dir + "/metadata"));
+        REQUIRE(fs::exists(results_dir + "/request"));
+        REQUIRE(st.getActionMetadata(valid_transaction_id).get<std::string>("status")
+                == "success");
+    }
+
+
+    SECTION("Updates the metadata file in strict durability mode") {
+        ResultsStorage strict_st { SPOOL_DIR, SPOOL_TTL, ResultsStorage::Quotas { 0, 0, 0 },
+                                   Util::Durability::Strict };
+        strict_st.initializeMetadataFile(valid_transaction_id, some_valid_metadata);
+        some_valid_metadata.set<std::string>("status", "success");
+        strict_st.updateMetadataFile(valid_transaction_id, some_valid_metadata);
+
+        auto results_dir = strict_st.getResultsPath(valid_transaction_id).string();
+        REQUIRE_FALSE(fs::exists(results_dir + "/state~"));
+        REQUIRE(st.getActionMetadata(valid_transaction_id).get<std::string>("status")
+                == "success");
+    }
+
     resetTest();
 }
 
 TEST_CASE("ResultsStorage::pidFileExists", "[module][results]") {
-    ResultsStorage st { TESTING_RESULTS, SPOOL_TTL };
+    copyResultsToSpool(TESTING_RESULTS);
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
 
     SECTION("returns true if exists") {
         REQUIRE(st.pidFileExists(VALID_TRANSACTION));
@@ -150,10 +258,13 @@ TEST_CASE("ResultsStorage::pidFileExists", "[module][results]") {
     SECTION("returns false if it does not exist") {
         REQUIRE_FALSE(st.pidFileExists("does_not_exist"));
     }
+
+    resetTest();
 }
 
 TEST_CASE("ResultsStorage::getPID", "[module][results]") {
-    ResultsStorage st { TESTING_RESULTS, SPOOL_TTL };
+    copyResultsToSpool(TESTING_RESULTS);
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
 
     SECTION("Throws an Error if the PID file does not exist") {
         REQUIRE_THROWS_AS(st.getPID("does_not_exist"),
@@ -168,10 +279,13 @@ TEST_CASE("ResultsStorage::getPID", "[module][results]") {
     SECTION("Returns an integer if the PID is valid") {
         REQUIRE_NOTHROW(st.getPID(VALID_TRANSACTION));
     }
+
+    resetTest();
 }
 
 TEST_CASE("ResultsStorage::getOutput", "[module][results]") {
-    ResultsStorage st { TESTING_RESULTS, SPOOL_TTL };
+    copyResultsToSpool(TESTING_RESULTS);
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
 
     SECTION("Throws an Error if the exitcode is invalid") {
         REQUIRE_THROWS_AS(st.getOutput(BROKEN_TRANSACTION),
@@ -185,6 +299,73 @@ TEST_CASE("ResultsStorage::getOutput", "[module][results]") {
         REQUIRE(output.std_err == "Hey, all good here!");
         REQUIRE(output.std_out == "{\"spam\":\"eggs\"}");
     }
+
+    SECTION("Retrieves empty output files") {
+        auto results_dir = st.getResultsPath("1234").string();
+        fs::create_directories(results_dir);
+        lth_file::atomic_write_to_file("", results_dir + "/stdout");
+        lth_file::atomic_write_to_file("", results_dir + "/stderr");
+
+        auto output = st.getOutput("1234", 1);
+        REQUIRE(output.exitcode == 1);
+        REQUIRE(output.std_out.empty());
+        REQUIRE(output.std_err.empty());
+    }
+
+    resetTest();
+}
+
+TEST_CASE("ResultsStorage::compressOutput", "[module][results]") {
+    configureTest();
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+    auto results_dir = st.getResultsPath("1234").string();
+    fs::create_directories(results_dir);
+
+    std::string std_out;
+    for (auto i = 0; i < 10000; i++)
+        std_out += "line " + std::to_string(i) + "\n";
+    lth_file::atomic_write_to_file(std_out, results_dir + "/stdout");
+    lth_file::atomic_write_to_file("small", results_dir + "/stderr");
+
+    auto compressedFiles = [&results_dir]() {
+        std::vector<std::string> files;
+        for (fs::directory_iterator it { results_dir }, end; it != end; ++it) {
+            auto extension = it->path().extension().string();
+            if (extension == ".gz" || extension == ".zst")
+                files.push_back(it->path().stem().string());
+        }
+        return files;
+    };
+
+    SECTION("does nothing until the action completed") {
+        st.compressOutput("1234");
+        REQUIRE(fs::exists(results_dir + "/stdout"));
+        REQUIRE(compressedFiles().empty());
+    }
+
+    SECTION("compresses the large output files, which are then read transparently") {
+        lth_file::atomic_write_to_file("0", results_dir + "/exitcode");
+        st.compressOutput("1234");
+
+        REQUIRE_FALSE(fs::exists(results_dir + "/stdout"));
+        REQUIRE(compressedFiles() == std::vector<std::string> { "stdout" });
+        REQUIRE(fs::exists(results_dir + "/stderr"));
+
+        auto output = st.getOutput("1234");
+        REQUIRE(output.exitcode == 0);
+        REQUIRE(output.std_out == std_out);
+        REQUIRE(output.std_err == "small");
+    }
+
+    SECTION("reads the uncompressed file if both are present") {
+        lth_file::atomic_write_to_file("0", results_dir + "/exitcode");
+        st.compressOutput("1234");
+        lth_file::atomic_write_to_file("uncompressed", results_dir + "/stdout");
+
+        REQUIRE(st.getOutput("1234").std_out == "uncompressed");
+    }
+
+    resetTest();
 }
 
 static const std::string PURGE_TEST_RESULTS { std::string { PXP_AGENT_ROOT_PATH}
@@ -194,9 +375,10 @@ static const std::string OLD_TRANSACTION { "valid_old" };
 static const std::string RECENT_TRANSACTION { "valid_recent" };
 
 TEST_CASE("ResultsStorage::purge", "[module][results]") {
-    ResultsStorage st { PURGE_TEST_RESULTS, SPOOL_TTL };
-    auto recent_metadata_old = st.getActionMetadata(RECENT_TRANSACTION);
-    lth_jc::JsonContainer recent_metadata { recent_metadata_old };
+    copyResultsToSpool(PURGE_TEST_RESULTS);
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+    st.recover(1);
+    lth_jc::JsonContainer recent_metadata { st.getActionMetadata(RECENT_TRANSACTION) };
     recent_metadata.set<std::string>("start", lth_util::get_ISO8601_time());
     unsigned int num_purged_results { 0 };
     auto purgeCallback =
@@ -210,9 +392,267 @@ TEST_CASE("ResultsStorage::purge", "[module][results]") {
         REQUIRE(num_purged_results == 1);
     }
 
-    // Let's keep the recent metadata file as it was, to avoid
-    // updating it at every "git add -A"...
-    st.updateMetadataFile(RECENT_TRANSACTION, recent_metadata_old);
+    resetTest();
+}
+
+static lth_jc::JsonContainer getMetadata(const std::string& transaction_id,
+                                         const std::string& status,
+                                         const std::string& start)
+{
+    lth_jc::JsonContainer metadata {};
+    metadata.set<std::string>("requester", "me");
+    metadata.set<std::string>("module", "good_stuff");
+    metadata.set<std::string>("action", "do_stuff");
+    metadata.set<std::string>("request_params", "abc");
+    metadata.set<std::string>("transaction_id", transaction_id);
+    metadata.set<std::string>("request_id", "45");
+    metadata.set<bool>("notify_outcome", false);
+    metadata.set<std::string>("start", start);
+    metadata.set<std::string>("status", status);
+    return metadata;
+}
+
+TEST_CASE("ResultsStorage purge index", "[module][results]") {
+    static const std::string OLD_START { "2015-06-26T22:57:09.000000Z" };
+    std::vector<std::string> purged {};
+    auto purgeCallback =
+        [&purged](const std::string& dir_path) -> void {
+            purged.push_back(fs::path(dir_path).filename().string());
+            fs::remove_all(dir_path);
+        };
+
+    configureTest();
+
+    SECTION("only purges the finalised transactions that expired") {
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        st.initializeMetadataFile("old", getMetadata("old", "success", OLD_START));
+        st.initializeMetadataFile("old_running", getMetadata("old_running", "running", OLD_START));
+        st.initializeMetadataFile("old_ongoing", getMetadata("old_ongoing", "failure", OLD_START));
+        st.initializeMetadataFile("recent", getMetadata("recent", "success",
+                                                        lth_util::get_ISO8601_time()));
+
+        REQUIRE(st.purge("10d", { "old_ongoing" }, purgeCallback) == 1);
+        REQUIRE(purged == std::vector<std::string> { "old" });
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 1);
+        REQUIRE(purged.back() == "old_ongoing");
+        REQUIRE(st.find("old_running"));
+        REQUIRE(st.find("recent"));
+    }
+
+    SECTION("updates the index when the metadata changes") {
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        st.initializeMetadataFile("1234", getMetadata("1234", "running", OLD_START));
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 0);
+
+        st.updateMetadataFile("1234", getMetadata("1234", "success", OLD_START));
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 1);
+        REQUIRE_FALSE(st.find("1234"));
+    }
+
+    SECTION("rebuilds the index from the results directories") {
+        {
+            ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+            st.initializeMetadataFile("old", getMetadata("old", "success", OLD_START));
+            st.initializeMetadataFile("old_running",
+                                      getMetadata("old_running", "running", OLD_START));
+        }
+
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 0);
+        REQUIRE(st.recover(2) == 2u);
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 1);
+        REQUIRE(purged == std::vector<std::string> { "old" });
+    }
+
+    SECTION("stops once the budget is exhausted, leaving the rest for the next call") {
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        st.initializeMetadataFile("a", getMetadata("a", "success", OLD_START));
+        st.initializeMetadataFile("b", getMetadata("b", "success", OLD_START));
+        st.initializeMetadataFile("c", getMetadata("c", "success", OLD_START));
+
+        Util::PurgeBudget budget { 2, 0, pcp_util::chrono::milliseconds(0) };
+        REQUIRE(st.purge("10d", {}, purgeCallback, &budget) == 2);
+        REQUIRE(budget.exhausted());
+
+        Util::PurgeBudget next_budget { 2, 0, pcp_util::chrono::milliseconds(0) };
+        REQUIRE(st.purge("10d", {}, purgeCallback, &next_budget) == 1);
+        REQUIRE_FALSE(next_budget.exhausted());
+        REQUIRE(purged.size() == 3u);
+    }
+
+    SECTION("purges the oldest transactions first") {
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        st.initializeMetadataFile("b", getMetadata("b", "success", "2015-06-27T22:57:09.000000Z"));
+        st.initializeMetadataFile("a", getMetadata("a", "success", OLD_START));
+
+        REQUIRE(st.purge("10d", {}, purgeCallback) == 2);
+        REQUIRE(purged == (std::vector<std::string> { "a", "b" }));
+    }
+
+    resetTest();
+}
+
+TEST_CASE("ResultsStorage::recover", "[module][results]") {
+    static const std::string OLD_START { "2015-06-26T22:57:09.000000Z" };
+    static const unsigned int NUM_TRANSACTIONS { 100 };
+    configureTest();
+
+    {
+        ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+        for (unsigned int i = 0; i < NUM_TRANSACTIONS; i++) {
+            auto transaction_id = "done_" + std::to_string(i);
+            st.initializeMetadataFile(transaction_id,
+                                      getMetadata(transaction_id, "success", OLD_START));
+        }
+        st.initializeMetadataFile("running", getMetadata("running", "running", OLD_START));
+        st.initializeMetadataFile("failed", getMetadata("failed", "failure", OLD_START));
+    }
+
+    ResultsStorage st { SPOOL_DIR, SPOOL_TTL };
+    pcp_util::mutex running_mutex;
+    std::vector<std::string> running {};
+    // NB: called by the scanning threads; the assertions are made later
+    auto recoveryCallback =
+        [&](const std::string& transaction_id, lth_jc::JsonContainer metadata) -> void {
+            pcp_util::lock_guard<pcp_util::mutex> the_lock { running_mutex };
+            running.push_back(transaction_id + ":" + metadata.get<std::string>("status"));
+        };
+
+    SECTION("scans every transaction, with several threads") {
+        REQUIRE(st.recover(4, recoveryCallback) == NUM_TRANSACTIONS + 2);
+        REQUIRE(running == std::vector<std::string> { "running:running" });
+    }
+
+    SECTION("stops scanning once the stopper returns true") {
+        std::atomic<unsigned int> num_checks { 0 };
+        auto stopper = [&num_checks]() -> bool { return ++num_checks > 10; };
+        REQUIRE(st.recover(4, recoveryCallback, stopper) == 10u);
+    }
+
+    SECTION("indexes the finalised transactions for purging") {
+        st.recover(4);
+        REQUIRE(st.purge("10d", {}) == NUM_TRANSACTIONS + 1);
+        REQUIRE(st.find("running"));
+        REQUIRE_FALSE(st.find("failed"));
+    }
+
+    SECTION("skips the transactions with invalid metadata") {
+        fs::create_directories(st.getResultsPath("invalid"));
+        lth_file::atomic_write_to_file("{ invalid }",
+                                       (st.getResultsPath("invalid") / "metadata").string());
+        REQUIRE(st.recover(1, recoveryCallback) == NUM_TRANSACTIONS + 3);
+        REQUIRE(running == std::vector<std::string> { "running:running" });
+    }
+
+    resetTest();
+}
+
+TEST_CASE("ResultsStorage quotas", "[module][results]") {
+    static const std::string OLD_START { "2015-06-26T22:57:09.000000Z" };
+    std::vector<std::string> purged {};
+    auto purgeCallback =
+        [&purged](const std::string& dir_path) -> void {
+            purged.push_back(fs::path(dir_path).filename().string());
+            fs::remove_all(dir_path);
+        };
+    auto getRequesterMetadata =
+        [](const std::string& transaction_id, const std::string& status,
+           const std::string& start, const std::string& requester) {
+            auto metadata = getMetadata(transaction_id, status, start);
+            metadata.set<std::string>("requester", requester);
+            return metadata;
+        };
+
+    configureTest();
+
+    SECTION("is not exceeded without quotas") {
+        ResultsStorage st { SPOOL_DIR, "0d" };
+        st.initializeMetadataFile("a", getMetadata("a", "success", OLD_START));
+        REQUIRE_FALSE(st.hasQuotas());
+        REQUIRE_FALSE(st.quotaExceeded());
+        REQUIRE(st.purge("0d", {}, purgeCallback) == 0);
+    }
+
+    SECTION("evicts the oldest finalised transactions, never the running ones") {
+        ResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 2, 0 } };
+        st.initializeMetadataFile("running", getMetadata("running", "running", OLD_START));
+        st.initializeMetadataFile("b", getMetadata("b", "success", "2015-06-28T22:57:09.000000Z"));
+        st.initializeMetadataFile("a", getMetadata("a", "failure", "2015-06-27T22:57:09.000000Z"));
+        st.initializeMetadataFile("c", getMetadata("c", "success", lth_util::get_ISO8601_time()));
+        REQUIRE(st.quotaExceeded());
+
+        // The TTL is disabled; only the quota is enforced
+        REQUIRE(st.purge("0d", {}, purgeCallback) == 2);
+        REQUIRE(purged == (std::vector<std::string> { "a", "b" }));
+        REQUIRE(st.find("running"));
+        REQUIRE(st.find("c"));
+        REQUIRE_FALSE(st.quotaExceeded());
+    }
+
+    SECTION("skips the ongoing transactions") {
+        ResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 1, 0 } };
+        st.initializeMetadataFile("a", getMetadata("a", "success", OLD_START));
+        st.initializeMetadataFile("b", getMetadata("b", "success", OLD_START));
+
+        REQUIRE(st.purge("0d", { "a" }, purgeCallback) == 1);
+        REQUIRE(purged == std::vector<std::string> { "b" });
+    }
+
+    SECTION("caps the transactions of each requester") {
+        ResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 0, 2 } };
+        for (auto transaction_id : { "noisy_1", "noisy_2", "noisy_3", "noisy_4" })
+            st.initializeMetadataFile(transaction_id,
+                                      getRequesterMetadata(transaction_id, "success",
+                                                           OLD_START, "noisy"));
+        st.initializeMetadataFile("quiet_1", getRequesterMetadata("quiet_1", "success",
+                                                                  OLD_START, "quiet"));
+        REQUIRE(st.quotaExceeded());
+
+        REQUIRE(st.purge("0d", {}, purgeCallback) == 2);
+        REQUIRE(st.find("quiet_1"));
+        REQUIRE(std::count_if(purged.begin(), purged.end(),
+                              [](const std::string& t_id) {
+                                  return t_id.find("noisy") == 0;
+                              }) == 2);
+        REQUIRE_FALSE(st.quotaExceeded());
+    }
+
+    SECTION("bounds the size of the finalised transactions") {
+        ResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 1024 * 1024, 0, 0 } };
+        for (auto transaction_id : { "a", "b", "c" }) {
+            st.initializeMetadataFile(transaction_id,
+                                      getMetadata(transaction_id, "running", OLD_START));
+            lth_file::atomic_write_to_file(std::string(600 * 1024, 'x'),
+                                           (st.getResultsPath(transaction_id)
+                                            / "stdout").string());
+        }
+        REQUIRE_FALSE(st.quotaExceeded());
+
+        st.updateMetadataFile("a", getMetadata("a", "success", OLD_START));
+        st.updateMetadataFile("b", getMetadata("b", "success", "2015-06-27T22:57:09.000000Z"));
+        REQUIRE(st.quotaExceeded());
+
+        REQUIRE(st.purge("0d", {}, purgeCallback) == 1);
+        REQUIRE(purged == std::vector<std::string> { "a" });
+        REQUIRE_FALSE(st.quotaExceeded());
+    }
+
+    SECTION("rebuilds the quota usage at startup") {
+        {
+            ResultsStorage st { SPOOL_DIR, "0d" };
+            st.initializeMetadataFile("a", getMetadata("a", "success", OLD_START));
+            st.initializeMetadataFile("b", getMetadata("b", "success",
+                                                       lth_util::get_ISO8601_time()));
+        }
+
+        ResultsStorage st { SPOOL_DIR, "0d", ResultsStorage::Quotas { 0, 1, 0 } };
+        st.recover(2);
+        REQUIRE(st.quotaExceeded());
+        REQUIRE(st.purge("0d", {}, purgeCallback) == 1);
+        REQUIRE(purged == std::vector<std::string> { "a" });
+    }
+
+    resetTest();
 }
 
 }  // namespace PXPAgent
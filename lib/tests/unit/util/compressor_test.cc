@@ -0,0 +1,81 @@
+#include <pxp-agent/util/compressor.hpp>
+#include <pxp-agent/util/decompressor.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+static std::string compress(const std::string& compression,
+                            const std::string& content,
+                            size_t chunk_size)
+{
+    std::string compressed;
+    auto output_callback = [&compressed](const char* data, size_t size) {
+        compressed.append(data, size);
+    };
+    auto compressor = Compressor::create(compression);
+
+    for (size_t i = 0; i < content.size(); i += chunk_size)
+        compressor->compress(content.data() + i,
+                             std::min(chunk_size, content.size() - i),
+                             output_callback);
+    compressor->finish(output_callback);
+    return compressed;
+}
+
+static std::string decompress(const std::string& compression, const std::string& compressed)
+{
+    std::string output;
+    auto decompressor = Decompressor::create(compression);
+    decompressor->decompress(compressed.data(), compressed.size(),
+                             [&output](const char* data, size_t size) {
+                                 output.append(data, size);
+                             });
+    decompressor->finish();
+    return output;
+}
+
+TEST_CASE("Compressor::create", "[util]") {
+    SECTION("supports gzip") {
+        REQUIRE(Compressor::create("gzip") != nullptr);
+    }
+
+    SECTION("throws an Error for an unknown compression") {
+        REQUIRE_THROWS_AS(Compressor::create("rot13"), Compressor::Error);
+    }
+}
+
+TEST_CASE("Compressor::compress", "[util]") {
+    std::vector<std::string> compressions { "gzip" };
+#ifdef PXP_AGENT_HAS_ZSTD
+    compressions.push_back("zstd");
+#endif
+
+    std::string content;
+    for (auto i = 0; i < 100000; i++)
+        content += "line " + std::to_string(i) + "\n";
+
+    for (const auto& compression : compressions) {
+        SECTION("produces " + compression + " content that can be decompressed") {
+            auto compressed = compress(compression, content, content.size());
+            REQUIRE(compressed.size() < content.size() / 2);
+            REQUIRE(decompress(compression, compressed) == content);
+        }
+
+        SECTION("compresses " + compression + " content fed in small chunks") {
+            REQUIRE(decompress(compression, compress(compression, content, 1000)) == content);
+        }
+
+        SECTION("compresses empty " + compression + " content") {
+            REQUIRE(decompress(compression, compress(compression, "", 1)).empty());
+        }
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,45 @@
+#include <pxp-agent/util/curl_pool.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+TEST_CASE("CurlPool::get", "[util]") {
+    CurlPool pool { "mock_ca", "mock_crt", "mock_key" };
+    std::string error_body;
+    auto write_callback = [](long, const char*, size_t) {};
+
+    SECTION("throws a TransferError mentioning the host if it can't be resolved") {
+        REQUIRE_THROWS_AS(pool.get("https://_master1/task", write_callback, error_body, 1000),
+                          CurlPool::TransferError);
+
+        try {
+            pool.get("https://_master1/task", write_callback, error_body, 1000);
+        } catch (const CurlPool::TransferError& e) {
+            REQUIRE(std::string { e.what() }.find("_master1") != std::string::npos);
+        }
+    }
+
+    SECTION("returns the handle to the pool after a transfer") {
+        REQUIRE(pool.numIdleHandles() == 0u);
+        REQUIRE_THROWS(pool.get("https://_master1/task", write_callback, error_body, 1000));
+        REQUIRE(pool.numIdleHandles() == 1u);
+        REQUIRE_THROWS(pool.get("https://_master1/task", write_callback, error_body, 1000));
+        REQUIRE(pool.numIdleHandles() == 1u);
+    }
+
+    SECTION("releases the transfer slot after a failed transfer") {
+        CurlPool limited_pool { "mock_ca", "mock_crt", "mock_key", 1, 1024 };
+        REQUIRE_THROWS(limited_pool.get("https://_master1/task", write_callback, error_body, 1000));
+        REQUIRE(limited_pool.numActiveTransfers() == 0u);
+        REQUIRE_THROWS_AS(limited_pool.get("https://_master1/task", write_callback, error_body, 1000),
+                          CurlPool::TransferError);
+        REQUIRE(limited_pool.numActiveTransfers() == 0u);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
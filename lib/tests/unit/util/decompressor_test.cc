@@ -0,0 +1,82 @@
+#include <pxp-agent/util/decompressor.hpp>
+
+#include <catch.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace PXPAgent {
+namespace Util {
+
+static std::string gzip(const std::string& content)
+{
+    z_stream stream {};
+    // NB: 16 + MAX_WBITS makes zlib write a gzip header
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                 Z_DEFAULT_STRATEGY);
+    std::vector<char> buffer(deflateBound(&stream, content.size()) + 32);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+    stream.avail_in = static_cast<uInt>(content.size());
+    stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+    stream.avail_out = static_cast<uInt>(buffer.size());
+    deflate(&stream, Z_FINISH);
+    std::string compressed { buffer.data(), buffer.size() - stream.avail_out };
+    deflateEnd(&stream);
+    return compressed;
+}
+
+TEST_CASE("Decompressor::create", "[util]") {
+    SECTION("supports gzip") {
+        REQUIRE(Decompressor::create("gzip") != nullptr);
+    }
+
+    SECTION("throws an Error for an unknown compression") {
+        REQUIRE_THROWS_AS(Decompressor::create("rot13"), Decompressor::Error);
+    }
+}
+
+TEST_CASE("Decompressor::decompress", "[util]") {
+    std::string content;
+    for (auto i = 0; i < 10000; i++)
+        content += "line " + std::to_string(i) + "\n";
+    auto compressed = gzip(content);
+
+    std::string output;
+    auto output_callback = [&output](const char* data, size_t size) {
+        output.append(data, size);
+    };
+    auto decompressor = Decompressor::create("gzip");
+
+    SECTION("decompresses gzip content fed in a single chunk") {
+        decompressor->decompress(compressed.data(), compressed.size(), output_callback);
+        REQUIRE_NOTHROW(decompressor->finish());
+        REQUIRE(output == content);
+    }
+
+    SECTION("decompresses gzip content fed in small chunks") {
+        for (size_t i = 0; i < compressed.size(); i += 7)
+            decompressor->decompress(compressed.data() + i,
+                                     std::min<size_t>(7, compressed.size() - i),
+                                     output_callback);
+        REQUIRE_NOTHROW(decompressor->finish());
+        REQUIRE(output == content);
+    }
+
+    SECTION("finish throws an Error if the content is truncated") {
+        decompressor->decompress(compressed.data(), compressed.size() / 2, output_callback);
+        REQUIRE_THROWS_AS(decompressor->finish(), Decompressor::Error);
+    }
+
+    SECTION("throws an Error if the content is not gzip") {
+        std::string not_gzip { "not gzip content" };
+        REQUIRE_THROWS_AS(decompressor->decompress(not_gzip.data(), not_gzip.size(),
+                                                   output_callback),
+                          Decompressor::Error);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,71 @@
+#include <pxp-agent/util/file_syncer.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <cpp-pcp-client/util/chrono.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+namespace pcp_util = PCPClient::Util;
+
+static const fs::perms FILE_PERMS { fs::owner_read | fs::owner_write };
+
+TEST_CASE("FileSyncer", "[util]") {
+    auto dir_path = fs::temp_directory_path() / fs::unique_path("pxp_syncer_test_%%%%-%%%%");
+    fs::create_directories(dir_path);
+    lth_util::scope_exit dir_remover { [&dir_path]() { fs::remove_all(dir_path); } };
+    auto file_path = (dir_path / "file").string();
+
+    SECTION("replaces the file content in each mode") {
+        for (auto durability : { Durability::Strict,
+                                 Durability::GroupCommit,
+                                 Durability::Relaxed }) {
+            FileSyncer syncer { durability };
+            syncer.writeFile("first", file_path, FILE_PERMS);
+            syncer.writeFile("second", file_path, FILE_PERMS);
+            REQUIRE(lth_file::read(file_path) == "second");
+            REQUIRE_FALSE(fs::exists(file_path + "~"));
+        }
+    }
+
+    SECTION("strict mode throws an Error when the file can't be flushed") {
+        FileSyncer syncer { Durability::Strict };
+        REQUIRE_THROWS_AS(syncer.sync((dir_path / "missing").string()),
+                          FileSyncer::Error);
+        REQUIRE_THROWS_AS(syncer.writeFile("content",
+                                           (dir_path / "missing" / "file").string(),
+                                           FILE_PERMS),
+                          FileSyncer::Error);
+    }
+
+    SECTION("group-commit mode queues the files and logs the failures") {
+        FileSyncer syncer { Durability::GroupCommit, pcp_util::chrono::milliseconds(10) };
+        lth_file::atomic_write_to_file("content", file_path, FILE_PERMS, std::ios::binary);
+        REQUIRE_NOTHROW(syncer.sync(file_path));
+        REQUIRE_NOTHROW(syncer.sync((dir_path / "missing").string()));
+        REQUIRE_NOTHROW(syncer.syncEntry(file_path));
+        REQUIRE_NOTHROW(syncer.flush());
+        REQUIRE_NOTHROW(syncer.sync(file_path));
+        pcp_util::this_thread::sleep_for(pcp_util::chrono::milliseconds(50));
+    }
+
+    SECTION("relaxed mode doesn't flush anything") {
+        FileSyncer syncer { Durability::Relaxed };
+        REQUIRE_NOTHROW(syncer.sync((dir_path / "missing").string()));
+        REQUIRE_NOTHROW(syncer.syncEntry((dir_path / "missing" / "file").string()));
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,138 @@
+#include <pxp-agent/util/posix/detached_task.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <sys/stat.h>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+TEST_CASE("DetachedTask::run", "[util]") {
+    auto results_dir = fs::temp_directory_path() / fs::unique_path("pxp_detached_task_%%%%-%%%%");
+    fs::create_directories(results_dir);
+    lth_util::scope_exit results_remover { [&results_dir]() { fs::remove_all(results_dir); } };
+
+    auto stdout_path = (results_dir / "stdout").string();
+    auto stderr_path = (results_dir / "stderr").string();
+    auto exitcode_path = (results_dir / "exitcode").string();
+
+    auto run = [&](const std::string& executable,
+                   const std::vector<std::string>& arguments,
+                   const std::string& input,
+                   std::function<void(pid_t)> pid_callback = nullptr) {
+        return DetachedTask::run(executable, arguments, input, { { "PXP_TEST_VAR", "value" } },
+                                 stdout_path, stderr_path, exitcode_path, pid_callback);
+    };
+
+    SECTION("feeds the input and writes the output and exit code to files") {
+        pid_t reaper_pid { 0 };
+        auto exitcode = run("/bin/sh",
+                            { "-c", "cat -; echo \"$PXP_TEST_VAR\" >&2; exit 3" },
+                            "{\"message\":\"hello\"}",
+                            [&reaper_pid](pid_t pid) { reaper_pid = pid; });
+
+        REQUIRE(exitcode == 3);
+        REQUIRE(reaper_pid > 0);
+        REQUIRE(lth_file::read(stdout_path) == "{\"message\":\"hello\"}");
+        REQUIRE(lth_file::read(stderr_path) == "value\n");
+        REQUIRE(lth_file::read(exitcode_path) == "3");
+
+        struct stat file_stat;
+        REQUIRE(stat(stdout_path.c_str(), &file_stat) == 0);
+        REQUIRE((file_stat.st_mode & 0777) == 0640);
+    }
+
+    SECTION("searches the PATH for the executable") {
+        REQUIRE(run("sh", { "-c", "exit 0" }, "") == 0);
+        REQUIRE(lth_file::read(exitcode_path) == "0");
+    }
+
+    SECTION("doesn't block if the task doesn't read its input") {
+        REQUIRE(run("/bin/sh", { "-c", "exit 0" }, std::string(1 << 20, 'x')) == 0);
+    }
+
+    SECTION("reports a task killed by a signal") {
+        REQUIRE(run("/bin/sh", { "-c", "kill -9 $$" }, "") == 137);
+        REQUIRE(lth_file::read(exitcode_path) == "137");
+    }
+
+    SECTION("reports a task that can't be executed") {
+        auto missing = (results_dir / "missing").string();
+        REQUIRE(run(missing, {}, "") == 127);
+        REQUIRE(lth_file::read(exitcode_path) == "127");
+        auto error = lth_file::read(stderr_path);
+        REQUIRE(error.find("Task '" + missing + "' failed to run") == 0u);
+        REQUIRE(error.find("No such file or directory") != std::string::npos);
+    }
+
+    SECTION("throws an Error if the results files can't be created") {
+        stdout_path = (results_dir / "missing" / "stdout").string();
+        REQUIRE_THROWS_AS(run("/bin/sh", { "-c", "exit 0" }, ""), DetachedTask::Error);
+    }
+
+    SECTION("can feed the input from a file") {
+        auto input_path = (results_dir / "input").string();
+        std::string input(1 << 20, 'x');
+        lth_file::atomic_write_to_file(input, input_path);
+
+        REQUIRE(DetachedTask::runWithInputFile("/bin/sh", { "-c", "cat -" }, input_path, {},
+                                               stdout_path, stderr_path, exitcode_path,
+                                               nullptr) == 0);
+        REQUIRE(lth_file::read(stdout_path) == input);
+        REQUIRE(lth_file::read(exitcode_path) == "0");
+    }
+
+    SECTION("throws an Error if the input file can't be opened") {
+        REQUIRE_THROWS_AS(DetachedTask::runWithInputFile("/bin/sh", { "-c", "exit 0" },
+                                                         (results_dir / "missing").string(), {},
+                                                         stdout_path, stderr_path, exitcode_path,
+                                                         nullptr),
+                          DetachedTask::Error);
+    }
+}
+
+TEST_CASE("DetachedTask::capture", "[util]") {
+    std::string std_out;
+    std::string std_err;
+    auto capture = [&](const std::vector<std::string>& arguments, const std::string& input) {
+        return DetachedTask::capture("/bin/sh", arguments, input, { { "PXP_TEST_VAR", "value" } },
+                                     nullptr,
+                                     [&std_out](const char* data, size_t size) { std_out.append(data, size); },
+                                     [&std_err](const char* data, size_t size) { std_err.append(data, size); });
+    };
+
+    SECTION("feeds the input and captures the output and exit code") {
+        REQUIRE(capture({ "-c", "cat -; echo \"$PXP_TEST_VAR\" >&2; exit 2" }, "hello") == 2);
+        REQUIRE(std_out == "hello");
+        REQUIRE(std_err == "value\n");
+    }
+
+    SECTION("exchanges data larger than the pipe buffers") {
+        std::string input(1 << 22, 'x');
+        REQUIRE(capture({ "-c", "cat - >&2; cat /dev/null" }, input) == 0);
+        REQUIRE(std_err == input);
+    }
+
+    SECTION("doesn't block if the task doesn't read its input") {
+        REQUIRE(capture({ "-c", "exit 0" }, std::string(1 << 20, 'x')) == 0);
+    }
+
+    SECTION("propagates the exceptions of the output callbacks") {
+        auto failing_callback = [](const char*, size_t) { throw std::runtime_error("full"); };
+        REQUIRE_THROWS_AS(DetachedTask::capture("/bin/sh", { "-c", "echo hi" }, "", {}, nullptr,
+                                                failing_callback, failing_callback),
+                          std::runtime_error);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
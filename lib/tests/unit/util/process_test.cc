@@ -1,5 +1,7 @@
 #include <pxp-agent/util/process.hpp>
 
+#include <cpp-pcp-client/util/thread.hpp>
+
 #include <catch.hpp>
 
 #ifdef _WIN32
@@ -28,5 +30,12 @@ TEST_CASE("getPid", "[util]") {
     }
 }
 
+TEST_CASE("lowerThreadPriority", "[util]") {
+    SECTION("can call it from a separate thread") {
+        PCPClient::Util::thread low_priority_thread { []() { lowerThreadPriority(); } };
+        REQUIRE_NOTHROW(low_priority_thread.join());
+    }
+}
+
 }  // namespace Util
 }  // namespace PXPAgent
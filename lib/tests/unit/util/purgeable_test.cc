@@ -0,0 +1,50 @@
+#include <pxp-agent/util/purgeable.hpp>
+
+#include <cpp-pcp-client/util/thread.hpp>
+#include <cpp-pcp-client/util/chrono.hpp>
+
+#include <catch.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace pcp_util = PCPClient::Util;
+
+TEST_CASE("PurgeBudget", "[util]") {
+    SECTION("is never exhausted without limits") {
+        PurgeBudget budget { 0, 0, pcp_util::chrono::milliseconds(0) };
+        for (auto i = 0; i < 1000; i++)
+            budget.charge(1 << 20);
+        REQUIRE_FALSE(budget.exhausted());
+        REQUIRE_FALSE(budget.limitsBytes());
+        REQUIRE(budget.numDirs() == 1000u);
+    }
+
+    SECTION("is exhausted once the maximum number of directories is removed") {
+        PurgeBudget budget { 2, 0, pcp_util::chrono::milliseconds(0) };
+        budget.charge(0);
+        REQUIRE_FALSE(budget.exhausted());
+        budget.charge(0);
+        REQUIRE(budget.exhausted());
+    }
+
+    SECTION("is exhausted once the maximum number of bytes is removed") {
+        PurgeBudget budget { 0, 100, pcp_util::chrono::milliseconds(0) };
+        REQUIRE(budget.limitsBytes());
+        budget.charge(60);
+        REQUIRE_FALSE(budget.exhausted());
+        budget.charge(60);
+        REQUIRE(budget.exhausted());
+        REQUIRE(budget.numBytes() == 120u);
+    }
+
+    SECTION("is exhausted after the maximum duration") {
+        PurgeBudget budget { 0, 0, pcp_util::chrono::milliseconds(50) };
+        REQUIRE_FALSE(budget.exhausted());
+        pcp_util::this_thread::sleep_for(pcp_util::chrono::milliseconds(60));
+        REQUIRE(budget.exhausted());
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
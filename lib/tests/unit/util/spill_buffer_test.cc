@@ -0,0 +1,57 @@
+#include <pxp-agent/util/spill_buffer.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+TEST_CASE("SpillBuffer", "[util]") {
+    auto file_path = fs::temp_directory_path() / fs::unique_path("pxp_spill_test_%%%%-%%%%");
+    lth_util::scope_exit file_remover { [&file_path]() { fs::remove(file_path); } };
+    SpillBuffer buffer { file_path.string(), 10, fs::owner_read | fs::owner_write };
+
+    SECTION("keeps the output in memory below the threshold and stores it when finished") {
+        buffer.append("hello", 5);
+        buffer.append(" you", 4);
+        REQUIRE_FALSE(buffer.spilled());
+        REQUIRE_FALSE(fs::exists(file_path));
+
+        REQUIRE(buffer.finish() == "hello you");
+        REQUIRE(lth_file::read(file_path.string()) == "hello you");
+    }
+
+    SECTION("moves the output to the file once the threshold is exceeded") {
+        buffer.append("hello", 5);
+        buffer.append(" world", 6);
+        REQUIRE(buffer.spilled());
+        buffer.append("!", 1);
+
+        REQUIRE(buffer.finish() == "hello world!");
+        REQUIRE(lth_file::read(file_path.string()) == "hello world!");
+    }
+
+    SECTION("stores empty output") {
+        REQUIRE(buffer.finish().empty());
+        REQUIRE(fs::exists(file_path));
+    }
+
+    SECTION("throws an Error if the file can't be written") {
+        SpillBuffer bad_buffer { (file_path / "missing" / "stdout").string(), 1,
+                                 fs::owner_read | fs::owner_write };
+        REQUIRE_THROWS_AS(bad_buffer.append("hello", 5), SpillBuffer::Error);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
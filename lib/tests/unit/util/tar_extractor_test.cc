@@ -0,0 +1,163 @@
+#include <pxp-agent/util/tar_extractor.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+// sha256 of "#!/bin/sh\necho hi\n"
+static const std::string SCRIPT_SHA256 {
+    "299001868fb8c02fd431c336c6d058f5558c5dff5b5af5e6fe04b870a6a9cbba" };
+
+// Returns a ustar member: a header, followed by the padded content
+static std::string tarMember(const std::string& path,
+                             const std::string& content,
+                             char typeflag = '0')
+{
+    std::string header(512, '\0');
+    std::copy(path.begin(), path.end(), header.begin());
+    std::copy_n("0000755", 7, header.begin() + 100);
+    char size[12];
+    std::snprintf(size, sizeof(size), "%011o", static_cast<unsigned int>(content.size()));
+    std::copy_n(size, 11, header.begin() + 124);
+    std::copy_n("00000000000", 11, header.begin() + 136);
+    header[156] = typeflag;
+    std::copy_n("ustar\0" "00", 8, header.begin() + 257);
+
+    std::fill_n(header.begin() + 148, 8, ' ');
+    unsigned int checksum { 0 };
+    for (auto c : header)
+        checksum += static_cast<unsigned char>(c);
+    char checksum_field[8];
+    std::snprintf(checksum_field, sizeof(checksum_field), "%06o", checksum);
+    std::copy_n(checksum_field, 7, header.begin() + 148);
+
+    return header + content + std::string((512 - content.size() % 512) % 512, '\0');
+}
+
+static std::string tarEnd()
+{
+    return std::string(1024, '\0');
+}
+
+TEST_CASE("TarExtractor::extract", "[util]") {
+    auto dest_dir = fs::temp_directory_path() / fs::unique_path("pxp_tar_test_%%%%-%%%%");
+    lth_util::scope_exit dest_remover { [&dest_dir]() { fs::remove_all(dest_dir); } };
+
+    TarExtractor extractor { dest_dir, fs::owner_all | fs::group_read | fs::group_exe };
+    std::string script { "#!/bin/sh\necho hi\n" };
+
+    SECTION("extracts regular files and directories, computing their sha256") {
+        auto archive = tarMember("bin/", "", '5')
+                       + tarMember("bin/task.sh", script)
+                       + tarMember("./lib/helper.rb", std::string(1000, 'x'))
+                       + tarEnd();
+        extractor.extract(archive.data(), archive.size());
+        REQUIRE_NOTHROW(extractor.finish());
+
+        REQUIRE(lth_file::read((dest_dir / "bin" / "task.sh").string()) == script);
+        REQUIRE(fs::file_size(dest_dir / "lib" / "helper.rb") == 1000u);
+        REQUIRE(extractor.members().size() == 2u);
+        REQUIRE(extractor.members()[0].path == "bin/task.sh");
+        REQUIRE(extractor.members()[0].size == script.size());
+        REQUIRE(extractor.members()[0].sha256 == SCRIPT_SHA256);
+        REQUIRE(extractor.members()[1].path == "lib/helper.rb");
+    }
+
+    SECTION("lists only the last member of a repeated path") {
+        auto archive = tarMember("bin/task.sh", "old")
+                       + tarMember("lib/helper.rb", "helper")
+                       + tarMember("./bin/task.sh", script)
+                       + tarEnd();
+        extractor.extract(archive.data(), archive.size());
+        REQUIRE_NOTHROW(extractor.finish());
+
+        REQUIRE(lth_file::read((dest_dir / "bin" / "task.sh").string()) == script);
+        REQUIRE(extractor.members().size() == 2u);
+        REQUIRE(extractor.members()[0].path == "lib/helper.rb");
+        REQUIRE(extractor.members()[1].path == "bin/task.sh");
+        REQUIRE(extractor.members()[1].sha256 == SCRIPT_SHA256);
+    }
+
+    SECTION("extracts an archive fed in small chunks") {
+        auto archive = tarMember("task.sh", script) + tarMember("data", std::string(3000, 'y')) + tarEnd();
+        for (size_t i = 0; i < archive.size(); i += 100)
+            extractor.extract(archive.data() + i, std::min<size_t>(100, archive.size() - i));
+        REQUIRE_NOTHROW(extractor.finish());
+        REQUIRE(lth_file::read((dest_dir / "task.sh").string()) == script);
+        REQUIRE(fs::file_size(dest_dir / "data") == 3000u);
+    }
+
+    SECTION("supports GNU long names") {
+        std::string long_name(150, 'n');
+        auto archive = tarMember("././@LongLink", long_name + '\0', 'L')
+                       + tarMember("truncated", script)
+                       + tarEnd();
+        extractor.extract(archive.data(), archive.size());
+        REQUIRE(extractor.members().size() == 1u);
+        REQUIRE(extractor.members()[0].path == long_name);
+        REQUIRE(fs::exists(dest_dir / long_name));
+    }
+
+    SECTION("supports pax paths") {
+        auto archive = tarMember("PaxHeaders/x", "20 path=pax/task.sh\n", 'x')
+                       + tarMember("ignored", script)
+                       + tarEnd();
+        extractor.extract(archive.data(), archive.size());
+        REQUIRE(extractor.members().size() == 1u);
+        REQUIRE(extractor.members()[0].path == "pax/task.sh");
+    }
+
+    SECTION("throws an Error for paths escaping the destination directory") {
+        auto archive = tarMember("../evil", script);
+        REQUIRE_THROWS_AS(extractor.extract(archive.data(), archive.size()),
+                          TarExtractor::Error);
+        REQUIRE_FALSE(fs::exists(dest_dir.parent_path() / "evil"));
+
+        auto absolute_archive = tarMember("/tmp/evil", script);
+        REQUIRE_THROWS_AS(extractor.extract(absolute_archive.data(), absolute_archive.size()),
+                          TarExtractor::Error);
+    }
+
+    SECTION("throws an Error for links") {
+        auto archive = tarMember("link", "", '2');
+        REQUIRE_THROWS_AS(extractor.extract(archive.data(), archive.size()),
+                          TarExtractor::Error);
+    }
+
+    SECTION("throws an Error for an invalid header") {
+        std::string not_tar(512, 'z');
+        REQUIRE_THROWS_AS(extractor.extract(not_tar.data(), not_tar.size()),
+                          TarExtractor::Error);
+    }
+
+    SECTION("finish throws an Error if the archive is truncated") {
+        auto archive = tarMember("task.sh", script);
+        extractor.extract(archive.data(), 600);
+        REQUIRE_THROWS_AS(extractor.finish(), TarExtractor::Error);
+    }
+
+    SECTION("reset removes the extracted content") {
+        auto archive = tarMember("task.sh", script);
+        extractor.extract(archive.data(), archive.size());
+        extractor.reset();
+        REQUIRE_FALSE(fs::exists(dest_dir));
+        REQUIRE(extractor.members().empty());
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,93 @@
+#include <pxp-agent/util/task_cache_index.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <ctime>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+TEST_CASE("TaskCacheIndex", "[util]") {
+    auto cache_dir = fs::temp_directory_path() / fs::unique_path("pxp_index_test_%%%%-%%%%");
+    lth_util::scope_exit cache_remover { [&cache_dir]() { fs::remove_all(cache_dir); } };
+
+    fs::create_directories(cache_dir / "sha_a");
+    lth_file::atomic_write_to_file("task a", (cache_dir / "sha_a" / "task").string());
+    lth_file::atomic_write_to_file("partial", (cache_dir / "sha_a" / "partial_task_other").string());
+    fs::create_directories(cache_dir / "sha_b");
+    lth_file::atomic_write_to_file("task b", (cache_dir / "sha_b" / "task").string());
+
+    TaskCacheIndex index { cache_dir };
+    fs::path path;
+
+    SECTION("indexes the cached files, ignoring the partial ones, as not verified") {
+        index.load();
+        REQUIRE(index.numFiles() == 2u);
+        REQUIRE_FALSE(index.lookupVerified("sha_a", "task", path));
+        REQUIRE(index.lastUse("sha_a") == 0);
+    }
+
+    SECTION("does not fail if the cache directory does not exist") {
+        TaskCacheIndex missing_index { cache_dir / "missing" };
+        REQUIRE_NOTHROW(missing_index.load());
+        REQUIRE(missing_index.numFiles() == 0u);
+    }
+
+    SECTION("returns verified files and records their use") {
+        index.load();
+        index.addVerified("sha_a", "task", cache_dir / "sha_a" / "task", 6);
+        REQUIRE(index.lookupVerified("sha_a", "task", path));
+        REQUIRE(path == cache_dir / "sha_a" / "task");
+        REQUIRE(index.lastUse("sha_a") > 0);
+        REQUIRE_FALSE(index.lookupVerified("sha_a", "other", path));
+    }
+
+    SECTION("persists the last use lazily, when flushing") {
+        index.load();
+        std::time_t old_time { time(nullptr) - 3600 };
+        fs::last_write_time(cache_dir / "sha_a", old_time);
+
+        index.addVerified("sha_a", "task", cache_dir / "sha_a" / "task", 6);
+        REQUIRE(fs::last_write_time(cache_dir / "sha_a") == old_time);
+
+        index.flush();
+        REQUIRE(fs::last_write_time(cache_dir / "sha_a") == index.lastUse("sha_a"));
+    }
+
+    SECTION("forgets removed tasks") {
+        index.load();
+        index.addVerified("sha_b", "task", cache_dir / "sha_b" / "task", 6);
+        index.remove("sha_b");
+        REQUIRE_FALSE(index.lookupVerified("sha_b", "task", path));
+        REQUIRE(index.lastUse("sha_b") == 0);
+        REQUIRE(index.numFiles() == 1u);
+    }
+
+    SECTION("removes a task only if it was not used since the specified time") {
+        index.load();
+        std::time_t old_time { time(nullptr) - 3600 };
+        REQUIRE(index.removeIfUnusedSince("sha_b", old_time));
+        REQUIRE(index.numFiles() == 1u);
+        REQUIRE(index.removeIfUnusedSince("sha_b", old_time));
+
+        index.addVerified("sha_a", "task", cache_dir / "sha_a" / "task", 6);
+        // The use is not persisted yet
+        REQUIRE_FALSE(index.removeIfUnusedSince("sha_a", time(nullptr)));
+        index.flush();
+        REQUIRE_FALSE(index.removeIfUnusedSince("sha_a", old_time));
+        REQUIRE(index.removeIfUnusedSince("sha_a", index.lastUse("sha_a")));
+        REQUIRE_FALSE(index.lookupVerified("sha_a", "task", path));
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,44 @@
+#include <pxp-agent/util/token_bucket.hpp>
+
+#include <cpp-pcp-client/util/chrono.hpp>
+
+#include <catch.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace pcp_util = PCPClient::Util;
+
+static int64_t elapsedMilliseconds(pcp_util::chrono::steady_clock::time_point start)
+{
+    return pcp_util::chrono::duration_cast<pcp_util::chrono::milliseconds>(
+        pcp_util::chrono::steady_clock::now() - start).count();
+}
+
+TEST_CASE("TokenBucket::consume", "[util]") {
+    SECTION("does not wait if the rate is unlimited") {
+        TokenBucket bucket { 0 };
+        auto start = pcp_util::chrono::steady_clock::now();
+        bucket.consume(100000000);
+        REQUIRE(elapsedMilliseconds(start) < 100);
+    }
+
+    SECTION("does not wait while there are enough tokens") {
+        TokenBucket bucket { 1000000 };
+        auto start = pcp_util::chrono::steady_clock::now();
+        bucket.consume(500000);
+        bucket.consume(400000);
+        REQUIRE(elapsedMilliseconds(start) < 100);
+    }
+
+    SECTION("waits for the missing tokens at the specified rate") {
+        TokenBucket bucket { 1000000 };
+        auto start = pcp_util::chrono::steady_clock::now();
+        bucket.consume(1000000);
+        bucket.consume(300000);
+        REQUIRE(elapsedMilliseconds(start) >= 250);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
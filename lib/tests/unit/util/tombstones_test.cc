@@ -0,0 +1,78 @@
+#include <pxp-agent/util/tombstones.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+static size_t numEntries(const fs::path& dir_path)
+{
+    if (!fs::exists(dir_path))
+        return 0;
+    return std::distance(fs::directory_iterator { dir_path }, fs::directory_iterator {});
+}
+
+TEST_CASE("Tombstones", "[util]") {
+    auto root_dir = fs::temp_directory_path() / fs::unique_path("pxp_tombstones_test_%%%%-%%%%");
+    lth_util::scope_exit root_remover { [&root_dir]() { fs::remove_all(root_dir); } };
+
+    for (auto name : { "dir_a", "dir_b" }) {
+        fs::create_directories(root_dir / name / "nested");
+        lth_file::atomic_write_to_file("content", (root_dir / name / "nested" / "file").string());
+    }
+
+    Tombstones tombstones { root_dir / ".tombstones" };
+
+    SECTION("bury moves the directory to the tombstone directory") {
+        tombstones.bury(root_dir / "dir_a");
+        REQUIRE_FALSE(fs::exists(root_dir / "dir_a"));
+        REQUIRE(numEntries(root_dir / ".tombstones") == 1u);
+    }
+
+    SECTION("bury can be called for directories with the same name") {
+        tombstones.bury(root_dir / "dir_a");
+        fs::create_directories(root_dir / "dir_a");
+        tombstones.bury(root_dir / "dir_a");
+        REQUIRE(numEntries(root_dir / ".tombstones") == 2u);
+    }
+
+    SECTION("bury throws an Error if the directory does not exist") {
+        REQUIRE_THROWS_AS(tombstones.bury(root_dir / "missing"), Tombstones::Error);
+    }
+
+    SECTION("reap deletes the tombstones in the background") {
+        tombstones.bury(root_dir / "dir_a");
+        tombstones.bury(root_dir / "dir_b");
+        tombstones.reap();
+        tombstones.waitForReaping();
+        REQUIRE(numEntries(root_dir / ".tombstones") == 0u);
+    }
+
+    SECTION("reap deletes the tombstones of a previous run") {
+        {
+            Tombstones previous_tombstones { root_dir / ".tombstones" };
+            previous_tombstones.bury(root_dir / "dir_a");
+        }
+
+        tombstones.reap();
+        tombstones.waitForReaping();
+        REQUIRE(numEntries(root_dir / ".tombstones") == 0u);
+    }
+
+    SECTION("reap does not fail if there are no tombstones") {
+        tombstones.reap();
+        REQUIRE_NOTHROW(tombstones.waitForReaping());
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent
@@ -0,0 +1,125 @@
+#include <pxp-agent/util/vcdiff_decoder.hpp>
+
+#include <leatherman/util/scope_exit.hpp>
+#include <leatherman/file_util/file.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+
+namespace PXPAgent {
+namespace Util {
+
+namespace fs = boost::filesystem;
+namespace lth_util = leatherman::util;
+namespace lth_file = leatherman::file_util;
+
+static const std::string VCDIFF_HEADER { "\xD6\xC3\xC4\x00\x00", 5 };
+
+static std::string varint(uint64_t value)
+{
+    std::string bytes(1, static_cast<char>(value & 0x7f));
+    while (value >>= 7)
+        bytes.insert(bytes.begin(), static_cast<char>(0x80 | (value & 0x7f)));
+    return bytes;
+}
+
+// Returns an encoded window; the source segment is included if the
+// VCD_SOURCE bit (0x01) of the indicator is set, the checksum if the
+// VCD_ADLER32 one (0x04) is
+static std::string vcdiffWindow(char indicator,
+                                uint64_t source_size,
+                                uint64_t source_position,
+                                uint64_t target_size,
+                                const std::string& data,
+                                const std::string& instructions,
+                                const std::string& addresses,
+                                const std::string& checksum = "")
+{
+    auto encoding = varint(target_size) + std::string(1, '\0')
+                    + varint(data.size()) + varint(instructions.size()) + varint(addresses.size())
+                    + checksum + data + instructions + addresses;
+    std::string window(1, indicator);
+    if (indicator & 0x01)
+        window += varint(source_size) + varint(source_position);
+    return window + varint(encoding.size()) + encoding;
+}
+
+TEST_CASE("VcdiffDecoder::decode", "[util]") {
+    auto base_path = fs::temp_directory_path() / fs::unique_path("pxp_vcdiff_test_%%%%-%%%%");
+    lth_util::scope_exit base_remover { [&base_path]() { fs::remove(base_path); } };
+    lth_file::atomic_write_to_file("0123456789abcdefghij", base_path.string());
+
+    std::string target;
+    auto output = [&target](const char* data, size_t size) { target.append(data, size); };
+
+    // COPY 10 from 0 (mode 0), ADD "XY", COPY 10 from 10 (mode 0),
+    // RUN 5 'Z', ADD "XY", COPY 6 from 2 bytes back (mode HERE)
+    auto source_window = vcdiffWindow('\x01', 20, 0, 35,
+                                      "XYZXY",
+                                      std::string { 26, 3, 26, 0, 5, 3, 38 },
+                                      std::string { 0, 10, 2 });
+
+    SECTION("copies from the base file, adds, runs, and copies overlapping data") {
+        REQUIRE_NOTHROW(VcdiffDecoder::decode(VCDIFF_HEADER + source_window, base_path, output));
+        REQUIRE(target == "0123456789XYabcdefghijZZZZZXYXYXYXY");
+    }
+
+    SECTION("decodes multiple windows and verifies their checksum") {
+        // adler32 of "!\n"
+        auto checksum_window = vcdiffWindow('\x04', 0, 0, 2, "!\n", std::string { 3 }, "",
+                                            std::string { 0x00, 0x4E, 0x00, 0x2C });
+        VcdiffDecoder::decode(VCDIFF_HEADER + source_window + checksum_window, base_path, output);
+        REQUIRE(target == "0123456789XYabcdefghijZZZZZXYXYXYXY!\n");
+    }
+
+    SECTION("decodes sizes encoded on multiple bytes") {
+        auto run_window = vcdiffWindow('\0', 0, 0, 300, "a", std::string { 0 } + varint(300), "");
+        VcdiffDecoder::decode(VCDIFF_HEADER + run_window, base_path, output);
+        REQUIRE(target == std::string(300, 'a'));
+    }
+
+    SECTION("throws an Error if the delta is not in the VCDIFF format") {
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode("BSDIFF40", base_path, output),
+                          VcdiffDecoder::Error);
+    }
+
+    SECTION("throws an Error if secondary compression is used") {
+        std::string header { "\xD6\xC3\xC4\x00\x01\x02", 6 };
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode(header + source_window, base_path, output),
+                          VcdiffDecoder::Error);
+    }
+
+    SECTION("throws an Error if the delta refers to data beyond the end of the base file") {
+        auto window = vcdiffWindow('\x01', 30, 0, 10, "",
+                                   std::string { 26 }, std::string { 0 });
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode(VCDIFF_HEADER + window, base_path, output),
+                          VcdiffDecoder::Error);
+    }
+
+    SECTION("throws an Error if a window checksum doesn't match") {
+        auto window = vcdiffWindow('\x04', 0, 0, 2, "!\n", std::string { 3 }, "",
+                                   std::string { 0x00, 0x00, 0x00, 0x01 });
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode(VCDIFF_HEADER + window, base_path, output),
+                          VcdiffDecoder::Error);
+        REQUIRE(target.empty());
+    }
+
+    SECTION("throws an Error if a window is truncated") {
+        auto truncated = VCDIFF_HEADER + source_window.substr(0, source_window.size() - 1);
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode(truncated, base_path, output),
+                          VcdiffDecoder::Error);
+    }
+
+    SECTION("throws an Error if the base file doesn't exist") {
+        REQUIRE_THROWS_AS(VcdiffDecoder::decode(VCDIFF_HEADER + source_window,
+                                                base_path.string() + ".missing",
+                                                output),
+                          VcdiffDecoder::Error);
+    }
+}
+
+}  // namespace Util
+}  // namespace PXPAgent